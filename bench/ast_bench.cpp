@@ -0,0 +1,309 @@
+/**
+ * @file ast_bench.cpp
+ * @brief AST相关的性能测试. 比较旧的std::list<std::shared_ptr>子节点存储与现在连续存储的差别，
+ * 比较dynamic_cast与NodeKind类型判断的差别，并在一个自动生成的大型Pascal程序上测量语法分析与代码生成的耗时
+ *
+ * 用法: ast_bench [语句数量，默认200000]
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include "utils/ast.hpp"
+#include "codegen/codegen_context.hpp"
+#include "utils/parser.hpp"
+
+using namespace spc;
+
+namespace
+{
+    /// 每个begin...end语句块中的语句数量
+    constexpr int block_size = 8;
+
+    /**
+     * @brief 计时工具 返回执行给定函数所用的毫秒数
+     */
+    template<typename Func>
+    double time_ms(Func &&func)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - begin).count();
+    }
+
+    void report(const char *name, double ms)
+    {
+        std::printf("  %-40s %10.2f ms\n", name, ms);
+    }
+
+    /// 旧版本AST节点的子节点存储方式，仅用于对比
+    struct LegacyNode : public std::enable_shared_from_this<LegacyNode>
+    {
+        std::list<std::shared_ptr<LegacyNode>> children;
+        std::weak_ptr<LegacyNode> parent;
+        int val = 0;
+
+        void add_child(const std::shared_ptr<LegacyNode> &node)
+        {
+            children.push_back(node);
+            node->parent = shared_from_this();
+        }
+
+        void lift_children(const std::shared_ptr<LegacyNode> &node)
+        {
+            for (const auto &e : node->children) add_child(e);
+        }
+    };
+
+    long long walk(const LegacyNode &node)
+    {
+        if (node.children.empty()) return node.val;
+        long long sum = 0;
+        for (const auto &child : node.children) sum += walk(*child);
+        return sum;
+    }
+
+    long long walk(const AbstractNode *node)
+    {
+        if (node->_children.empty()) return static_cast<const IntegerNode *>(node)->val;
+        long long sum = 0;
+        for (const auto *child : node->_children) sum += walk(child);
+        return sum;
+    }
+
+    /**
+     * @brief 按语法分析的方式(语句先放进临时列表，再提升到语句块中)构建同样形状的两棵树，比较建树与遍历的耗时
+     */
+    void bench_children(int statements)
+    {
+        std::puts("children storage (synthetic tree):");
+
+        std::shared_ptr<LegacyNode> legacy_root;
+        auto legacy_build = time_ms([&] {
+            legacy_root = std::make_shared<LegacyNode>();
+            for (int i = 0; i < statements; i += block_size)
+            {
+                auto list = std::make_shared<LegacyNode>();
+                for (int j = 0; j < block_size; ++j)
+                {
+                    auto stmt = std::make_shared<LegacyNode>();
+                    auto lhs = std::make_shared<LegacyNode>(); lhs->val = i;
+                    auto rhs = std::make_shared<LegacyNode>(); rhs->val = j;
+                    stmt->add_child(lhs);
+                    stmt->add_child(rhs);
+                    list->add_child(stmt);
+                }
+                auto compound = std::make_shared<LegacyNode>();
+                compound->lift_children(list);
+                legacy_root->add_child(compound);
+            }
+        });
+        long long legacy_sum = 0;
+        auto legacy_walk = time_ms([&] { legacy_sum = walk(*legacy_root); });
+        auto legacy_free = time_ms([&] { legacy_root.reset(); });
+
+        NodeArena *arena = new NodeArena;
+        AbstractNode *root = nullptr;
+        auto arena_build = time_ms([&] {
+            NodeArena::Scope scope(*arena);
+            root = make_node<CompoundStmtNode>();
+            for (int i = 0; i < statements; i += block_size)
+            {
+                auto list = make_node<StmtList>();
+                for (int j = 0; j < block_size; ++j)
+                {
+                    auto stmt = make_node<ArgListNode>();
+                    stmt->add_child(make_node<IntegerNode>(i));
+                    stmt->add_child(make_node<IntegerNode>(j));
+                    list->add_child(stmt);
+                }
+                auto compound = make_node<CompoundStmtNode>();
+                compound->lift_children(list);
+                root->add_child(compound);
+            }
+        });
+        long long arena_sum = 0;
+        auto arena_walk = time_ms([&] { arena_sum = walk(root); });
+        auto arena_free = time_ms([&] { delete arena; });
+
+        if (legacy_sum != arena_sum)
+        { std::fprintf(stderr, "checksum mismatch: %lld != %lld\n", legacy_sum, arena_sum); std::exit(1); }
+
+        report("build  list<shared_ptr>", legacy_build);
+        report("build  arena + NodeList", arena_build);
+        report("walk   list<shared_ptr>", legacy_walk);
+        report("walk   arena + NodeList", arena_walk);
+        report("free   list<shared_ptr>", legacy_free);
+        report("free   arena + NodeList", arena_free);
+    }
+
+    /// 节点类型统计 用dynamic_cast实现(旧的is_a_ptr_of)
+    long long count_by_dynamic_cast(const std::vector<AbstractNode *> &nodes)
+    {
+        long long count = 0;
+        for (const auto *node : nodes)
+        {
+            count += dynamic_cast<const ExprNode *>(node) != nullptr;
+            count += dynamic_cast<const LeftValueExprNode *>(node) != nullptr;
+            count += dynamic_cast<const ConstValueNode *>(node) != nullptr;
+            count += dynamic_cast<const TypeNode *>(node) != nullptr;
+            count += dynamic_cast<const StmtNode *>(node) != nullptr;
+        }
+        return count;
+    }
+
+    /// 节点类型统计 用NodeKind实现
+    long long count_by_kind(const std::vector<AbstractNode *> &nodes)
+    {
+        long long count = 0;
+        for (const auto *node : nodes)
+        {
+            count += is_a_ptr_of<ExprNode>(node);
+            count += is_a_ptr_of<LeftValueExprNode>(node);
+            count += is_a_ptr_of<ConstValueNode>(node);
+            count += is_a_ptr_of<TypeNode>(node);
+            count += is_a_ptr_of<StmtNode>(node);
+        }
+        return count;
+    }
+
+    /// 旧版本TypeNode::get_llvm_type的dynamic_cast链，仅用于对比
+    llvm::Type *legacy_get_llvm_type(const TypeNode *node, CodegenContext &context)
+    {
+        if (auto *simple_type = dynamic_cast<const SimpleTypeNode *>(node))
+        {
+            return simple_type->type == Type::INTEGER ? context.builder.getInt32Ty()
+                                                      : context.builder.getDoubleTy();
+        }
+        else if (auto *array_type = dynamic_cast<const ArrayTypeNode *>(node))
+        {
+            auto itemtype = legacy_get_llvm_type(array_type->element_type, context);
+            return llvm::ArrayType::get(itemtype, array_type->range->length);
+        }
+        else if (dynamic_cast<const AliasTypeNode *>(node))
+        {
+            return nullptr;
+        }
+        else if (auto *record_type = dynamic_cast<const RecordTypeNode *>(node))
+        {
+            auto it = context.record_types.find(record_type);
+            return it == context.record_types.end() ? nullptr : it->second;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 在一组混合的节点上比较dynamic_cast与NodeKind类型判断的耗时
+     */
+    void bench_kind(int statements)
+    {
+        std::puts("node kind checks (synthetic nodes):");
+        constexpr int rounds = 10;
+        NodeArena arena;
+        NodeArena::Scope scope(arena);
+        std::vector<AbstractNode *> nodes;
+        std::vector<TypeNode *> types;
+        for (int i = 0; i < statements; ++i)
+        {
+            auto id = make_node<IdentifierNode>(arena.symbols().intern("x"));
+            auto value = make_node<IntegerNode>(i);
+            auto binop = make_node<BinopExprNode>(BinaryOperator::ADD, id, value);
+            auto simple = make_node<SimpleTypeNode>(i % 2 ? Type::INTEGER : Type::REAL);
+            auto array = make_node<ArrayTypeNode>(
+                    make_node<RangeNode>(make_node<IntegerNode>(1), make_node<IntegerNode>(10)), simple);
+            nodes.insert(nodes.end(), {id, value, binop, simple, array, make_node<AssignStmtNode>(id, binop)});
+            types.push_back(i % 4 ? static_cast<TypeNode *>(simple) : array);
+        }
+
+        long long legacy_count = 0, kind_count = 0;
+        report("is_a_ptr_of  dynamic_cast", time_ms([&] {
+            for (int r = 0; r < rounds; ++r) legacy_count += count_by_dynamic_cast(nodes);
+        }));
+        report("is_a_ptr_of  NodeKind", time_ms([&] {
+            for (int r = 0; r < rounds; ++r) kind_count += count_by_kind(nodes);
+        }));
+        if (legacy_count != kind_count)
+        { std::fprintf(stderr, "checksum mismatch: %lld != %lld\n", legacy_count, kind_count); std::exit(1); }
+
+        CodegenContext context("bench", false);
+        size_t legacy_hash = 0, kind_hash = 0;
+        report("get_llvm_type  dynamic_cast", time_ms([&] {
+            for (int r = 0; r < rounds; ++r)
+                for (auto *type : types) legacy_hash += reinterpret_cast<size_t>(legacy_get_llvm_type(type, context));
+        }));
+        report("get_llvm_type  NodeKind", time_ms([&] {
+            for (int r = 0; r < rounds; ++r)
+                for (auto *type : types) kind_hash += reinterpret_cast<size_t>(type->get_llvm_type(context));
+        }));
+        if (legacy_hash != kind_hash)
+        { std::fprintf(stderr, "get_llvm_type mismatch\n"); std::exit(1); }
+    }
+
+    /**
+     * @brief 生成一个有statements条语句的Pascal程序
+     */
+    std::string generate_program(int statements)
+    {
+        std::string source = "program bench;\n"
+                             "var i, j, sum: integer;\n"
+                             "    a: array[1..100] of integer;\n"
+                             "begin\n"
+                             "  sum := 0; i := 1; j := 2;\n";
+        for (int i = 0; i < statements; i += block_size)
+        {
+            source += "  begin\n"
+                      "    sum := sum + i * 3 - j div 2;\n"
+                      "    if sum > 1000 then sum := sum - 1000 else sum := sum + 1;\n"
+                      "    a[i] := sum mod 100;\n"
+                      "    j := a[i] + j;\n"
+                      "    while j > 10 do j := j - 10;\n"
+                      "    i := i + 1;\n"
+                      "    if i > 100 then i := 1;\n"
+                      "    sum := (sum + j) * 2 - i;\n"
+                      "  end;\n";
+        }
+        source += "end.\n";
+        return source;
+    }
+
+    /**
+     * @brief 在生成的程序上测量语法分析与代码生成
+     */
+    void bench_compile(int statements)
+    {
+        std::puts("parse + codegen (synthetic program):");
+        auto source = generate_program(statements);
+
+        NodeArena arena;
+        NodeArena::Scope scope(arena); //代码生成时也会创建临时节点
+        ParserState state(arena);
+        AbstractNode *program = nullptr;
+        report("parse", time_ms([&] { program = parse(source, state); }));
+        if (program == nullptr)
+        { std::fprintf(stderr, "failed to parse the generated program\n"); std::exit(1); }
+        std::printf("  %-40s %10zu\n", "nodes", arena.size());
+        std::printf("  %-40s %10zu KiB\n", "arena memory", arena.bytes_allocated() / 1024);
+
+        CodegenContext context("bench", false);
+        report("codegen", time_ms([&] { program->codegen(context); }));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int statements = argc > 1 ? std::atoi(argv[1]) : 200000;
+    if (statements <= 0)
+    { std::fprintf(stderr, "USAGE: ast_bench [statements]\n"); return 1; }
+    std::printf("statements: %d\n", statements);
+    bench_children(statements);
+    bench_kind(statements);
+    bench_compile(statements);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file interp_bench.cpp
+ * @brief 比较字节码解释器(spc -interp)，分层执行(spc -tiered)与LLVM JIT(spc -run)从读入源文件到程序结束的端到端耗时.
+ * 每种方式各执行若干次取中位数，程序的输出重定向到/dev/null，标准输入为空
+ *
+ * 用法: interp_bench [-n 次数，默认20] <source.pas>...
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "driver/compiler.h"
+#include "driver/interp.h"
+#include "driver/jit.h"
+
+using namespace spc;
+
+namespace
+{
+    /**
+     * @brief 执行count次，返回耗时的中位数(毫秒) 执行期间标准输出重定向到/dev/null
+     */
+    double median_ms(int count, const std::function<int()> &func, int &status)
+    {
+        std::vector<double> samples;
+        std::fflush(stdout);
+        int saved = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        for (int i = 0; i < count; ++i)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            status = func();
+            std::fflush(stdout);
+            auto end = std::chrono::steady_clock::now();
+            samples.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+        }
+        dup2(saved, STDOUT_FILENO);
+        close(null);
+        close(saved);
+        std::sort(samples.begin(), samples.end());
+        return samples[samples.size() / 2];
+    }
+
+    void report(const char *name, double ms, int status)
+    {
+        std::printf("  %-40s %10.2f ms%s\n", name, ms, status == 0 ? "" : "  (failed)");
+    }
+
+    void bench_file(const std::string &file, int count)
+    {
+        std::printf("%s\n", file.c_str());
+        std::ostringstream diagnostics;
+        int status = 0;
+        auto ms = median_ms(count, [&] { return interpret_program(file, diagnostics); }, status);
+        report("interpreter (-interp)", ms, status);
+
+        TierOptions tier;
+        tier.enabled = true;
+        ms = median_ms(count, [&] { return interpret_program(file, diagnostics, tier); }, status);
+        report("tiered (-tiered)", ms, status);
+
+        CompileOptions options;
+        options.optimization = OptLevel::O0;
+        ms = median_ms(count, [&] { return run_program(file, options, RunOptions(), {}, diagnostics); }, status);
+        report("LLVM JIT (-run)", ms, status);
+
+        options.optimization = OptLevel::O2;
+        ms = median_ms(count, [&] { return run_program(file, options, RunOptions(), {}, diagnostics); }, status);
+        report("LLVM JIT (-run -O2)", ms, status);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int count = 20;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) count = std::atoi(argv[++i]);
+        else files.push_back(argv[i]);
+    }
+    if (files.empty() || count <= 0)
+    { std::fprintf(stderr, "USAGE: interp_bench [-n count] <source.pas>...\n"); return 1; }
+
+    //程序读标准输入时立即遇到文件结尾
+    int null = open("/dev/null", O_RDONLY);
+    dup2(null, STDIN_FILENO);
+    close(null);
+
+    std::printf("median of %d runs\n", count);
+    for (const auto &file : files) bench_file(file, count);
+    return 0;
+}
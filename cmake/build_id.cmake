@@ -0,0 +1,32 @@
+# 生成spc::build_id(OUTPUT): spc的源代码、构建脚本与嵌入的运行时库bitcode的哈希
+# 用法: cmake -DROOT=<源代码目录> -DINPUTS=<文件列表> -DBITCODE=spcrt_bitcode.cpp -DOUTPUT=spc_build_id.cpp -P build_id.cmake
+# INPUTS中每行一个源代码目录中的文件，BITCODE是embed_bitcode.cmake生成的文件；
+# 编译缓存的键包含build_id，任何一个文件改变后之前缓存的结果都不再使用
+file(STRINGS "${INPUTS}" files)
+list(SORT files)
+set(digests "")
+foreach(path ${files})
+    if(EXISTS "${path}")
+        file(SHA256 "${path}" digest)
+    else()
+        set(digest "missing")
+    endif()
+    # 用相对路径，同样的源代码在不同的目录中构建得到同样的build_id
+    file(RELATIVE_PATH name "${ROOT}" "${path}")
+    string(APPEND digests "${name} ${digest}\n")
+endforeach()
+if(EXISTS "${BITCODE}")
+    file(SHA256 "${BITCODE}" digest)
+    string(APPEND digests "runtime bitcode ${digest}\n")
+endif()
+string(SHA256 id "${digests}")
+file(WRITE "${OUTPUT}.tmp"
+"// 由cmake/build_id.cmake生成，不要修改
+namespace spc
+{
+    extern const char build_id[] = \"${id}\";
+}
+")
+# 内容不变时不更新文件，避免重新编译
+configure_file("${OUTPUT}.tmp" "${OUTPUT}" COPYONLY)
+file(REMOVE "${OUTPUT}.tmp")
@@ -0,0 +1,33 @@
+# 把运行时库的bitcode(INPUT)写成C++数组(OUTPUT)，定义spc::runtime_bitcode与spc::runtime_bitcode_size
+# 用法: cmake -DINPUT=spcrt.bc -DOUTPUT=spcrt_bitcode.cpp -P embed_bitcode.cmake
+# INPUT不存在(构建环境中没有clang)时数组为空，spc不链接运行时库的bitcode
+if(EXISTS "${INPUT}")
+    file(READ "${INPUT}" content HEX)
+else()
+    set(content "")
+endif()
+string(LENGTH "${content}" length)
+math(EXPR size "${length} / 2")
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${content}")
+# 每行16个字节 CMake的正则表达式不支持{n}
+set(line "0x[0-9a-f][0-9a-f],0x[0-9a-f][0-9a-f],0x[0-9a-f][0-9a-f],0x[0-9a-f][0-9a-f],")
+string(REGEX REPLACE "(${line}${line}${line}${line})" "\\1\n    " bytes "${bytes}")
+if(size EQUAL 0)
+    set(bytes "0")
+endif()
+file(WRITE "${OUTPUT}.tmp"
+"// 由cmake/embed_bitcode.cmake生成，不要修改
+#include <cstddef>
+
+namespace spc
+{
+    //bitcode按32位的字读取，保证4字节对齐
+    alignas(4) extern const unsigned char runtime_bitcode[] = {
+    ${bytes}
+    };
+    extern const size_t runtime_bitcode_size = ${size};
+}
+")
+# 内容不变时不更新文件，避免重新编译
+configure_file("${OUTPUT}.tmp" "${OUTPUT}" COPYONLY)
+file(REMOVE "${OUTPUT}.tmp")
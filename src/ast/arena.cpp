@@ -0,0 +1,24 @@
+/**
+ * @file arena.cpp
+ * @brief 节点内存池的实现
+ * @version 0.1
+ * @date 2021-06-02
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "arena.h"
+#include "ast_base.h"
+
+using namespace spc;
+
+thread_local NodeArena *NodeArena::_current = nullptr;
+
+NodeArena::~NodeArena()
+{
+    //节点之间只保存裸指针 析构时不会访问其他节点，这里只需要把每个节点自己持有的资源(字符串，容器等)释放掉
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it)
+    {
+        (*it)->~AbstractNode();
+    }
+}
@@ -0,0 +1,98 @@
+/**
+ * @file arena.h
+ * @brief AST节点的内存池. 一次编译中生成的所有语义节点都从这里分配，编译结束时一次性释放.
+ * 节点中的标识符指向内存池的标识符池，所以标识符池也由内存池持有
+ * @version 0.1
+ * @date 2021-06-02
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_ARENA_H
+#define NAIVE_PASCAL_COMPILER_ARENA_H
+
+#include <cassert>
+#include <new>
+#include <utility>
+#include <vector>
+#include <llvm/Support/Allocator.h>
+#include "symbol_pool.h"
+
+namespace spc
+{
+    struct AbstractNode;
+    /**
+     * @brief 节点内存池(bump allocator)
+     * 节点只会在这里顺序分配，不会单独释放；内存池析构时按创建顺序的逆序调用各节点的析构函数，然后整块归还内存
+     */
+    class NodeArena final
+    {
+    public:
+        NodeArena() = default;
+        NodeArena(const NodeArena &) = delete;
+        NodeArena &operator=(const NodeArena &) = delete;
+        ~NodeArena();
+
+        /**
+         * @brief 在内存池中构造一个节点
+         *
+         * @tparam NodeType 节点类型
+         * @tparam Args
+         * @param args 节点构造函数的参数
+         * @return NodeType* 节点指针，它的生命周期与内存池相同
+         */
+        template<typename NodeType, typename...Args>
+        NodeType *create(Args &&...args)
+        {
+            void *mem = allocator.Allocate(sizeof(NodeType), alignof(NodeType));
+            auto *node = new(mem) NodeType(std::forward<Args>(args)...);
+            nodes.push_back(node);
+            return node;
+        }
+        /// 已分配的节点数量
+        size_t size() const noexcept
+        { return nodes.size(); }
+        /// 已占用的内存字节数
+        size_t bytes_allocated() const noexcept
+        { return allocator.getBytesAllocated(); }
+        /// 本次编译的标识符池
+        SymbolPool &symbols() noexcept
+        { return pool; }
+
+        /**
+         * @brief 返回当前线程正在使用的内存池 make_node会从这里分配节点
+         *
+         * @return NodeArena&
+         */
+        static NodeArena &current() noexcept
+        {
+            assert(_current != nullptr && "no NodeArena is active on this thread");
+            return *_current;
+        }
+        /**
+         * @brief 在一个作用域内把给定的内存池设置为当前内存池，离开作用域时恢复原来的内存池
+         *
+         */
+        class Scope final
+        {
+        public:
+            explicit Scope(NodeArena &arena) : previous(_current)
+            { _current = &arena; }
+            Scope(const Scope &) = delete;
+            Scope &operator=(const Scope &) = delete;
+            ~Scope()
+            { _current = previous; }
+        private:
+            NodeArena *previous;
+        };
+
+    private:
+        llvm::BumpPtrAllocator allocator;
+        /// 按创建顺序记录的节点 析构时使用
+        std::vector<AbstractNode *> nodes;
+        SymbolPool pool;
+        static thread_local NodeArena *_current;
+    };
+}
+
+#endif //NAIVE_PASCAL_COMPILER_ARENA_H
@@ -49,4 +49,8 @@ string SysCallNode::json_head()const{
 
 SysCallNode::SysCallNode(const NodePtr &routine, const NodePtr &args)
                 : routine(cast_node<SysRoutineNode>(routine)), args(cast_node<ArgListNode>(args))
-        {}
\ No newline at end of file
+        {}
+
+SysCallNode::SysCallNode(const NodePtr &routine)
+                : SysCallNode(routine, make_node<ArgListNode>())
+        {}
@@ -17,12 +17,14 @@
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <locale>
 #include <fmt/core.h>
-#include <list>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/Value.h>
 #include <typeinfo>
+#include "arena.h"
 
 /**
  * @brief simple pascal compiler 
@@ -87,7 +89,84 @@ namespace spc{
     struct CodegenContext;
 
 
-    using NodePtr = std::shared_ptr<AbstractNode>;
+    using NodePtr = AbstractNode *;
+
+    /**
+     * @brief 语义节点的具体类型. 用来代替dynamic_cast做类型判断(类似LLVM的classof机制)，判断类型只需要比较整数.
+     * 同一个基类的派生类在这里是连续排列的，First/Last标出了每个基类对应的区间，添加新节点时要放在对应区间内
+     */
+    enum class NodeKind : unsigned char
+    {
+        // 左值表达式
+        Identifier,
+        ArrayRef,
+        RecordRef,
+        // 常量
+        Boolean,
+        Integer,
+        Real,
+        Char,
+        String,
+        // 其他表达式
+        BinopExpr,
+        FuncExpr,
+        // 类型
+        SimpleType,
+        StringType,
+        AliasType,
+        ArrayType,
+        RecordType,
+        SetType,
+        // 语句
+        CompoundStmt,
+        AssignStmt,
+        ProcStmt,
+        IfStmt,
+        RepeatStmt,
+        WhileStmt,
+        ForStmt,
+        CaseExpr,
+        CaseStmt,
+        StmtList,
+        // 过程
+        Program,
+        Subroutine,
+        // 其他
+        Range,
+        SysRoutine,
+        SysCall,
+        ArgList,
+        ParamDecl,
+        ParamList,
+        VarDecl,
+        VarList,
+        ConstDecl,
+        ConstList,
+        TypeDef,
+        TypeList,
+        NameList,
+        RoutineCall,
+        SubroutineList,
+        HeadList,
+
+        FirstExpr = Identifier,
+        LastExpr = FuncExpr,
+        FirstLeftValue = Identifier,
+        LastLeftValue = RecordRef,
+        FirstConstValue = Boolean,
+        LastConstValue = String,
+        FirstType = SimpleType,
+        LastType = SetType,
+        FirstStmt = CompoundStmt,
+        LastStmt = StmtList,
+        FirstRoutine = Program,
+        LastRoutine = Subroutine
+    };
+    /// 判断kind是否位于[first, last]区间内
+    inline bool kind_in(NodeKind kind, NodeKind first, NodeKind last) noexcept
+    {
+        return kind >= first && kind <= last;
+    }
 
     //一些类型转换用的函数
     /**
@@ -99,15 +178,9 @@ namespace spc{
      * @return false 
      */
     template<typename NodeType>
-    bool is_a_ptr_of(const std::shared_ptr<AbstractNode> &ptr)
+    bool is_a_ptr_of(const AbstractNode *ptr)
     {
-        auto _p = ptr.get();
-        return dynamic_cast<NodeType *>(_p) != nullptr;
-    }
-
-    inline std::shared_ptr<AbstractNode> wrap_node(AbstractNode *node)
-    {
-        return std::shared_ptr<AbstractNode>{node};
+        return ptr != nullptr && NodeType::classof(ptr);
     }
 
     /**
@@ -115,49 +188,73 @@ namespace spc{
      * 
      * @tparam TNode 
      * @param node 
-     * @return std::enable_if<std::is_base_of<AbstractNode, TNode>::value, std::shared_ptr<TNode>>::type 
+     * @return std::enable_if<std::is_base_of<AbstractNode, TNode>::value, TNode *>::type 
      */
     template<typename TNode>
-    typename std::enable_if<std::is_base_of<AbstractNode, TNode>::value, std::shared_ptr<TNode>>::type
-    cast_node(const std::shared_ptr<AbstractNode> &node)
+    typename std::enable_if<std::is_base_of<AbstractNode, TNode>::value, TNode *>::type
+    cast_node(AbstractNode *node)
     {
        if(is_a_ptr_of<TNode>(node))
-           return std::dynamic_pointer_cast<TNode>(node);
-       //std::string nodeTypeName = typeid(*node.get()).name();
+           return static_cast<TNode *>(node);
+       //std::string nodeTypeName = typeid(*node).name();
        assert(is_a_ptr_of<TNode>(node));
        return nullptr;
     }
     /**
-     * @brief 一个助手函数，生成指定的AST节点，并返回指向此节点的基类指针
+     * @brief 一个助手函数，在当前线程的节点内存池中生成指定的AST节点，并返回指向此节点的指针.
+     * 节点由内存池持有，编译结束时随内存池一起释放，所以不需要(也不可以)手动delete
+     * @see NodeArena
      * 
      * @tparam NodeType 
      * @tparam Args 
      * @param args 
-     * @return std::shared_ptr<AbstractNode> 
+     * @return NodeType* 
      */
     template<typename NodeType, typename...Args>
-    std::shared_ptr<AbstractNode> make_node(Args &&...args)
+    NodeType *make_node(Args &&...args)
     {
-        return std::dynamic_pointer_cast<AbstractNode>(std::make_shared<NodeType>(std::forward<Args>(args)...));
+        auto *node = NodeArena::current().create<NodeType>(std::forward<Args>(args)...);
+        node->_kind = NodeType::static_kind;
+        return node;
     };
 
+    /**
+     * @brief 存放子节点指针的容器. 子节点指针连续存放，少量子节点时直接存放在节点内部，不需要额外的堆分配
+     * 
+     */
+    using NodeList = llvm::SmallVector<AbstractNode *, 4>;
+
     /**
      * @brief 所有AST节点的基类 是一个纯虚基类
      * 
      */
-    struct AbstractNode : public std::enable_shared_from_this<AbstractNode>{
+    struct AbstractNode{
         /**
          * @brief 指向此节点子节点的指针容器
          * 
          */
-        std::list<std::shared_ptr<AbstractNode>> _children;
+        NodeList _children;
+        /**
+         * @brief 指向此节点的父节点 节点都由内存池持有，这里只是一个不持有所有权的指针
+         * 
+         */
+        AbstractNode *_parent = nullptr;
         /**
-         * @brief 指向此节点的父节点，注意为了避免循环引用导致内存泄漏，这里要使用weak——ptr
+         * @brief 节点的具体类型 由make_node设置
          * 
          */
-        std::weak_ptr<AbstractNode> _parent;
+        NodeKind _kind;
 
         virtual ~AbstractNode() noexcept = default;
+        /**
+         * @brief 返回节点的具体类型
+         * 
+         * @return NodeKind 
+         */
+        NodeKind kind() const noexcept
+        { return this->_kind; }
+        static bool classof(const AbstractNode * /*node*/)
+        { return true; }
         /**
          * @brief 调用此函数进行代码生成，每个节点（即此类的派生类）都应重写此虚函数以实现各种语义的代码生成
          * 
@@ -179,16 +276,16 @@ namespace spc{
         /**
          * @brief 如果此节点可以有子节点的话,返回存放子节点的容器
          * 
-         * @return std::list<std::shared_ptr<AbstractNode>>& 
+         * @return NodeList& 
          */
-        std::list<std::shared_ptr<AbstractNode>>& children() noexcept{
+        NodeList& children() noexcept{
             assert(this->should_have_children());
             return this->_children;
         }
         /**
          * @brief 返回此节点的父节点
          * 
-         * @return std::weak_ptr<AbstractNode>
+         * @return AbstractNode*&
          */
         auto& parent() noexcept{
             return this->_parent;
@@ -198,41 +295,38 @@ namespace spc{
          * 
          * @param node 指向子节点的指针
          */
-        virtual void add_child(const std::shared_ptr<AbstractNode> &node)
+        void add_child(AbstractNode *node)
         {
             this->_children.push_back(node);
-            node->parent() = this->shared_from_this();
-        }
-        /**
-         * @brief 添加子节点
-         * 
-         * @param node 指向子节点的指针
-         */
-        virtual void add_child(std::shared_ptr<AbstractNode> &&node)
-        {
-            this->_children.push_back(node);
-            node->parent() = this->shared_from_this();
+            node->parent() = this;
+            this->children_added(this->_children.size() - 1);
         }
         /**
          * @brief 子节点合并.给定节点容器内的节点添加到此节点的子节点列表
          * 
          * @param children 存放子节点指针的容器
          */
-        void merge_children(const std::list<std::shared_ptr<AbstractNode>> &children)
+        void merge_children(const NodeList &children)
         {
-            for (const auto &e : children)
-            {
-                this->add_child(e);
-            }
+            auto first = this->_children.size();
+            this->_children.append(children.begin(), children.end());
+            this->adopt_children(first);
         }
         /**
-         * @brief 子节点合并.将传入的节点的子节点添加到此节点的子节点列表
+         * @brief 子节点合并.将传入的节点的子节点移动到此节点的子节点列表，传入的节点之后不再有子节点
          * 
          * @param node 传入的语义节点
          */
-        void lift_children(const std::shared_ptr<AbstractNode> &node)
+        void lift_children(AbstractNode *node)
         {
-            this->merge_children(node->children());
+            auto &source = node->children();
+            auto first = this->_children.size();
+            if (this->_children.empty())
+                this->_children = std::move(source); //直接接管对方的存储，不逐个复制
+            else
+                this->_children.append(source.begin(), source.end());
+            source.clear();
+            this->adopt_children(first);
         }
         /**
          * @brief 此节点是否具有子节点
@@ -242,11 +336,28 @@ namespace spc{
          */
         virtual bool should_have_children() const
         { return true; }
+        /**
+         * @brief 子节点添加之后调用的钩子，需要在添加子节点时维护额外信息的节点(比如记录类型)可以重写它
+         * 
+         * @param first 新添加的第一个子节点在子节点容器中的下标
+         */
+        virtual void children_added(size_t /*first*/)
+        {}
         /**
          * @brief 打印json用的一个函数
          * @return std::string
          */
         virtual std::string json_head() const = 0;
+
+    private:
+        /// 把下标first之后的子节点的父节点设置为此节点
+        void adopt_children(size_t first)
+        {
+            for (auto i = first; i < this->_children.size(); ++i)
+                this->_children[i]->parent() = this;
+            if (first < this->_children.size())
+                this->children_added(first);
+        }
     };
 
     /**
@@ -254,6 +365,8 @@ namespace spc{
      */
     struct DummyNode : public AbstractNode
     {
+        static bool classof(const AbstractNode * /*node*/)
+        { return true; }
     public:
         /**
          * @brief 代码生成函数
@@ -277,17 +390,40 @@ namespace spc{
      */
     struct ExprNode : public DummyNode
     {
-        std::shared_ptr<TypeNode> type;
+        static bool classof(const AbstractNode *node)
+        { return kind_in(node->kind(), NodeKind::FirstExpr, NodeKind::LastExpr); }
+        TypeNode *type = nullptr;
         //virtual llvm::Value* get_ptr(CodegenContext& context)=0;
         
     protected:
         ExprNode() = default;
     };
+    /**
+     * @brief 名字绑定的结果. 由代码生成前的名字绑定(NameBinder)填入，代码生成时按槽位下标直接取出符号，不必再逐层查找
+     * 
+     */
+    struct Binding
+    {
+        enum class Scope : unsigned char
+        {
+            /// 未绑定 代码生成时按名字查找
+            UNBOUND,
+            /// 全局变量
+            GLOBAL,
+            /// 当前子过程的局部变量
+            LOCAL
+        };
+        Scope scope = Scope::UNBOUND;
+        /// 在所属作用域中的槽位 与符号在该作用域中声明的先后顺序一致
+        unsigned slot = 0;
+    };
     /**
      * @brief 左值表达式(即可被赋值的东西)
      * 
      */
     struct LeftValueExprNode : public ExprNode{
+        static bool classof(const AbstractNode *node)
+        { return kind_in(node->kind(), NodeKind::FirstLeftValue, NodeKind::LastLeftValue); }
         /**
          * @brief Get the ptr object 获得左值目标指针为了赋值使用
          * 
@@ -295,10 +431,28 @@ namespace spc{
          * @return llvm::Value* 指这个左值在llvm IR中的指针
          */
         virtual llvm::Value* get_ptr(CodegenContext& context)=0;
+        /**
+         * @brief 左值名(已转为小写)
+         * 
+         * @return const std::string& 
+         */
+        const std::string &name() const noexcept
+        { return symbol.str(); }
+        /**
+         * @brief 左值名在标识符池中的编号 符号表用它来查找
+         * 
+         * @return SymbolId 
+         */
+        SymbolId id() const noexcept
+        { return symbol.id; }
         /**
          * 左值名
          */
-        std::string name;
+        InternedName symbol;
+        /**
+         * 左值引用的符号所在的作用域与槽位
+         */
+        Binding binding;
     };
     /**
      * @brief Statement语句(纯虚基类)
@@ -306,6 +460,8 @@ namespace spc{
      */
     struct StmtNode : public DummyNode
     {
+        static bool classof(const AbstractNode *node)
+        { return kind_in(node->kind(), NodeKind::FirstStmt, NodeKind::LastStmt); }
     protected:
         StmtNode() = default;
     };
@@ -315,16 +471,18 @@ namespace spc{
      */
     struct IdentifierNode : public LeftValueExprNode
     {
+        static constexpr NodeKind static_kind = NodeKind::Identifier;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /**
          * @brief Construct a new Identifier Node object
          * 
-         * @param c 字符串
+         * @param symbol 词法分析时驻留在标识符池中的标识符(已转为小写)
          */
-        explicit IdentifierNode(const char *c)
+        explicit IdentifierNode(const InternedName &symbol)
         {
-            name=std::string(c);
-            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c){ return std::tolower(c); }); //为了忽略大小写，所以全部转为小写
+            this->symbol=symbol;
         }
 
         llvm::Value *get_ptr(CodegenContext &context) override;
@@ -334,7 +492,7 @@ namespace spc{
         std::string json_head() const override
         {
             return std::string{"\"type\": \"Identifier\", \"name\": \""}
-                   + this->name + "\"";
+                   + this->name() + "\"";
         }
 
         bool should_have_children() const override
@@ -382,6 +540,8 @@ namespace spc{
      * 
      */
     struct TypeNode : public DummyNode{
+        static bool classof(const AbstractNode *node)
+        { return kind_in(node->kind(), NodeKind::FirstType, NodeKind::LastType); }
         Type type = Type::UNDEFINED;
         llvm::Type *get_llvm_type(CodegenContext& context)const; 
 
@@ -394,6 +554,9 @@ namespace spc{
      * 
      */
     struct  SimpleTypeNode : public TypeNode{
+        static constexpr NodeKind static_kind = NodeKind::SimpleType;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
         using TypeNode::type;
         SimpleTypeNode(Type type){
             this->type=type;
@@ -409,6 +572,9 @@ namespace spc{
      */
     struct StringTypeNode : public TypeNode
     {
+        static constexpr NodeKind static_kind = NodeKind::StringType;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         StringTypeNode()
         { type = Type::STRING; }
@@ -424,8 +590,11 @@ namespace spc{
      */
     struct AliasTypeNode : public TypeNode
     {
+        static constexpr NodeKind static_kind = NodeKind::AliasType;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<IdentifierNode> identifier;
+        IdentifierNode *identifier;
 
         AliasTypeNode(const NodePtr &identifier)
                 : identifier(cast_node<IdentifierNode>(identifier))
@@ -445,11 +614,14 @@ namespace spc{
      * 
      */
     struct RangeNode : public DummyNode{
+        static constexpr NodeKind static_kind = NodeKind::Range;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 数组上界
-        std::shared_ptr<IntegerNode> low;
+        IntegerNode *low;
         /// 数组下界
-        std::shared_ptr<IntegerNode> high;
+        IntegerNode *high;
         /// 整个数组的长度
         int length;
         RangeNode(const NodePtr& min,const NodePtr& max);
@@ -461,16 +633,19 @@ namespace spc{
      */
     struct ArrayTypeNode : public TypeNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ArrayType;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /**
          * @brief 数组范围
          * @see RangeNode
          */ 
-        std::shared_ptr<RangeNode> range;
+        RangeNode *range;
         /**
          * @brief 数组元素类型
         */
-        std::shared_ptr<TypeNode> element_type;
+        TypeNode *element_type;
 
         ArrayTypeNode(const NodePtr &range, const NodePtr &element_type)
                 : range(cast_node<RangeNode>(range)), element_type(cast_node<TypeNode>(element_type))
@@ -488,13 +663,16 @@ namespace spc{
      */ 
     struct RecordTypeNode : public TypeNode
     {
+        static constexpr NodeKind static_kind = NodeKind::RecordType;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::map<std::string,std::shared_ptr<TypeNode>> fields;
-        std::map<std::string,int> indexes;
-        llvm::Type* innertype;
+        /// 字段名编号到字段类型
+        std::unordered_map<SymbolId,TypeNode *> fields;
+        /// 字段名编号到字段在结构体中的位置
+        std::unordered_map<SymbolId,int> indexes;
         RecordTypeNode();
-        void add_child(const std::shared_ptr<AbstractNode> &node) override;
-        void add_child(std::shared_ptr<AbstractNode> &&node) override;
+        void children_added(size_t first) override;
         virtual std::string json_head() const override{
             return fmt::format("\"type\": \"Type\", \"name\":\"{}\"",type2string(this->type));
         }
@@ -509,6 +687,9 @@ namespace spc{
      */
     struct SetTypeNode : public TypeNode
     {
+        static constexpr NodeKind static_kind = NodeKind::SetType;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         SetTypeNode()
         {
@@ -526,6 +707,8 @@ namespace spc{
      */
     struct ConstValueNode : public ExprNode
     {
+        static bool classof(const AbstractNode *node)
+        { return kind_in(node->kind(), NodeKind::FirstConstValue, NodeKind::LastConstValue); }
     public:
         /**
          * @brief Get the llvm type object
@@ -549,13 +732,16 @@ namespace spc{
      */
     struct BooleanNode : public ConstValueNode
     {
+        static constexpr NodeKind static_kind = NodeKind::Boolean;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 布尔值
         bool val;
 
         BooleanNode(bool val) : val(val)
         {
-            type = std::make_shared<SimpleTypeNode>(Type::BOOLEAN);
+            type = make_node<SimpleTypeNode>(Type::BOOLEAN);
         }
 
         llvm::Value *codegen(CodegenContext &context) override;
@@ -573,13 +759,16 @@ namespace spc{
      */
     struct IntegerNode : public ConstValueNode
     {
+        static constexpr NodeKind static_kind = NodeKind::Integer;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 值
         int val;
 
         IntegerNode(int val) : val(val)
         {
-            type = std::make_shared<SimpleTypeNode>(Type::INTEGER);
+            type = make_node<SimpleTypeNode>(Type::INTEGER);
         }
         /**
          * @brief Construct a new Integer Node object
@@ -591,7 +780,7 @@ namespace spc{
             std::stringstream ss;
             ss << val;
             ss >> this->val;
-            type = std::make_shared<SimpleTypeNode>(Type::INTEGER);
+            type = make_node<SimpleTypeNode>(Type::INTEGER);
         }
 
         llvm::Value *codegen(CodegenContext &context) override;
@@ -608,6 +797,9 @@ namespace spc{
      */
     struct RealNode : public ConstValueNode
     {
+        static constexpr NodeKind static_kind = NodeKind::Real;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         double val;
         /**
@@ -618,7 +810,7 @@ namespace spc{
          */
         RealNode(double val) : val(val)
         {
-            type = std::make_shared<SimpleTypeNode>(Type::REAL);
+            type = make_node<SimpleTypeNode>(Type::REAL);
         }
 
         RealNode(const char *val)
@@ -626,7 +818,7 @@ namespace spc{
             std::stringstream ss;
             ss << val;
             ss >> this->val;
-            type = std::make_shared<SimpleTypeNode>(Type::REAL);
+            type = make_node<SimpleTypeNode>(Type::REAL);
         }
 
         llvm::Value *codegen(CodegenContext &context) override;
@@ -634,7 +826,7 @@ namespace spc{
     protected:
         std::string json_head() const override
         {
-            return std::string{"\"type\": \"Real\", \"value\": \""} + std::to_string(val) + "\"";
+            return std::string{"\"type\": \"Real\", \"value\": \""} + fmt::format("{}", val) + "\""; //最短的可以精确还原的表示
         }
     };
     /**
@@ -643,18 +835,21 @@ namespace spc{
      */
     struct CharNode : public ConstValueNode
     {
+        static constexpr NodeKind static_kind = NodeKind::Char;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         char val;
 
         CharNode(const char val) : val(val)
         {
-            type = std::make_shared<SimpleTypeNode>(Type::CHAR);
+            type = make_node<SimpleTypeNode>(Type::CHAR);
         }
 
         CharNode(const char *val)
         {
             this->val = val[1];
-            type = std::make_shared<SimpleTypeNode>(Type::CHAR);
+            type = make_node<SimpleTypeNode>(Type::CHAR);
         }
 
         llvm::Value *codegen(CodegenContext &context) override;
@@ -671,6 +866,9 @@ namespace spc{
      */
     struct StringNode : public ConstValueNode
     {
+        static constexpr NodeKind static_kind = NodeKind::String;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         std::string val;
 
@@ -678,7 +876,7 @@ namespace spc{
         {
             this->val.erase(this->val.begin());
             this->val.pop_back();
-            type = std::make_shared<SimpleTypeNode>(Type::STRING);
+            type = make_node<SimpleTypeNode>(Type::STRING);
         }
 
         llvm::Value *codegen(CodegenContext &context) override;
@@ -694,16 +892,19 @@ namespace spc{
      */
     struct ArrayRefNode : public LeftValueExprNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ArrayRef;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 数组名称
-        std::shared_ptr<IdentifierNode> identifier;
+        IdentifierNode *identifier;
         /// 想要获取元素的下标
-        std::shared_ptr<ExprNode> index;
+        ExprNode *index;
 
         ArrayRefNode(const NodePtr &identifier, const NodePtr &index)
                 : identifier(cast_node<IdentifierNode>(identifier)), index(cast_node<ExprNode>(index))
         {
-            name=this->identifier->name;
+            symbol=this->identifier->symbol;
         }
         llvm::Value *get_ptr(CodegenContext& context)override;
         llvm::Value *codegen(CodegenContext& context)override;
@@ -727,16 +928,21 @@ namespace spc{
      */
     struct RecordRefNode : public LeftValueExprNode
     {
+        static constexpr NodeKind static_kind = NodeKind::RecordRef;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 记录名
-        std::shared_ptr<IdentifierNode> identifier;
+        IdentifierNode *identifier;
         /// 字段名
-        std::shared_ptr<IdentifierNode> field;
+        IdentifierNode *field;
 
 
         RecordRefNode(const NodePtr &identifier, const NodePtr &field)
                 : identifier(cast_node<IdentifierNode>(identifier)), field(cast_node<IdentifierNode>(field))
-        {}
+        {
+            symbol=this->identifier->symbol;
+        }
         llvm::Value *get_ptr(CodegenContext& context)override;
         llvm::Value *codegen(CodegenContext& context)override;
 
@@ -820,13 +1026,16 @@ namespace spc{
      */
     struct BinopExprNode : public ExprNode
     {
+        static constexpr NodeKind static_kind = NodeKind::BinopExpr;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 运算符
         BinaryOperator op;
         /// 二元运算符左部
-        std::shared_ptr<ExprNode> lhs;
+        ExprNode *lhs;
         /// 二元运算符右部
-        std::shared_ptr<ExprNode> rhs;
+        ExprNode *rhs;
 
         BinopExprNode(BinaryOperator op, const NodePtr &lhs, const NodePtr &rhs)
                 : op(op), lhs(cast_node<ExprNode>(lhs)), rhs(cast_node<ExprNode>(rhs))
@@ -855,6 +1064,9 @@ namespace spc{
      */
     struct FuncExprNode : public ExprNode
     {
+        static constexpr NodeKind static_kind = NodeKind::FuncExpr;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         NodePtr func_call;
 
@@ -889,6 +1101,24 @@ namespace spc{
         SUCC,
         /// 开方
         SQRT, 
+        /// 平方
+        SQR,
+        /// 正弦
+        SIN,
+        /// 余弦
+        COS,
+        /// 反正切
+        ARCTAN,
+        /// e的幂
+        EXP,
+        /// 自然对数
+        LN,
+        /// 四舍五入为整数 0.5向远离0的方向舍入
+        ROUND,
+        /// 向0取整
+        TRUNC,
+        /// 是否为奇数
+        ODD,
         /// 读取 不丢弃回车
         READ, 
         /// 读取 丢弃回车
@@ -912,6 +1142,15 @@ namespace spc{
                 {SysRoutine::ORD,     "ord"},
                 {SysRoutine::PRED,    "pred"},
                 {SysRoutine::SQRT,    "sqrt"},
+                {SysRoutine::SQR,     "sqr"},
+                {SysRoutine::SIN,     "sin"},
+                {SysRoutine::COS,     "cos"},
+                {SysRoutine::ARCTAN,  "arctan"},
+                {SysRoutine::EXP,     "exp"},
+                {SysRoutine::LN,      "ln"},
+                {SysRoutine::ROUND,   "round"},
+                {SysRoutine::TRUNC,   "trunc"},
+                {SysRoutine::ODD,     "odd"},
                 {SysRoutine::SUCC,    "succ"},
                 {SysRoutine::READ,    "read"},
                 {SysRoutine::READLN,  "readln"},
@@ -921,9 +1160,38 @@ namespace spc{
         // TODO: bound checking
         return routine_to_string[routine];
     }
+    /**
+     * @brief 预定义的数学函数(sqr sin cos arctan exp ln round trunc odd)
+     * 它们不是保留字，词法分析得到普通的标识符，用户声明的同名变量或函数会覆盖它们
+     * 
+     * @param name 小写的标识符
+     * @param routine 找到时返回对应的系统函数
+     * @return true name是预定义的数学函数
+     */
+    inline bool predeclared_routine(const std::string &name, SysRoutine &routine)
+    {
+        static const std::map<std::string, SysRoutine> predeclared{
+                {"sqr",    SysRoutine::SQR},
+                {"sin",    SysRoutine::SIN},
+                {"cos",    SysRoutine::COS},
+                {"arctan", SysRoutine::ARCTAN},
+                {"exp",    SysRoutine::EXP},
+                {"ln",     SysRoutine::LN},
+                {"round",  SysRoutine::ROUND},
+                {"trunc",  SysRoutine::TRUNC},
+                {"odd",    SysRoutine::ODD}
+        };
+        auto it = predeclared.find(name);
+        if (it == predeclared.end()) return false;
+        routine = it->second;
+        return true;
+    }
     /// 系统函数调用语义节点
     struct SysRoutineNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::SysRoutine;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         SysRoutine routine;
 
@@ -940,18 +1208,22 @@ namespace spc{
      */
     struct SysCallNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::SysCall;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<SysRoutineNode> routine;
-        std::shared_ptr<ArgListNode> args;
+        SysRoutineNode *routine;
+        ArgListNode *args;
 
         SysCallNode(const NodePtr &routine, const NodePtr &args);
 
-        explicit SysCallNode(const NodePtr &routine)
-                : SysCallNode(routine, make_node<ArgListNode>())
-        {}
+        explicit SysCallNode(const NodePtr &routine);
 
         llvm::Value *codegen(CodegenContext &context) override;
 
+        /// 生成系统函数routine的调用，预定义的数学函数由RoutineCallNode经这里生成
+        static llvm::Value *codegen_routine(CodegenContext &context, SysRoutine routine, ArgListNode *args);
+
     protected:
         std::string json_head() const override;
 
@@ -964,6 +1236,9 @@ namespace spc{
      */
     struct ArgListNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ArgList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     protected:
         std::string json_head() const override
         {
@@ -979,11 +1254,14 @@ namespace spc{
      */
     struct ParamDeclNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ParamDecl;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 程序名
-        std::shared_ptr<IdentifierNode> name;
+        IdentifierNode *name;
         /// 返回类型
-        std::shared_ptr<TypeNode> type;
+        TypeNode *type;
 
         ParamDeclNode(const NodePtr &name, const NodePtr &type)
                 : name(cast_node<IdentifierNode>(name)), type(cast_node<TypeNode>(type))
@@ -1006,6 +1284,9 @@ namespace spc{
     /// 程序列表语义节点
     struct ParamListNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ParamList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     protected:
         std::string json_head() const override
         {
@@ -1018,11 +1299,14 @@ namespace spc{
     /// 变量声明语义节点
     struct VarDeclNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::VarDecl;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 变量名
-        std::shared_ptr<IdentifierNode> name;
+        IdentifierNode *name;
         /// 变量类型
-        std::shared_ptr<TypeNode> type;
+        TypeNode *type;
 
         VarDeclNode(const NodePtr &name, const NodePtr &type)
                 : name(cast_node<IdentifierNode>(name)), type(cast_node<TypeNode>(type))
@@ -1045,6 +1329,9 @@ namespace spc{
     /// 变量列表语义节点
     struct VarListNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::VarList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         llvm::Value *codegen(CodegenContext &context) override;
 
@@ -1060,9 +1347,12 @@ namespace spc{
     /// 常量声明语义节点
     struct ConstDeclNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ConstDecl;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<IdentifierNode> name;
-        std::shared_ptr<ConstValueNode> value;
+        IdentifierNode *name;
+        ConstValueNode *value;
 
         ConstDeclNode(const NodePtr &name, const NodePtr &value)
                 : name(cast_node<IdentifierNode>(name)), value(cast_node<ConstValueNode>(value))
@@ -1085,6 +1375,9 @@ namespace spc{
     /// 常量列表语义节点
     struct ConstListNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ConstList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         llvm::Value *codegen(CodegenContext &context) override;
 
@@ -1100,9 +1393,12 @@ namespace spc{
     /// 类型定义语义节点
     struct TypeDefNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::TypeDef;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<IdentifierNode> name;
-        std::shared_ptr<TypeNode> type;
+        IdentifierNode *name;
+        TypeNode *type;
 
         TypeDefNode(const NodePtr &name, const NodePtr &type)
                 : name(cast_node<IdentifierNode>(name)), type(cast_node<TypeNode>(type))
@@ -1125,6 +1421,9 @@ namespace spc{
     /// 类型列表语义节点
     struct TypeListNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::TypeList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         llvm::Value *codegen(CodegenContext &context) override;
 
@@ -1141,15 +1440,21 @@ namespace spc{
     // Intermediate container, would be removed
     struct NameListNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::NameList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     };
     /// 过程调用语义节点
     struct RoutineCallNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::RoutineCall;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 函数名
-        std::shared_ptr<IdentifierNode> identifier;
+        IdentifierNode *identifier;
         /// 实参
-        std::shared_ptr<ArgListNode> args;
+        ArgListNode *args;
 
         RoutineCallNode(const NodePtr &identifier, const NodePtr &args)
                 : identifier(cast_node<IdentifierNode>(identifier)), args(cast_node<ArgListNode>(args))
@@ -1174,6 +1479,9 @@ namespace spc{
     /// 子过程列表
     struct SubroutineListNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::SubroutineList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         llvm::Value *codegen(CodegenContext &context) override;
 
@@ -1189,11 +1497,14 @@ namespace spc{
     /// 存放头部（如子过程，变量，常量）的容器节点
     struct HeadListNode : public DummyNode
     {
+        static constexpr NodeKind static_kind = NodeKind::HeadList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<ConstListNode> const_list;
-        std::shared_ptr<TypeListNode> type_list;
-        std::shared_ptr<VarListNode> var_list;
-        std::shared_ptr<SubroutineListNode> subroutine_list;
+        ConstListNode *const_list;
+        TypeListNode *type_list;
+        VarListNode *var_list;
+        SubroutineListNode *subroutine_list;
 
         HeadListNode(const NodePtr &consts, const NodePtr &types, const NodePtr &vars, const NodePtr &subroutines)
                 : const_list(cast_node<ConstListNode>(consts)), type_list(cast_node<TypeListNode>(types)),
@@ -1221,9 +1532,11 @@ namespace spc{
     /// 过程语义节点
     struct RoutineNode : public DummyNode
     {
+        static bool classof(const AbstractNode *node)
+        { return kind_in(node->kind(), NodeKind::FirstRoutine, NodeKind::LastRoutine); }
     public:
-        std::shared_ptr<IdentifierNode> name;
-        std::shared_ptr<HeadListNode> head_list;
+        IdentifierNode *name;
+        HeadListNode *head_list;
 
         RoutineNode(const NodePtr &name, const NodePtr &head_list)
                 : name(cast_node<IdentifierNode>(name)), head_list(cast_node<HeadListNode>(head_list))
@@ -1238,6 +1551,9 @@ namespace spc{
     /// 函数语义节点
     struct ProgramNode : public RoutineNode
     {
+        static constexpr NodeKind static_kind = NodeKind::Program;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         using RoutineNode::RoutineNode;
 
@@ -1255,9 +1571,12 @@ namespace spc{
     /// 子过程语义节点
     struct SubroutineNode : public RoutineNode
     {
+        static constexpr NodeKind static_kind = NodeKind::Subroutine;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<ParamListNode> params;
-        std::shared_ptr<TypeNode> return_type;
+        ParamListNode *params;
+        TypeNode *return_type;
 
         SubroutineNode(const NodePtr &name, const NodePtr &params, const NodePtr &type, const NodePtr &head_list)
                 : RoutineNode(name, head_list), params(cast_node<ParamListNode>(params)),
@@ -1266,6 +1585,13 @@ namespace spc{
             assert(is_a_ptr_of<SimpleTypeNode>(type) || is_a_ptr_of<AliasTypeNode>(type));
         }
 
+        /**
+         * @brief 只声明这个子过程(不生成函数体) 已经声明过时直接返回之前的声明
+         * 
+         * @param context 代码生成上下文
+         * @return llvm::Function* 
+         */
+        llvm::Function *declare(CodegenContext &context);
         llvm::Value *codegen(CodegenContext &context) override;
 
     protected:
@@ -1284,6 +1610,9 @@ namespace spc{
     /// 语句块语义节点 （比如begin...end之内的语句都在这里)
     struct CompoundStmtNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::CompoundStmt;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         llvm::Value *codegen(CodegenContext &context) override;
 
@@ -1299,11 +1628,14 @@ namespace spc{
     /// 赋值语句语义节点
     struct AssignStmtNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::AssignStmt;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 被赋值量
-        std::shared_ptr<ExprNode> lhs;
+        ExprNode *lhs;
         /// 赋值量
-        std::shared_ptr<ExprNode> rhs;
+        ExprNode *rhs;
 
         AssignStmtNode(const NodePtr &lhs, const NodePtr &rhs)
                 : lhs(cast_node<ExprNode>(lhs)), rhs(cast_node<ExprNode>(rhs))
@@ -1329,6 +1661,9 @@ namespace spc{
     /// 过程调用语义节点
     struct ProcStmtNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ProcStmt;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         NodePtr proc_call;
 
@@ -1352,10 +1687,13 @@ namespace spc{
     /// IF语义节点
     struct IfStmtNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::IfStmt;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<ExprNode> expr;
-        std::shared_ptr<StmtNode> stmt;
-        std::shared_ptr<StmtNode> else_stmt;
+        ExprNode *expr;
+        StmtNode *stmt;
+        StmtNode *else_stmt;
 
         IfStmtNode(const NodePtr &expr, const NodePtr &stmt, const NodePtr &else_stmt)
                 : expr(cast_node<ExprNode>(expr)), stmt(cast_node<StmtNode>(stmt)),
@@ -1381,8 +1719,11 @@ namespace spc{
     /// repeat 语义节点
     struct RepeatStmtNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::RepeatStmt;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<ExprNode> expr;
+        ExprNode *expr;
 
         RepeatStmtNode(const NodePtr &expr) : expr(cast_node<ExprNode>(expr))
         {}
@@ -1402,9 +1743,12 @@ namespace spc{
     /// while 语义节点
     struct WhileStmtNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::WhileStmt;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<ExprNode> expr;
-        std::shared_ptr<StmtNode> stmt;
+        ExprNode *expr;
+        StmtNode *stmt;
 
         WhileStmtNode(const NodePtr &expr, const NodePtr &stmt)
                 : expr(cast_node<ExprNode>(expr)), stmt(cast_node<StmtNode>(stmt))
@@ -1432,17 +1776,20 @@ namespace spc{
     /// for语义语义节点
     struct ForStmtNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::ForStmt;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
         /// 计数方向
         DirectionEnum direction;
         /// 计数变量
-        std::shared_ptr<IdentifierNode> identifier;
+        IdentifierNode *identifier;
         /// 开始
-        std::shared_ptr<ExprNode> start;
+        ExprNode *start;
         /// 结束
-        std::shared_ptr<ExprNode> finish;
+        ExprNode *finish;
         /// for循环体内语句
-        std::shared_ptr<StmtNode> stmt;
+        StmtNode *stmt;
 
         ForStmtNode(DirectionEnum direction, const NodePtr &identifier,
                     const NodePtr &start, const NodePtr &finish, const NodePtr &stmt)
@@ -1470,9 +1817,12 @@ namespace spc{
     /// case表达式语义节点
     struct CaseExprNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::CaseExpr;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<ExprNode> branch;
-        std::shared_ptr<StmtNode> stmt;
+        ExprNode *branch;
+        StmtNode *stmt;
 
         CaseExprNode(const NodePtr &branch, const NodePtr &stmt)
                 : branch(cast_node<ExprNode>(branch)), stmt(cast_node<StmtNode>(stmt))
@@ -1495,8 +1845,11 @@ namespace spc{
     /// case语句语义节点
     struct CaseStmtNode : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::CaseStmt;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     public:
-        std::shared_ptr<ExprNode> expr;
+        ExprNode *expr = nullptr;
 
         void add_expr(const NodePtr &expr)
         {
@@ -1519,6 +1872,9 @@ namespace spc{
     // 语句的临时容器，在语法分析构建AST的时候会用到
     struct StmtList : public StmtNode
     {
+        static constexpr NodeKind static_kind = NodeKind::StmtList;
+        static bool classof(const AbstractNode *node)
+        { return node->kind() == static_kind; }
     };
 };
 #endif
\ No newline at end of file
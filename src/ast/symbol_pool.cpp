@@ -0,0 +1,35 @@
+/**
+ * @file symbol_pool.cpp
+ * @brief 标识符池的实现
+ * @version 0.1
+ * @date 2021-06-05
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <cstring>
+#include <llvm/ADT/StringExtras.h>
+#include "symbol_pool.h"
+
+using namespace spc;
+
+InternedName SymbolPool::intern(const char *text, size_t length)
+{
+    scratch.resize(length);
+    for (size_t i = 0; i < length; ++i)
+        scratch[i] = llvm::toLower(text[i]); //为了忽略大小写，所以全部转为小写
+
+    auto it = index.find(llvm::StringRef(scratch));
+    if (it != index.end())
+        return InternedName{it->second, &names[it->second]};
+
+    auto id = static_cast<SymbolId>(names.size());
+    names.push_back(scratch);
+    index.insert({llvm::StringRef(names.back()), id});
+    return InternedName{id, &names.back()};
+}
+
+InternedName SymbolPool::intern(const char *text)
+{
+    return intern(text, std::strlen(text));
+}
@@ -0,0 +1,76 @@
+/**
+ * @file symbol_pool.h
+ * @brief 标识符池. 词法分析时每个标识符只做一次小写转换与哈希，之后用整数编号比较与查找
+ * @version 0.1
+ * @date 2021-06-05
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_SYMBOL_POOL_H
+#define NAIVE_PASCAL_COMPILER_SYMBOL_POOL_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace spc
+{
+    /// 标识符编号 同一次编译中相同(忽略大小写)的标识符编号相同
+    using SymbolId = std::uint32_t;
+
+    /**
+     * @brief 驻留后的标识符. 编号用于比较与查找，字符串只在生成LLVM中的名字或者报错时使用
+     *
+     */
+    struct InternedName
+    {
+        SymbolId id = 0;
+        /// 指向标识符池中的字符串，它的生命周期与标识符池相同
+        const std::string *text = nullptr;
+
+        const std::string &str() const noexcept
+        { return *text; }
+    };
+
+    /**
+     * @brief 标识符池 存放一次编译中出现过的所有标识符(已转为小写)
+     *
+     */
+    class SymbolPool final
+    {
+    public:
+        SymbolPool() = default;
+        SymbolPool(const SymbolPool &) = delete;
+        SymbolPool &operator=(const SymbolPool &) = delete;
+
+        /**
+         * @brief 驻留一个标识符 Pascal忽略大小写，所以会先转为小写
+         *
+         * @param text 标识符(比如yytext)
+         * @param length 标识符长度
+         * @return InternedName
+         */
+        InternedName intern(const char *text, size_t length);
+        /// 驻留一个以'\0'结尾的标识符
+        InternedName intern(const char *text);
+        /// 根据编号返回标识符字符串
+        const std::string &str(SymbolId id) const
+        { return names[id]; }
+        /// 池中标识符的数量
+        size_t size() const noexcept
+        { return names.size(); }
+
+    private:
+        /// 标识符字符串 deque在尾部插入时不会移动已有元素，所以可以放心地保存指向它们的指针
+        std::deque<std::string> names;
+        /// 标识符到编号的索引 键指向names中的字符串
+        llvm::DenseMap<llvm::StringRef, SymbolId> index;
+        /// 小写转换用的缓冲区
+        std::string scratch;
+    };
+}
+
+#endif //NAIVE_PASCAL_COMPILER_SYMBOL_POOL_H
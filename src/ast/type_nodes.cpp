@@ -55,22 +55,16 @@ RecordTypeNode::RecordTypeNode(){
     int i=0;
     for(const auto& p:children()){
         auto fieldPtr=cast_node<VarDeclNode>(p);
-        fields[fieldPtr->name->name]=fieldPtr->type;
-        indexes[fieldPtr->name->name]=i++;
-        std::cout<<fieldPtr->name->name<<std::endl;
+        fields[fieldPtr->name->id()]=fieldPtr->type;
+        indexes[fieldPtr->name->id()]=i++;
+        std::cout<<fieldPtr->name->name()<<std::endl;
     }
 
 }
-void RecordTypeNode::add_child(const std::shared_ptr<AbstractNode> &node){
-    auto fieldPtr=cast_node<VarDeclNode>(node);
-    fields[fieldPtr->name->name]=fieldPtr->type;
-    indexes[fieldPtr->name->name]=i++;
-    AbstractNode::add_child(node);
-}
-
-void RecordTypeNode::add_child(std::shared_ptr<AbstractNode> &&node){
-    auto fieldPtr=cast_node<VarDeclNode>(node);
-    fields[fieldPtr->name->name]=fieldPtr->type;
-    indexes[fieldPtr->name->name]=i++;
-    AbstractNode::add_child(node);
+void RecordTypeNode::children_added(size_t first){
+    for(auto it=children().begin()+first;it!=children().end();++it){
+        auto fieldPtr=cast_node<VarDeclNode>(*it);
+        fields[fieldPtr->name->id()]=fieldPtr->type;
+        indexes[fieldPtr->name->id()]=i++;
+    }
 }
\ No newline at end of file
@@ -12,10 +12,15 @@
 #define NAIVE_PASCAL_COMPILER_CODEGEN_CONTEXT_H
 
 #include <map>
+#include <unordered_map>
 #include <string>
+#include <vector>
 #include <memory>
 #include <exception>
 #include <iostream>
+#include <functional>
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
@@ -24,48 +29,120 @@
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Transforms/Utils.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
-#include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/Scalar.h>
-#include <llvm/Transforms/Scalar/GVN.h>
 
 #include "symbol.h"
 
-static llvm::LLVMContext llvm_context;
-
 namespace spc
 {
+    class CompileCache;
     struct TypeNode; //前置声明，因为类型信息需要类型节点 但类型节点隶属与AST，直接include会导致循环引用
     ///  代码生成的上下文环境 聚合了LLVM代码生成要用到的一些东西以及优化标志，符号表等
     struct CodegenContext final
     {
     public:
+        /// 本次编译独占的LLVMContext 不同线程上的编译各自使用自己的上下文，所以可以并行；它必须比builder和module先构造、后析构
+        std::unique_ptr<llvm::LLVMContext> llvm_context;
         llvm::IRBuilder<> builder;
         std::unique_ptr<llvm::Module> module;
+        /// 每个函数生成后立即运行的清理优化 完整的优化流水线在整个module生成后由编译驱动运行
         std::unique_ptr<llvm::legacy::FunctionPassManager> fpm;
-        std::unique_ptr<llvm::legacy::PassManager> mpm;
         SymbolTable symbolTable;
+        /// 已生成的子过程 以过程名编号为键，过程调用时按编号查找
+        std::unordered_map<SymbolId, llvm::Function *> functions;
+        /// functions中找不到时用它声明子过程 并行生成时用来声明由其他线程生成的子过程
+        std::function<llvm::Function *(SymbolId)> resolve_function;
+        /// 记录类型节点对应的结构体 按创建顺序排列
+        llvm::MapVector<const TypeNode *, llvm::StructType *> record_types;
+        /// 字符串常量池 内容相同的字符串常量在module中只有一个全局变量
+        llvm::StringMap<llvm::GlobalVariable *> string_pool;
         bool is_subroutine = false;
+        /// 按子过程缓存生成的IR(增量编译) 为空时不使用
+        CompileCache *routine_cache = nullptr;
+        /// 从缓存中取出的子过程 代码生成结束前链接进module
+        std::vector<std::unique_ptr<llvm::Module>> cached_routines;
+        /// 生成顶层子过程使用的线程数
+        unsigned jobs = 1;
 
         CodegenContext(std::string module_id, bool optimization)
-                : builder(llvm_context),
-                  module(std::make_unique<llvm::Module>(module_id, llvm_context)),
+                : llvm_context(std::make_unique<llvm::LLVMContext>()),
+                  builder(*llvm_context),
+                  module(std::make_unique<llvm::Module>(module_id, *llvm_context)),
                   symbolTable(this)
         {
             if (optimization)
             {
-                //添加常用优化
+                //只做便宜的清理，让并行生成与子过程缓存中的IR更小；GVN，内联等交给之后的完整流水线
+                //instcombine依赖数据布局，生成代码之前要先设置module的目标平台(见generate_module)
                 fpm = std::make_unique<llvm::legacy::FunctionPassManager>(module.get());
                 fpm->add(llvm::createPromoteMemoryToRegisterPass());  //添加内存-寄存器优化 因为LLVM IR的SSA特性 这个一定要加
                 fpm->add(llvm::createInstructionCombiningPass()); //添加指令合并优化
-                fpm->add(llvm::createReassociatePass());  // 4 + (x + 5)  ->  x + (4 + 5) 这个叫什么优化...
-                fpm->add(llvm::createGVNPass()); // 消除冗余代码
                 fpm->add(llvm::createCFGSimplificationPass()); // 合并基本块 移除不可达部分 基本上也是消除冗余代码用的
                 fpm->doInitialization();
-                mpm = std::make_unique<llvm::legacy::PassManager>();
-                mpm->add(llvm::createConstantMergePass());  // 常亮合并
-                mpm->add(llvm::createFunctionInliningPass()); // 函数内联 这个加不加区别不大
             }
         }
+        /**
+         * @brief 根据过程名编号查找已生成的子过程 找不到时返回nullptr
+         * 
+         * @param name 过程名编号
+         * @return llvm::Function* 
+         */
+        llvm::Function *getFunction(SymbolId name) const
+        {
+            auto it = functions.find(name);
+            if (it != functions.end()) return it->second;
+            return resolve_function ? resolve_function(name) : nullptr;
+        }
+        /**
+         * @brief 取得字符串常量的i8*指针 内容相同的字符串共用string_pool中的同一个全局变量
+         *
+         * @param text 字符串的内容 不含结尾的'\0'
+         * @return llvm::Constant*
+         */
+        llvm::Constant *string_constant(llvm::StringRef text)
+        {
+            auto &var = string_pool[text];
+            if (var == nullptr)
+            {
+                //与IRBuilder::CreateGlobalString相同: 不需要地址唯一的匿名私有常量
+                auto *data = llvm::ConstantDataArray::getString(*llvm_context, text);
+                var = new llvm::GlobalVariable(*module, data->getType(), true, llvm::GlobalValue::PrivateLinkage, data);
+                var->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+            }
+            auto *zero = builder.getInt32(0);
+            llvm::Constant *indices[] = {zero, zero};
+            return llvm::ConstantExpr::getInBoundsGetElementPtr(var->getValueType(), var, indices);
+        }
+        /**
+         * @brief 其他module中生成的全局变量var是字符串常量(私有的以'\0'结尾的字符数组)时，返回常量池中对应的位置，
+         * 否则返回nullptr 合并并行生成与缓存中的子过程时用它让相同的字符串共用一个全局变量
+         *
+         * @param var 全局变量
+         * @return llvm::GlobalVariable** 位置中为nullptr表示常量池中还没有这个字符串
+         */
+        llvm::GlobalVariable **string_pool_slot(const llvm::GlobalVariable &var)
+        {
+            if (!var.hasPrivateLinkage() || !var.hasInitializer()) return nullptr;
+            auto *text = llvm::dyn_cast<llvm::ConstantDataSequential>(var.getInitializer());
+            if (text == nullptr || !text->isCString()) return nullptr;
+            return &string_pool[text->getAsCString()];
+        }
+        /**
+         * @brief 声明运行时库(runtime/spcrt.h)中的函数 它们不会抛出异常
+         *
+         * @param name 函数名
+         * @param result 返回值类型
+         * @param params 参数类型
+         * @return llvm::FunctionCallee
+         */
+        llvm::FunctionCallee runtime_function(llvm::StringRef name, llvm::Type *result,
+                                              llvm::ArrayRef<llvm::Type *> params)
+        {
+            auto callee = module->getOrInsertFunction(name, llvm::FunctionType::get(result, params, false));
+            if (auto *func = llvm::dyn_cast<llvm::Function>(callee.getCallee()))
+            { func->addFnAttr(llvm::Attribute::NoUnwind); }
+            return callee;
+        }
     /*
         llvm::Value *get_local(std::string key)
         {
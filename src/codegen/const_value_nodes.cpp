@@ -41,6 +41,6 @@ namespace spc
 
     llvm::Value *StringNode::codegen(CodegenContext &context)
     {
-        return context.builder.CreateGlobalStringPtr(val);
+        return context.string_constant(val);
     }
 }
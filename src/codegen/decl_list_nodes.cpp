@@ -34,11 +34,10 @@ namespace spc
         if (context.is_subroutine)
         {
             //
-            bool success = context.symbolTable.addLocalSymbol(name->name,value->type,true);
+            auto local = context.symbolTable.addLocalSymbol(name->symbol,value->type,true);
             //auto *local = context.builder.CreateAlloca(value->get_llvm_type(context));
             //auto success = context.set_local(name->name, local);
-            if (!success) throw CodegenException("duplicate identifier in const section: " + name->name);
-            auto local=context.symbolTable.getLocalSymbol(name->name);
+            if (local == nullptr) throw CodegenException("duplicate identifier in const section: " + name->name());
             context.builder.CreateStore(value->codegen(context), local->get_llvmptr());
             return local->get_llvmptr();
         }
@@ -47,8 +46,7 @@ namespace spc
             if (is_a_ptr_of<StringNode>(value)) //符号表字符串的支持还有问题，先在这打个洞吧...
                 return value->codegen(context);
             auto *constant = llvm::cast<llvm::Constant>(value->codegen(context)); //获得初值
-            bool success = context.symbolTable.addGlobalSymbol(name->name,value->type,constant,true);
-            return context.symbolTable.getGlobalSymbol(name->name)->get_llvmptr();
+            return context.symbolTable.addGlobalSymbol(name->symbol,value->type,constant,true)->get_llvmptr();
         }
     }
 
@@ -62,17 +60,15 @@ namespace spc
     {
         if (context.is_subroutine) //如果是子过程 分配临时变量
         {
-            bool success = context.symbolTable.addLocalSymbol(name->name,type);
-            if (!success) throw CodegenException("duplicate identifier in var section: " + name->name);
-            auto local=context.symbolTable.getLocalSymbol(name->name);
+            auto local = context.symbolTable.addLocalSymbol(name->symbol,type);
+            if (local == nullptr) throw CodegenException("duplicate identifier in var section: " + name->name());
             return local->get_llvmptr();
         }
         else
         {
-            bool success = context.symbolTable.addGlobalSymbol(name->name,type,nullptr);
-            if(!success) throw CodegenException("duplicate global identifier in var sectrion: "+name->name);
-            auto ptr=context.symbolTable.getGlobalSymbol(name->name)->get_llvmptr();
-            return ptr;
+            auto global = context.symbolTable.addGlobalSymbol(name->symbol,type,nullptr);
+            if(global == nullptr) throw CodegenException("duplicate global identifier in var sectrion: "+name->name());
+            return global->get_llvmptr();
         }
     }
 
@@ -88,20 +84,20 @@ namespace spc
         if(is_a_ptr_of<RecordTypeNode>(this->type)){
             auto p=cast_node<RecordTypeNode>(this->type);
             std::vector<llvm::Type*> llvmTypes;
-            std::vector<std::shared_ptr<TypeNode>> types;
-            for(const auto& type:p->fields){
-                llvmTypes.push_back(type.second->get_llvm_type(context));
+            std::vector<TypeNode *> types;
+            for(const auto& field:p->children()){ //按字段声明的顺序排列，与indexes中的位置一致
+                llvmTypes.push_back(cast_node<VarDeclNode>(field)->type->get_llvm_type(context));
             }
-            llvm::StructType *structReg = llvm::StructType::create(context.module->getContext(),llvmTypes,name->name);
-            p->innertype=structReg;
+            llvm::StructType *structReg = llvm::StructType::create(context.module->getContext(),llvmTypes,name->name());
+            context.record_types[p]=structReg;
         }
         if (context.is_subroutine){
-            bool success = context.symbolTable.addLocalAlias(name->name,type);
-            if(!success) throw CodegenException(fmt::format("duplicate local type alias: \"{}\"",name->name));
+            bool success = context.symbolTable.addLocalAlias(name->symbol,type);
+            if(!success) throw CodegenException(fmt::format("duplicate local type alias: \"{}\"",name->name()));
         }
         else{
-            bool success = context.symbolTable.addGlobalAlias(name->name,type);
-            if(!success) throw CodegenException(fmt::format("duplicate global type alias: \"{}\"",name->name));
+            bool success = context.symbolTable.addGlobalAlias(name->symbol,type);
+            if(!success) throw CodegenException(fmt::format("duplicate global type alias: \"{}\"",name->name()));
         }
         return nullptr;
     }
@@ -128,13 +128,12 @@ namespace spc
     }
     
     llvm::Value* ArrayRefNode::get_ptr(CodegenContext& context){
-        auto symbol = context.symbolTable.getLocalSymbol(identifier->name);
-        if(symbol==nullptr)symbol = context.symbolTable.getGlobalSymbol(identifier->name);
+        auto symbol = context.symbolTable.lookup(binding, id());
         if(symbol==nullptr){
-            throw CodegenException(fmt::format("Undefined Identifier named \"{}\"",identifier->name));
+            throw CodegenException(fmt::format("Undefined Identifier named \"{}\"",identifier->name()));
         }
         if(symbol->typeNode->type!=Type::ARRAY){
-            throw CodegenException(fmt::format("Identifier \"{}\" is not a array!",identifier->name));
+            throw CodegenException(fmt::format("Identifier \"{}\" is not a array!",identifier->name()));
         }
         auto ptr=symbol->get_llvmptr();
         auto array=cast_node<ArrayTypeNode>(symbol->typeNode);
@@ -151,21 +150,20 @@ namespace spc
     }
 
     llvm::Value* RecordRefNode::get_ptr(CodegenContext& context){
-        auto symbol=context.symbolTable.getLocalSymbol(identifier->name);
-        if(symbol==nullptr)symbol = context.symbolTable.getGlobalSymbol(identifier->name);
+        auto symbol=context.symbolTable.lookup(binding, id());
         if(symbol==nullptr){
-            throw CodegenException(fmt::format("Undefined Identifier named \"{}\"",identifier->name));
+            throw CodegenException(fmt::format("Undefined Identifier named \"{}\"",identifier->name()));
         }
         if(symbol->typeNode->type!=Type::RECORD){
-            throw CodegenException(fmt::format("Identifier \"{}\" is not a record!",identifier->name));
+            throw CodegenException(fmt::format("Identifier \"{}\" is not a record!",identifier->name()));
         }
         auto llvm_ptr=symbol->get_llvmptr();
         auto record=cast_node<RecordTypeNode>(symbol->typeNode);
-        std::string field_name=field->name;
-        if(record->indexes.count(field_name)==0){
-            throw CodegenException(fmt::format("Record \"{}\" has no field named \"{}\"",identifier->name,field->name));
+        auto field_index=record->indexes.find(field->id());
+        if(field_index==record->indexes.end()){
+            throw CodegenException(fmt::format("Record \"{}\" has no field named \"{}\"",identifier->name(),field->name()));
         }
-        int index=record->indexes[field_name];
+        int index=field_index->second;
         auto targetPtr=context.builder.CreateInBoundsGEP(llvm_ptr,{context.builder.getInt32(0),context.builder.getInt32(index)},"targetPtr");
         return targetPtr;
     }
@@ -15,9 +15,8 @@ namespace spc
 {
     llvm::Value *IdentifierNode::get_ptr(CodegenContext &context)
     {
-        auto value = context.symbolTable.getLocalSymbol(name);
-        if(value==nullptr) value = context.symbolTable.getGlobalSymbol(name);
-        if(value==nullptr) throw CodegenException("identifier not found: " + name);
+        auto value = context.symbolTable.lookup(binding, id());
+        if(value==nullptr) throw CodegenException("identifier not found: " + name());
         return value->get_llvmptr();
     }
 
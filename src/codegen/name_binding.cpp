@@ -0,0 +1,157 @@
+/**
+ * @file name_binding.cpp
+ * @brief 名字绑定的实现
+ * @version 0.1
+ * @date 2021-06-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "utils/ast.hpp"
+#include "name_binding.h"
+
+using namespace spc;
+
+void NameBinder::declare(Scope &scope, SymbolId name)
+{
+    if (scope.index.insert({name, scope.size}).second) ++scope.size;
+}
+
+void NameBinder::bind(ProgramNode *program)
+{
+    //与ProgramNode::codegen的声明顺序一致: 常量，变量，然后是各个子过程，最后是主程序
+    for (auto child : program->head_list->const_list->children())
+    {
+        auto decl = cast_node<ConstDeclNode>(child);
+        if (is_a_ptr_of<StringNode>(decl->value)) continue; //字符串常量不进符号表
+        declare(globals, decl->name->id());
+    }
+    for (auto child : program->head_list->var_list->children())
+        declare(globals, cast_node<VarDeclNode>(child)->name->id());
+
+    for (auto child : program->head_list->subroutine_list->children())
+        bind_subroutine(cast_node<SubroutineNode>(child));
+
+    for (auto stmt : program->children()) visit(stmt);
+}
+
+void NameBinder::bind_subroutine(SubroutineNode *routine)
+{
+    //与SubroutineNode::codegen的声明顺序一致: 参数，返回值，常量，变量
+    locals.emplace_back();
+    auto &scope = locals.back();
+    for (auto child : routine->params->children())
+        declare(scope, cast_node<ParamDeclNode>(child)->name->id());
+    if (routine->return_type->type != Type::VOID)
+        declare(scope, routine->name->id());
+    for (auto child : routine->head_list->const_list->children())
+        declare(scope, cast_node<ConstDeclNode>(child)->name->id());
+    for (auto child : routine->head_list->var_list->children())
+        declare(scope, cast_node<VarDeclNode>(child)->name->id());
+
+    for (auto child : routine->head_list->subroutine_list->children())
+        bind_subroutine(cast_node<SubroutineNode>(child));
+
+    for (auto stmt : routine->children()) visit(stmt);
+    locals.pop_back();
+}
+
+void NameBinder::bind_ref(LeftValueExprNode *node)
+{
+    if (!locals.empty())
+    {
+        auto it = locals.back().index.find(node->id());
+        if (it != locals.back().index.end())
+        {
+            node->binding = Binding{Binding::Scope::LOCAL, it->second};
+            return;
+        }
+    }
+    auto it = globals.index.find(node->id());
+    if (it != globals.index.end())
+        node->binding = Binding{Binding::Scope::GLOBAL, it->second};
+}
+
+void NameBinder::visit(AbstractNode *node)
+{
+    if (node == nullptr) return;
+    switch (node->kind())
+    {
+        case NodeKind::Identifier:
+        case NodeKind::RecordRef:
+            bind_ref(cast_node<LeftValueExprNode>(node));
+            return;
+        case NodeKind::ArrayRef:
+            bind_ref(cast_node<LeftValueExprNode>(node));
+            visit(cast_node<ArrayRefNode>(node)->index);
+            return;
+        case NodeKind::BinopExpr:
+        {
+            auto binop = cast_node<BinopExprNode>(node);
+            visit(binop->lhs);
+            visit(binop->rhs);
+            return;
+        }
+        case NodeKind::FuncExpr:
+            visit(cast_node<FuncExprNode>(node)->func_call);
+            return;
+        case NodeKind::ProcStmt:
+            visit(cast_node<ProcStmtNode>(node)->proc_call);
+            return;
+        case NodeKind::RoutineCall:
+            visit(cast_node<RoutineCallNode>(node)->args);
+            return;
+        case NodeKind::SysCall:
+            visit(cast_node<SysCallNode>(node)->args);
+            return;
+        case NodeKind::AssignStmt:
+        {
+            auto assign = cast_node<AssignStmtNode>(node);
+            visit(assign->lhs);
+            visit(assign->rhs);
+            return;
+        }
+        case NodeKind::IfStmt:
+        {
+            auto if_stmt = cast_node<IfStmtNode>(node);
+            visit(if_stmt->expr);
+            visit(if_stmt->stmt);
+            visit(if_stmt->else_stmt);
+            return;
+        }
+        case NodeKind::WhileStmt:
+        {
+            auto while_stmt = cast_node<WhileStmtNode>(node);
+            visit(while_stmt->expr);
+            visit(while_stmt->stmt);
+            return;
+        }
+        case NodeKind::RepeatStmt:
+            visit(cast_node<RepeatStmtNode>(node)->expr);
+            break;
+        case NodeKind::ForStmt:
+        {
+            auto for_stmt = cast_node<ForStmtNode>(node);
+            visit(for_stmt->identifier);
+            visit(for_stmt->start);
+            visit(for_stmt->finish);
+            visit(for_stmt->stmt);
+            return;
+        }
+        case NodeKind::CaseStmt:
+            visit(cast_node<CaseStmtNode>(node)->expr);
+            break;
+        case NodeKind::CaseExpr:
+        {
+            auto case_expr = cast_node<CaseExprNode>(node);
+            visit(case_expr->branch);
+            visit(case_expr->stmt);
+            return;
+        }
+        default:
+            break;
+    }
+    //语句块，参数列表等容器节点 以及repeat与case的子语句 常量等叶子节点没有子节点
+    if (!node->should_have_children()) return;
+    for (auto child : node->children()) visit(child);
+}
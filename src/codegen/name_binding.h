@@ -0,0 +1,54 @@
+/**
+ * @file name_binding.h
+ * @brief 名字绑定. 代码生成之前遍历一次语法树，把每个变量引用绑定到它所在作用域的槽位上
+ * @version 0.1
+ * @date 2021-06-07
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_NAME_BINDING_H
+#define NAIVE_PASCAL_COMPILER_NAME_BINDING_H
+
+#include <vector>
+#include <llvm/ADT/DenseMap.h>
+#include "ast/ast_base.h"
+
+namespace spc
+{
+    /**
+     * @brief 名字绑定器.
+     * 按代码生成向符号表声明符号的顺序给每个作用域中的符号编排槽位，再把引用它们的左值节点绑定到对应槽位，
+     * 这样代码生成时SymbolTable::lookup只需要一次下标访问. 找不到声明的引用保持未绑定，由代码生成按名字查找并报错
+     */
+    class NameBinder final
+    {
+    public:
+        /**
+         * @brief 绑定整个程序
+         *
+         * @param program 语法树根节点
+         */
+        void bind(ProgramNode *program);
+
+    private:
+        /// 一层作用域 只记录名字对应的槽位
+        struct Scope
+        {
+            llvm::DenseMap<SymbolId, unsigned> index;
+            unsigned size = 0;
+        };
+
+        /// 在作用域中声明一个名字，重复声明不会占用新的槽位(代码生成时会报错)
+        static void declare(Scope &scope, SymbolId name);
+        void bind_subroutine(SubroutineNode *routine);
+        void bind_ref(LeftValueExprNode *node);
+        void visit(AbstractNode *node);
+
+        Scope globals;
+        /// 局部作用域栈 与代码生成时SymbolTable的局部作用域栈一一对应
+        std::vector<Scope> locals;
+    };
+}
+
+#endif //NAIVE_PASCAL_COMPILER_NAME_BINDING_H
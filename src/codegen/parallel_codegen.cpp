@@ -0,0 +1,451 @@
+/**
+ * @file parallel_codegen.cpp
+ * @brief 并行生成子过程的实现
+ * @version 0.1
+ * @date 2021-06-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include "utils/ast.hpp"
+#include "utils/thread_pool.hpp"
+#include "codegen_context.hpp"
+#include "parallel_codegen.h"
+
+namespace spc
+{
+    namespace
+    {
+        /// 工作线程写出bitcode前把结构体改名为这个前缀加上它在record_types中的位置，主线程据此找到对应的结构体
+        const char record_tag[] = "spc.record.";
+
+        /// 一个子过程在工作线程module中新增的全局变量(字符串常量)，函数与结构体 按创建顺序排列
+        struct Segment
+        {
+            /// 段中一个函数对应的子过程 由其他线程生成、这里只是声明的子过程没有node
+            struct Routine
+            {
+                SymbolId id;
+                SubroutineNode *node;
+            };
+
+            unsigned worker = 0;
+            bool done = false;
+            /// 生成失败时的异常 在主线程中按子过程的顺序重新抛出，报告的错误与串行生成时相同
+            std::exception_ptr error;
+            size_t first_global = 0, last_global = 0;
+            size_t first_function = 0, last_function = 0;
+            size_t first_record = 0, last_record = 0;
+            /// 以函数在段中的位置为键
+            llvm::DenseMap<size_t, Routine> routines;
+        };
+
+        /// 把工作线程中的类型换成主线程中的类型
+        class RecordRemapper final : public llvm::ValueMapTypeRemapper
+        {
+        public:
+            llvm::DenseMap<llvm::StructType *, llvm::StructType *> records;
+
+            llvm::Type *remapType(llvm::Type *type) override
+            {
+                auto it = cache.find(type);
+                if (it != cache.end()) return it->second;
+                return cache[type] = remap(type);
+            }
+
+        private:
+            llvm::Type *remap(llvm::Type *type)
+            {
+                auto *record = llvm::dyn_cast<llvm::StructType>(type);
+                if (record && !record->isLiteral())
+                {
+                    auto it = records.find(record);
+                    return it == records.end() ? type : it->second;
+                }
+
+                llvm::SmallVector<llvm::Type *, 8> types;
+                bool changed = false;
+                for (auto *subtype : type->subtypes())
+                {
+                    types.push_back(remapType(subtype));
+                    changed |= types.back() != subtype;
+                }
+                if (!changed) return type;
+                switch (type->getTypeID())
+                {
+                    case llvm::Type::PointerTyID:
+                        return llvm::PointerType::get(types[0], type->getPointerAddressSpace());
+                    case llvm::Type::ArrayTyID:
+                        return llvm::ArrayType::get(types[0], type->getArrayNumElements());
+                    case llvm::Type::FunctionTyID:
+                        return llvm::FunctionType::get(types[0], llvm::makeArrayRef(types).slice(1),
+                                                       type->isFunctionVarArg());
+                    case llvm::Type::StructTyID:
+                        return llvm::StructType::get(type->getContext(), types, record->isPacked());
+                    default:
+                        return type;
+                }
+            }
+
+            llvm::DenseMap<llvm::Type *, llvm::Type *> cache;
+        };
+
+        struct Worker
+        {
+            std::unique_ptr<CodegenContext> context;
+            /// 顶层子过程[0, visible_routines)及其嵌套子过程 串行生成到当前子过程时它们都已声明
+            std::unordered_map<SymbolId, SubroutineNode *> visible;
+            size_t visible_routines = 0;
+            /// 生成当前子过程时按需声明的其他子过程
+            std::vector<std::pair<llvm::Function *, SymbolId>> declared;
+            size_t globals = 0, functions = 0;
+            std::vector<const TypeNode *> record_nodes;
+            std::vector<std::string> record_names;
+            std::exception_ptr error;
+            std::string bitcode;
+
+            /// 在主线程中解析出的module与合并用的映射
+            std::unique_ptr<llvm::Module> module;
+            std::vector<llvm::GlobalVariable *> module_globals;
+            std::vector<llvm::Function *> module_functions;
+            std::vector<llvm::StructType *> module_records;
+            RecordRemapper remapper;
+            llvm::ValueToValueMapTy values;
+        };
+
+        void collect_routines(SubroutineNode *routine, std::vector<SubroutineNode *> &routines)
+        {
+            routines.push_back(routine);
+            for (auto child : routine->head_list->subroutine_list->children())
+                collect_routines(cast_node<SubroutineNode>(child), routines);
+        }
+
+        /// 名字中第一个'.'之后是LLVM为避免重名加上的后缀 Pascal的标识符中不会有'.'
+        llvm::StringRef base_name(llvm::StringRef name)
+        {
+            return name.substr(0, name.find('.'));
+        }
+
+        template<typename Iterator, typename List>
+        Iterator next_of(Iterator last, List &&list)
+        {
+            return last == list.end() ? list.begin() : std::next(last);
+        }
+
+        void generate(ProgramNode *program, const std::vector<SubroutineNode *> &routines, std::vector<Segment> &segments,
+                      std::atomic<size_t> &next, std::atomic<size_t> &failed, Worker &worker, unsigned index,
+                      const CodegenContext &main)
+        {
+            worker.context = std::make_unique<CodegenContext>(main.module->getModuleIdentifier(), main.fpm != nullptr);
+            auto &context = *worker.context;
+            auto &module = *context.module;
+            context.module->setDataLayout(main.module->getDataLayout());
+            context.module->setTargetTriple(main.module->getTargetTriple());
+            try
+            {
+                //全局部分与主线程中的完全相同，所以全局变量与符号表槽位都一致
+                context.is_subroutine = false;
+                program->head_list->const_list->codegen(context);
+                program->head_list->type_list->codegen(context);
+                program->head_list->var_list->codegen(context);
+            }
+            catch (...)
+            {
+                worker.error = std::current_exception();
+                return;
+            }
+            worker.globals = std::distance(module.global_begin(), module.global_end());
+            worker.functions = std::distance(module.begin(), module.end());
+            context.resolve_function = [&worker](SymbolId id) -> llvm::Function * {
+                auto it = worker.visible.find(id);
+                if (it == worker.visible.end()) return nullptr;
+                auto *routine = it->second;
+                worker.visible.erase(it); //declare会先查找已有的声明，删掉避免再回到这里
+                auto *func = routine->declare(*worker.context);
+                worker.declared.emplace_back(func, id);
+                return func;
+            };
+
+            //同一个线程领取的编号是递增的
+            for (size_t k = next++; k < routines.size() && k < failed; k = next++)
+            {
+                for (; worker.visible_routines < k; ++worker.visible_routines)
+                {
+                    std::vector<SubroutineNode *> nested;
+                    collect_routines(routines[worker.visible_routines], nested);
+                    for (auto *routine : nested) worker.visible.emplace(routine->name->id(), routine);
+                }
+
+                auto &segment = segments[k];
+                segment.worker = index;
+                auto last_global = module.global_empty() ? module.global_end() : std::prev(module.global_end());
+                auto last_function = module.empty() ? module.end() : std::prev(module.end());
+                auto records = context.record_types.size();
+                worker.declared.clear();
+                context.is_subroutine = true;
+                try
+                { routines[k]->codegen(context); }
+                catch (...)
+                {
+                    segment.error = std::current_exception();
+                    for (auto &func : module) //删掉生成到一半的函数体，保证写出的bitcode是合法的IR
+                    {
+                        for (auto &block : func)
+                        {
+                            if (block.getTerminator() != nullptr) continue;
+                            func.deleteBody();
+                            break;
+                        }
+                    }
+                    for (auto expected = failed.load(); k < expected && !failed.compare_exchange_weak(expected, k);) {}
+                    break;
+                }
+
+                segment.first_global = worker.globals;
+                worker.globals += std::distance(next_of(last_global, module.globals()), module.global_end());
+                segment.last_global = worker.globals;
+
+                llvm::DenseMap<llvm::Function *, size_t> positions;
+                for (auto it = next_of(last_function, module); it != module.end(); ++it)
+                {
+                    auto position = positions.size();
+                    positions[&*it] = position;
+                }
+                segment.first_function = worker.functions;
+                worker.functions += positions.size();
+                segment.last_function = worker.functions;
+                std::vector<SubroutineNode *> defined;
+                collect_routines(routines[k], defined);
+                for (auto *routine : defined)
+                {
+                    auto func = context.functions.find(routine->name->id());
+                    if (func == context.functions.end()) continue;
+                    auto it = positions.find(func->second);
+                    if (it != positions.end()) segment.routines[it->second] = {routine->name->id(), routine};
+                }
+                for (auto &declared : worker.declared)
+                {
+                    auto it = positions.find(declared.first);
+                    if (it != positions.end()) segment.routines.try_emplace(it->second, Segment::Routine{declared.second, nullptr});
+                }
+
+                segment.first_record = records;
+                segment.last_record = context.record_types.size();
+                segment.done = true;
+            }
+
+            size_t position = 0;
+            for (auto &record : context.record_types)
+            {
+                worker.record_nodes.push_back(record.first);
+                worker.record_names.push_back(base_name(record.second->getName()).str());
+                record.second->setName(record_tag + std::to_string(position++));
+            }
+            llvm::raw_string_ostream out(worker.bitcode);
+            llvm::WriteBitcodeToFile(module, out, true); //保留use-list的顺序，否则基本块前驱的顺序会与串行生成不同
+            out.flush();
+            worker.context.reset();
+        }
+
+        /// 在主线程的LLVMContext中解析工作线程写出的bitcode
+        void load(Worker &worker, CodegenContext &context, const std::vector<llvm::StructType *> &globals)
+        {
+            auto module = llvm::parseBitcodeFile(llvm::MemoryBufferRef(worker.bitcode, "routines"), *context.llvm_context);
+            if (!module)
+            {
+                llvm::consumeError(module.takeError());
+                throw CodegenException("failed to read the code generated by a worker thread");
+            }
+            worker.module = std::move(*module);
+            worker.bitcode.clear();
+            for (auto &var : worker.module->globals())
+            {
+                worker.module_globals.push_back(&var);
+                if (var.hasName()) //用户定义的全局变量 字符串常量没有名字
+                {
+                    if (auto *dst = context.module->getNamedGlobal(var.getName())) worker.values[&var] = dst;
+                }
+                else if (auto *pooled = context.string_pool_slot(var))
+                {
+                    if (*pooled != nullptr) worker.values[&var] = *pooled; //常量部分的字符串，子过程中相同的字符串也用它
+                }
+            }
+            for (auto &func : *worker.module) worker.module_functions.push_back(&func);
+            for (auto *record : worker.module->getIdentifiedStructTypes())
+            {
+                auto name = record->getName();
+                if (!name.startswith(record_tag)) continue;
+                auto position = std::strtoul(name.data() + sizeof(record_tag) - 1, nullptr, 10);
+                if (position < globals.size()) worker.remapper.records[record] = globals[position];
+                else
+                {
+                    if (worker.module_records.size() <= position) worker.module_records.resize(position + 1);
+                    worker.module_records[position] = record;
+                }
+            }
+        }
+
+        /// 按串行生成的顺序把一个子过程的生成结果合并进context.module
+        void merge(const Segment &segment, Worker &worker, CodegenContext &context,
+                   const std::vector<llvm::StructType *> &records)
+        {
+            auto &remapper = worker.remapper;
+            auto &values = worker.values;
+            for (auto position = segment.first_record; position < segment.last_record; ++position)
+            {
+                if (position >= worker.module_records.size() || worker.module_records[position] == nullptr)
+                    continue; //没有用到的结构体 串行生成时也不会输出
+                auto *source = worker.module_records[position];
+                auto *record = records[position - segment.first_record];
+                remapper.records[source] = record;
+                llvm::SmallVector<llvm::Type *, 8> elements;
+                for (auto *element : source->elements()) elements.push_back(remapper.remapType(element));
+                record->setBody(elements, source->isPacked());
+            }
+
+            std::vector<std::pair<llvm::GlobalVariable *, llvm::GlobalVariable *>> globals;
+            for (auto position = segment.first_global; position < segment.last_global; ++position)
+            {
+                auto *source = worker.module_globals[position];
+                //字符串常量与串行生成一样放进主线程的常量池，内容相同的只保留第一个
+                auto *pooled = context.string_pool_slot(*source);
+                if (pooled != nullptr && *pooled != nullptr)
+                {
+                    values[source] = *pooled;
+                    continue;
+                }
+                auto *global = new llvm::GlobalVariable(*context.module, remapper.remapType(source->getValueType()),
+                                                        source->isConstant(), source->getLinkage(), nullptr,
+                                                        source->getName(), nullptr, source->getThreadLocalMode(),
+                                                        source->getAddressSpace());
+                global->copyAttributesFrom(source);
+                if (pooled != nullptr) *pooled = global;
+                values[source] = global;
+                globals.emplace_back(source, global);
+            }
+
+            std::vector<std::pair<llvm::Function *, llvm::Function *>> bodies;
+            for (auto position = segment.first_function; position < segment.last_function; ++position)
+            {
+                auto *source = worker.module_functions[position];
+                auto routine = segment.routines.find(position - segment.first_function);
+                auto *type = remapper.remapType(source->getType());
+                //内建函数(llvm.sqrt.f64等)的名字本身带有'.'
+                auto name = source->isIntrinsic() ? source->getName() : base_name(source->getName());
+                if (source->isDeclaration())
+                {
+                    //其他子过程与之前已经声明过的库函数
+                    llvm::Function *func = nullptr;
+                    if (routine != segment.routines.end()) func = context.getFunction(routine->second.id);
+                    if (func == nullptr) func = context.module->getFunction(name);
+                    if (func != nullptr)
+                    {
+                        values[source] = func->getType() == type ? static_cast<llvm::Constant *>(func)
+                                                                 : llvm::ConstantExpr::getBitCast(func, type);
+                        continue;
+                    }
+                }
+                else if (routine != segment.routines.end() && routine->second.node != nullptr)
+                {
+                    auto *func = context.getFunction(routine->second.id);
+                    if (func != nullptr && !func->empty())
+                        throw CodegenException("duplicate routine: " + routine->second.node->name->name());
+                }
+
+                auto *func = llvm::Function::Create(llvm::cast<llvm::FunctionType>(remapper.remapType(source->getFunctionType())),
+                                                    source->getLinkage(), name,
+                                                    context.module.get());
+                func->copyAttributesFrom(source);
+                values[source] = func;
+                if (routine != segment.routines.end() && routine->second.node != nullptr)
+                    context.functions.emplace(routine->second.id, func);
+                if (source->isDeclaration()) continue;
+                auto arg = func->arg_begin();
+                for (auto &source_arg : source->args())
+                {
+                    arg->setName(source_arg.getName());
+                    values[&source_arg] = &*arg++;
+                }
+                bodies.emplace_back(source, func);
+            }
+
+            for (auto &global : globals)
+            {
+                if (global.first->hasInitializer())
+                    global.second->setInitializer(llvm::MapValue(global.first->getInitializer(), values,
+                                                                 llvm::RF_None, &remapper));
+            }
+            for (auto &body : bodies)
+            {
+                body.second->getBasicBlockList().splice(body.second->end(), body.first->getBasicBlockList());
+                llvm::RemapFunction(*body.second, values, llvm::RF_IgnoreMissingLocals, &remapper);
+            }
+        }
+    }
+
+    void codegen_subroutines_in_parallel(ProgramNode *program, CodegenContext &context, unsigned jobs)
+    {
+        std::vector<SubroutineNode *> routines;
+        for (auto child : program->head_list->subroutine_list->children())
+            routines.push_back(cast_node<SubroutineNode>(child));
+        if (routines.empty()) return;
+
+        std::vector<Segment> segments(routines.size());
+        std::vector<Worker> workers(std::min<size_t>(std::max(1u, jobs), routines.size()));
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> failed{std::numeric_limits<size_t>::max()};
+        parallel_for(static_cast<unsigned>(workers.size()), workers.size(), [&](size_t index) {
+            generate(program, routines, segments, next, failed, workers[index], static_cast<unsigned>(index), context);
+        });
+
+        //先按串行生成的顺序创建所有局部结构体，再解析bitcode(解析时也会创建结构体)，这样结构体的名字与串行生成时相同
+        std::vector<llvm::StructType *> globals;
+        for (auto &record : context.record_types) globals.push_back(record.second);
+        std::vector<std::vector<llvm::StructType *>> records(routines.size());
+        for (size_t k = 0; k < routines.size() && segments[k].done; ++k)
+        {
+            auto &segment = segments[k];
+            auto &worker = workers[segment.worker];
+            for (auto position = segment.first_record; position < segment.last_record; ++position)
+            {
+                auto *record = llvm::StructType::create(*context.llvm_context, worker.record_names[position]);
+                records[k].push_back(record);
+                context.record_types[worker.record_nodes[position]] = record;
+            }
+        }
+        for (auto &worker : workers)
+        {
+            if (!worker.bitcode.empty()) load(worker, context, globals);
+        }
+
+        for (size_t k = 0; k < routines.size(); ++k)
+        {
+            auto &segment = segments[k];
+            auto *existing = context.getFunction(routines[k]->name->id());
+            if (existing != nullptr && !existing->empty())
+                throw CodegenException("duplicate routine: " + routines[k]->name->name());
+            if (!segment.done)
+            {
+                if (segment.error) std::rethrow_exception(segment.error);
+                for (auto &worker : workers)
+                {
+                    if (worker.error) std::rethrow_exception(worker.error);
+                }
+                throw CodegenException("routine was not generated: " + routines[k]->name->name());
+            }
+            merge(segment, workers[segment.worker], context, records[k]);
+        }
+    }
+}
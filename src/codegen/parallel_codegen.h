@@ -0,0 +1,31 @@
+/**
+ * @file parallel_codegen.h
+ * @brief 并行生成子过程. 每个工作线程有自己的LLVMContext与module，先生成全局常量，类型与变量，
+ * 再按编号领取顶层子过程，生成并经过函数级优化后写成bitcode；主线程按子过程的顺序把各线程的结果合并进context.module
+ *
+ * 合并时按串行生成的顺序创建函数，全局变量与结构体，名字冲突时LLVM加上的后缀也与串行生成时相同，
+ * 所以输出与串行生成逐字节一致
+ * @version 0.1
+ * @date 2021-06-17
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_PARALLEL_CODEGEN_H
+#define NAIVE_PASCAL_COMPILER_PARALLEL_CODEGEN_H
+
+#include "ast/ast_base.h"
+
+namespace spc
+{
+    /**
+     * @brief 用多个线程生成程序的所有顶层子过程 调用前全局常量，类型与变量必须已经生成在context中
+     *
+     * @param program 语法树根节点
+     * @param context 代码生成上下文
+     * @param jobs 线程数量
+     */
+    void codegen_subroutines_in_parallel(ProgramNode *program, CodegenContext &context, unsigned jobs);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_PARALLEL_CODEGEN_H
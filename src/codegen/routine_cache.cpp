@@ -0,0 +1,167 @@
+/**
+ * @file routine_cache.cpp
+ * @brief 子过程粒度增量编译的实现
+ * @version 0.1
+ * @date 2021-06-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <iterator>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include "utils/ast.hpp"
+#include "driver/cache.h"
+#include "codegen_context.hpp"
+#include "routine_cache.h"
+
+namespace spc
+{
+    /**
+     * @brief 子过程依赖的程序上下文: 全局常量，类型，变量的声明以及所有顶层子过程的签名
+     * 这些改变时所有子过程都要重新生成
+     */
+    static std::string program_signature(ProgramNode *program)
+    {
+        auto head = program->head_list;
+        auto signature = head->const_list->to_json() + head->type_list->to_json() + head->var_list->to_json();
+        for (auto child : head->subroutine_list->children())
+        {
+            auto routine = cast_node<SubroutineNode>(child);
+            signature += routine->name->to_json() + routine->params->to_json() + routine->return_type->to_json();
+        }
+        return signature;
+    }
+
+    static std::string routine_key(const std::string &signature, SubroutineNode *routine, const CodegenContext &context)
+    {
+        llvm::SHA1 hasher;
+        auto separator = llvm::StringRef("\0", 1);
+        hasher.update("routine");
+        hasher.update(separator);
+        hasher.update(compiler_version());
+        hasher.update(separator);
+        //缓存的是生成的IR，逐函数的清理依赖目标平台与数据布局；-mcpu等选项只影响之后的优化与目标代码
+        hasher.update(context.module->getTargetTriple());
+        hasher.update(separator);
+        hasher.update(context.module->getDataLayoutStr());
+        hasher.update(separator);
+        hasher.update(context.fpm != nullptr ? "O" : "");
+        hasher.update(separator);
+        hasher.update(signature);
+        hasher.update(separator);
+        hasher.update(routine->to_json());
+        return llvm::toHex(hasher.final(), true);
+    }
+
+    static std::unique_ptr<llvm::Module> load_routine(CodegenContext &context, const std::string &key)
+    {
+        CompileResult entry;
+        if (!context.routine_cache->lookup(key, entry)) return nullptr;
+        auto module = llvm::parseBitcodeFile(llvm::MemoryBufferRef(entry.output, "routine"), *context.llvm_context);
+        if (!module)
+        {
+            llvm::consumeError(module.takeError()); //损坏的条目当作未命中
+            return nullptr;
+        }
+        return std::move(*module);
+    }
+
+    /**
+     * @brief 把刚生成的一组函数(子过程及其嵌套子过程)连同它们用到的字符串常量复制到一个单独的module中，写入缓存
+     * 其他函数与全局变量在复制出的module中只是外部声明
+     */
+    static void store_routine(CodegenContext &context, const std::string &key,
+                              const llvm::SmallPtrSetImpl<const llvm::Function *> &defined)
+    {
+        llvm::ValueToValueMapTy vmap;
+        auto routine = llvm::CloneModule(*context.module, vmap, [&](const llvm::GlobalValue *value) {
+            if (auto *func = llvm::dyn_cast<llvm::Function>(value)) return defined.count(func) > 0;
+            return value->hasPrivateLinkage(); //字符串常量
+        });
+        //删除用不到的声明与常量
+        for (auto it = routine->global_begin(); it != routine->global_end();)
+        {
+            auto &var = *it++;
+            var.removeDeadConstantUsers();
+            if ((var.isDeclaration() || var.hasPrivateLinkage()) && var.use_empty()) var.eraseFromParent();
+        }
+        for (auto it = routine->begin(); it != routine->end();)
+        {
+            auto &func = *it++;
+            if (func.isDeclaration() && func.use_empty()) func.eraseFromParent();
+        }
+
+        CompileResult entry;
+        llvm::raw_string_ostream out(entry.output);
+        llvm::WriteBitcodeToFile(*routine, out);
+        out.flush();
+        entry.success = true;
+        context.routine_cache->store(key, entry);
+    }
+
+    void codegen_subroutines_incrementally(ProgramNode *program, CodegenContext &context)
+    {
+        auto signature = program_signature(program);
+        auto &module = *context.module;
+        for (auto child : program->head_list->subroutine_list->children())
+        {
+            auto routine = cast_node<SubroutineNode>(child);
+            auto key = routine_key(signature, routine, context);
+            if (auto cached = load_routine(context, key))
+            {
+                routine->declare(context);
+                context.cached_routines.push_back(std::move(cached));
+                continue;
+            }
+
+            //新生成的函数都追加在module的末尾
+            auto last = module.empty() ? module.end() : std::prev(module.end());
+            routine->codegen(context);
+            llvm::SmallPtrSet<const llvm::Function *, 4> defined;
+            defined.insert(context.getFunction(routine->name->id()));
+            for (auto it = last == module.end() ? module.begin() : std::next(last); it != module.end(); ++it)
+                if (!it->isDeclaration()) defined.insert(&*it);
+            store_routine(context, key, defined);
+        }
+    }
+
+    void link_cached_routines(CodegenContext &context)
+    {
+        if (context.cached_routines.empty()) return;
+        //全局变量是internal的，不会与缓存中的外部声明链接到一起，所以链接期间暂时改为external
+        std::vector<llvm::GlobalVariable *> internals;
+        for (auto &var : context.module->globals())
+        {
+            if (!var.hasInternalLinkage()) continue;
+            internals.push_back(&var);
+            var.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+        for (auto &routine : context.cached_routines)
+        {
+            if (llvm::Linker::linkModules(*context.module, std::move(routine)))
+                throw CodegenException("failed to link a cached routine");
+        }
+        context.cached_routines.clear();
+        for (auto *var : internals) var->setLinkage(llvm::GlobalValue::InternalLinkage);
+        //缓存中的字符串常量链接后是新的全局变量，换成常量池中内容相同的那一个
+        for (auto it = context.module->global_begin(); it != context.module->global_end();)
+        {
+            auto &var = *it++;
+            auto *pooled = context.string_pool_slot(var);
+            if (pooled == nullptr) continue;
+            if (*pooled == nullptr) *pooled = &var;
+            else if (*pooled != &var)
+            {
+                var.replaceAllUsesWith(*pooled);
+                var.eraseFromParent();
+            }
+        }
+    }
+}
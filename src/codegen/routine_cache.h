@@ -0,0 +1,34 @@
+/**
+ * @file routine_cache.h
+ * @brief 子过程粒度的增量编译. 每个顶层子过程以它的语法树，全局声明与所有子过程签名的哈希为键，
+ * 把生成(并经过函数级优化)的IR以bitcode形式放进编译缓存；没有改动的子过程直接从缓存取出，只声明不生成
+ * @version 0.1
+ * @date 2021-06-16
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_ROUTINE_CACHE_H
+#define NAIVE_PASCAL_COMPILER_ROUTINE_CACHE_H
+
+#include "ast/ast_base.h"
+
+namespace spc
+{
+    /**
+     * @brief 生成程序的所有顶层子过程 命中缓存的子过程只生成声明，等到link_cached_routines时再链接进来
+     *
+     * @param program 语法树根节点
+     * @param context 代码生成上下文 context.routine_cache不能为空
+     */
+    void codegen_subroutines_incrementally(ProgramNode *program, CodegenContext &context);
+
+    /**
+     * @brief 把从缓存中取出的子过程链接进context.module
+     *
+     * @param context 代码生成上下文
+     */
+    void link_cached_routines(CodegenContext &context);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_ROUTINE_CACHE_H
@@ -16,9 +16,15 @@ namespace spc
 {
     llvm::Value *RoutineCallNode::codegen(CodegenContext &context)
     {
-        auto *func = context.module->getFunction(identifier->name);
+        auto *func = context.getFunction(identifier->id());
+        SysRoutine routine;
+        //没有同名的用户函数时才是预定义的数学函数
+        if (func == nullptr && predeclared_routine(identifier->name(), routine))
+        { return SysCallNode::codegen_routine(context, routine, args); }
+        if (func == nullptr)
+        { throw CodegenException("routine not found: " + identifier->name() + "()"); }
         if (func->arg_size() != args->children().size())
-        { throw CodegenException("wrong number of arguments: " + identifier->name + "()"); }
+        { throw CodegenException("wrong number of arguments: " + identifier->name() + "()"); }
         std::vector<llvm::Value*> values;
         // TODO: check type compatibility between arguments and parameters
         for (auto &arg : args->children()) values.push_back(arg->codegen(context));
@@ -15,6 +15,9 @@
 #include "utils/ast.hpp"
 #include "codegen/codegen_context.hpp"
 #include "utils/ast_utils.hpp"
+#include "codegen/name_binding.h"
+#include "codegen/routine_cache.h"
+#include "codegen/parallel_codegen.h"
 
 namespace spc
 {
@@ -26,13 +29,19 @@ namespace spc
      */
     llvm::Value *ProgramNode::codegen(CodegenContext &context)
     {
+        NameBinder().bind(this); //先把所有变量引用绑定到符号表槽位上
         context.is_subroutine = false; //设置不是子过程 所以接下来的const，type，var会定义到全局变量中
         head_list->const_list->codegen(context);
         head_list->type_list->codegen(context);
         head_list->var_list->codegen(context);
 
         context.is_subroutine = true; //子过程是局部的
-        head_list->subroutine_list->codegen(context);
+        if (context.routine_cache)
+        { codegen_subroutines_incrementally(this, context); }
+        else if (context.jobs > 1)
+        { codegen_subroutines_in_parallel(this, context, context.jobs); }
+        else
+        { head_list->subroutine_list->codegen(context); }
 
         context.is_subroutine = false;
 
@@ -42,31 +51,47 @@ namespace spc
         auto *block = llvm::BasicBlock::Create(context.module->getContext(), "entry", main_func);
         context.builder.SetInsertPoint(block);
         for (auto &stmt : children()) stmt->codegen(context);
+        //运行时库的输出缓冲区在程序结束时写出 libspcrt在退出时也会写出，但lli与JIT中不运行它的析构函数
+        context.builder.CreateCall(context.runtime_function("spc_flush", context.builder.getVoidTy(), {}));
         context.builder.CreateRet(context.builder.getInt32(0));
 
         llvm::verifyFunction(*main_func);
         if (context.fpm)
         { context.fpm->run(*main_func); }
-        if (context.mpm)
-        { context.mpm->run(*context.module); }
+        link_cached_routines(context); //模块级优化要看到所有函数
         return nullptr;
     }
 
-    llvm::Value *SubroutineNode::codegen(CodegenContext &context)
+    llvm::Function *SubroutineNode::declare(CodegenContext &context)
     {
+        if (auto *func = context.getFunction(name->id()))
+        { return func; }
         std::vector<llvm::Type*> llvmTypes;
-        std::vector<std::string> names;
-        std::vector<std::shared_ptr<TypeNode>> types;
         for (auto child : params->children())
         {
-            auto decl = cast_node<ParamDeclNode>(child);
-            types.push_back(decl->type);
-            llvmTypes.push_back(decl->type->get_llvm_type(context));
-            names.push_back(decl->name->name);
+            llvmTypes.push_back(cast_node<ParamDeclNode>(child)->type->get_llvm_type(context));
         }
         auto *func_type = llvm::FunctionType::get(return_type->get_llvm_type(context), llvmTypes, false);
         auto *func = llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
-                                            name->name, context.module.get());
+                                            name->name(), context.module.get());
+        context.functions[name->id()] = func;
+        return func;
+    }
+
+    llvm::Value *SubroutineNode::codegen(CodegenContext &context)
+    {
+        std::vector<InternedName> names;
+        std::vector<TypeNode *> types;
+        for (auto child : params->children())
+        {
+            auto decl = cast_node<ParamDeclNode>(child);
+            types.push_back(decl->type);
+            names.push_back(decl->name->symbol);
+        }
+        auto *func = declare(context);
+        if (!func->empty()) throw CodegenException("duplicate routine: " + name->name());
+        llvm::IRBuilderBase::InsertPointGuard guard(context.builder); //嵌套子过程生成完后要回到外层子过程继续生成
+        context.symbolTable.pushLocals();
         auto *block = llvm::BasicBlock::Create(context.module->getContext(), "entry", func);
         context.builder.SetInsertPoint(block);
         
@@ -74,16 +99,15 @@ namespace spc
         auto index = 0;
         for (auto &arg : func->args())
         {
-            std::string argName=names[index];
+            auto& argName=names[index];
             auto& argType=types[index];
-            context.symbolTable.addLocalSymbol(argName,argType);
-            auto ptr=context.symbolTable.getLocalSymbol(argName)->get_llvmptr();
+            auto ptr=context.symbolTable.addLocalSymbol(argName,argType)->get_llvmptr();
             context.builder.CreateStore(&arg,ptr);
             index+=1;
         }
         if (return_type->type != Type::VOID)
         {
-            context.symbolTable.addLocalSymbol(name->name,return_type);
+            context.symbolTable.addLocalSymbol(name->symbol,return_type);
         }
 
         head_list->codegen(context);
@@ -95,7 +119,7 @@ namespace spc
         }
         else //处理返回值
         {
-            auto local = context.symbolTable.getLocalSymbol(name->name); //根据Pascal的规则，对函数名的赋值即为返回值
+            auto local = context.symbolTable.getLocalSymbol(name->id()); //根据Pascal的规则，对函数名的赋值即为返回值
             //auto *local = context.get_local(name->name);  //根据Pascal的规则，对函数名的赋值即为返回值  
             auto *ret = context.builder.CreateLoad(local->get_llvmptr());
             context.builder.CreateRet(ret);
@@ -105,7 +129,7 @@ namespace spc
         if (context.fpm)
         { context.fpm->run(*func); }
 
-        context.symbolTable.resetLocals(); //清除局部信息 为下一个函数的生成做准备
+        context.symbolTable.popLocals(); //清除局部信息 恢复外层的局部符号
         return nullptr;
     }
 
@@ -37,7 +37,7 @@ namespace spc
                    (lhs_type->isIntegerTy(32) && rhs_type->isIntegerTy(32)) ||
                    (lhs_type->isDoubleTy()    && rhs_type->isDoubleTy())))
         {
-            throw CodegenException("incompatible type in assignments: " + assignee->name);
+            throw CodegenException("incompatible type in assignments: " + assignee->name());
         }
         context.builder.CreateStore(rhs, lhs);
         return nullptr;
@@ -139,23 +139,59 @@ namespace spc
         return nullptr;
     }
 
+    namespace
+    {
+        /**
+         * @brief 生成for循环的llvm.loop元数据 for循环总会结束(mustprogress).
+         * 不加向量化的提示: 计数器是phi的循环LoopVectorize自己就能识别，是否向量化交给代价模型与优化级别决定
+         */
+        llvm::MDNode *loop_metadata(llvm::LLVMContext &context)
+        {
+            std::vector<llvm::Metadata *> operands{nullptr};
+            operands.push_back(llvm::MDNode::get(context, llvm::MDString::get(context, "llvm.loop.mustprogress")));
+            auto *loop = llvm::MDNode::getDistinct(context, operands);
+            loop->replaceOperandWith(0, loop);
+            return loop;
+        }
+    }
+
     llvm::Value *ForStmtNode::codegen(CodegenContext &context)
     {
-        if (!identifier->codegen(context)->getType()->isIntegerTy(32))
+        auto *ptr = identifier->get_ptr(context);
+        if (!ptr->getType()->getPointerElementType()->isIntegerTy(32))
         { throw CodegenException("incompatible type in for iterator: expected int"); }
+        //初值与终值只计算一次
+        auto *start_value = start->codegen(context);
+        auto *finish_value = finish->codegen(context);
+        if (!start_value->getType()->isIntegerTy(32) || !finish_value->getType()->isIntegerTy(32))
+        { throw CodegenException("incompatible type in for bound: expected int"); }
 
-        auto init = make_node<AssignStmtNode>(identifier, start);
+        //旋转后的循环: 入口处判断一次是否执行，之后在循环末尾先与终值比较再递增，终值为maxint时也不会溢出
         auto upto = direction == DirectionEnum::TO;
-        auto cond = make_node<BinopExprNode>(upto ? BinaryOperator::LE : BinaryOperator::GE, identifier, finish);
-        auto iter = make_node<AssignStmtNode>(identifier,
-                make_node<BinopExprNode>(upto ? BinaryOperator::ADD :BinaryOperator::SUB,
-                                         identifier, make_node<IntegerNode>(1)));
-        auto compound = make_node<CompoundStmtNode>();
-        compound->add_child(stmt); compound->add_child(iter);
-        auto while_stmt = make_node<WhileStmtNode>(cond, compound);
-
-        init->codegen(context);
-        while_stmt->codegen(context);
+        auto *func = context.builder.GetInsertBlock()->getParent();
+        auto *entry_block = context.builder.GetInsertBlock();
+        auto *loop_block = llvm::BasicBlock::Create(context.module->getContext(), "for", func);
+        auto *cont_block = llvm::BasicBlock::Create(context.module->getContext(), "cont");
+        auto *enter = upto ? context.builder.CreateICmpSLE(start_value, finish_value)
+                           : context.builder.CreateICmpSGE(start_value, finish_value);
+        context.builder.CreateCondBr(enter, loop_block, cont_block);
+
+        //计数器是phi 每次迭代开始时写回循环变量，循环体读到的总是当前的值
+        context.builder.SetInsertPoint(loop_block);
+        auto *counter = context.builder.CreatePHI(context.builder.getInt32Ty(), 2, "counter");
+        counter->addIncoming(start_value, entry_block);
+        context.builder.CreateStore(counter, ptr);
+        stmt->codegen(context);
+        auto *latch_block = context.builder.GetInsertBlock();
+        auto *done = context.builder.CreateICmpEQ(counter, finish_value);
+        auto *next = upto ? context.builder.CreateNSWAdd(counter, context.builder.getInt32(1))
+                          : context.builder.CreateNSWSub(counter, context.builder.getInt32(1));
+        counter->addIncoming(next, latch_block);
+        auto *back_edge = context.builder.CreateCondBr(done, cont_block, loop_block);
+        back_edge->setMetadata(llvm::LLVMContext::MD_loop, loop_metadata(context.module->getContext()));
+
+        func->getBasicBlockList().push_back(cont_block);
+        context.builder.SetInsertPoint(cont_block);
         return nullptr;
     }
 }
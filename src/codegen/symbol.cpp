@@ -12,48 +12,76 @@
 #include "codegen_context.hpp"
 #include <fmt/core.h>
 #include <typeinfo>
+#include <utility>
 
 using namespace spc;
 using std::string;
-using std::shared_ptr;
-using std::make_shared;
 
-bool SymbolTable::addLocalSymbol(string name,shared_ptr<TypeNode> type,bool isConst){
-    if(localSymbols.count(name)>0){
-        throw CodegenException(fmt::format("Duplicate local name {}",name));
-        return false;
+Symbol *SymbolTable::Scope::find(SymbolId name){
+    auto it=index.find(name);
+    if(it==index.end()){
+        return nullptr;
+    }
+    return &slots[it->second];
+}
+
+TypeNode *SymbolTable::Scope::findAlias(SymbolId name) const{
+    auto it=aliases.find(name);
+    if(it==aliases.end()){
+        return nullptr;
+    }
+    return it->second;
+}
+
+Symbol *SymbolTable::Scope::add(Symbol symbol){
+    index.insert({symbol.name.id,static_cast<unsigned>(slots.size())});
+    slots.push_back(std::move(symbol));
+    return &slots.back();
+}
+
+SymbolTable::Scope *SymbolTable::locals(){
+    if(localScopes.empty()){
+        return nullptr;
+    }
+    return &localScopes.back();
+}
+
+Symbol *SymbolTable::addLocalSymbol(const InternedName &name,TypeNode *type,bool isConst){
+    auto scope=locals();
+    if(scope==nullptr){
+        throw CodegenException(fmt::format("local name {} declared outside of a subroutine",name.str()));
     }
-    if(localAliases.count(name)>0){
-        throw CodegenException(fmt::format("When creating local variable detecting an existed alias named \"{}\"",name));
-        return false;
+    if(scope->index.count(name.id)>0){
+        throw CodegenException(fmt::format("Duplicate local name {}",name.str()));
+    }
+    if(scope->aliases.count(name.id)>0){
+        throw CodegenException(fmt::format("When creating local variable detecting an existed alias named \"{}\"",name.str()));
     }
     auto localVariable = context.builder.CreateAlloca(type->get_llvm_type(context));
-    localVariable->setName(name); //设置在LLVM IR中此变量的名字
-    localSymbols[name]=make_shared<Symbol>(name,type,localVariable,isConst);
-    return true;
+    localVariable->setName(name.str()); //设置在LLVM IR中此变量的名字
+    return scope->add(Symbol(name,type,localVariable,isConst));
 }
 
-std::shared_ptr<Symbol> SymbolTable::getLocalSymbol(string name){
-    if(localSymbols.count(name)==0){
+Symbol *SymbolTable::getLocalSymbol(SymbolId name){
+    auto scope=locals();
+    if(scope==nullptr){
         return nullptr;
     }
-    return localSymbols[name];
+    return scope->find(name);
 }
 
-bool SymbolTable::addGlobalSymbol(string name,shared_ptr<TypeNode> type,llvm::Constant* initializer,bool isConst){
-    if(globalSymbols.count(name)>0){
-        throw CodegenException(fmt::format("Duplicate global name {}",name));
-        return false;
+Symbol *SymbolTable::addGlobalSymbol(const InternedName &name,TypeNode *type,llvm::Constant* initializer,bool isConst){
+    if(globals.index.count(name.id)>0){
+        throw CodegenException(fmt::format("Duplicate global name {}",name.str()));
     }
-    if(globalAliases.count(name)>0){
-        throw CodegenException(fmt::format("When creating global variable detecting an existed alias named \"{}\"",name));
-        return false;
+    if(globals.aliases.count(name.id)>0){
+        throw CodegenException(fmt::format("When creating global variable detecting an existed alias named \"{}\"",name.str()));
     }
     auto llvmtype=type->get_llvm_type(context);
     llvm::Constant* constant=nullptr;
     if(is_a_ptr_of<AliasTypeNode>(type)){
         auto aliasTypePtr=cast_node<AliasTypeNode>(type);
-        type=getGlobalAlias(aliasTypePtr->identifier->name);
+        type=getGlobalAlias(aliasTypePtr->identifier->id());
     }
     switch(llvmtype->getTypeID()){
         case llvm::Type::IntegerTyID:
@@ -62,70 +90,83 @@ bool SymbolTable::addGlobalSymbol(string name,shared_ptr<TypeNode> type,llvm::Co
         case llvm::Type::DoubleTyID:
             constant = (initializer==nullptr)?llvm::ConstantFP::get(llvmtype,0):initializer;
             break;
-        case llvm::Type::ArrayTyID:
-            constant=llvm::ConstantAggregateZero::get(cast_node<ArrayTypeNode>(type)->element_type->get_llvm_type(context));
-            break;
+        case llvm::Type::ArrayTyID: //初值的类型必须与变量相同，否则拆分module时只会按元素的大小分配空间
         case llvm::Type::StructTyID:
-            constant=llvm::ConstantAggregateZero::get(cast_node<RecordTypeNode>(type)->innertype);
+            constant=llvm::ConstantAggregateZero::get(llvmtype);
             break;
         default:
             throw CodegenException("unsupported type: " + type2string(type->type));
     }
-    auto globalVariblePtr = new llvm::GlobalVariable(*context.module,type->get_llvm_type(context),isConst,llvm::GlobalVariable::InternalLinkage,constant,name);
-    globalSymbols[name]=make_shared<Symbol>(name,type,globalVariblePtr);
-    return true;
+    auto globalVariblePtr = new llvm::GlobalVariable(*context.module,type->get_llvm_type(context),isConst,llvm::GlobalVariable::InternalLinkage,constant,name.str());
+    return globals.add(Symbol(name,type,globalVariblePtr));
 }
 
-std::shared_ptr<Symbol> SymbolTable::getGlobalSymbol(std::string name){
-    if(globalSymbols.count(name)==0){
-        return nullptr;
+Symbol *SymbolTable::getGlobalSymbol(SymbolId name){
+    return globals.find(name);
+}
+
+Symbol *SymbolTable::lookup(const Binding &binding,SymbolId name){
+    Scope *scope=nullptr;
+    switch(binding.scope){
+        case Binding::Scope::LOCAL: scope=locals(); break;
+        case Binding::Scope::GLOBAL: scope=&globals; break;
+        default: break;
     }
-    return globalSymbols[name];
+    //槽位与名字一致时直接返回，否则(例如绑定之后声明顺序被改动)退回到按名字查找
+    if(scope!=nullptr && binding.slot<scope->slots.size()){
+        auto &symbol=scope->slots[binding.slot];
+        if(symbol.name.id==name){
+            return &symbol;
+        }
+    }
+    auto symbol=getLocalSymbol(name);
+    if(symbol==nullptr) symbol=getGlobalSymbol(name);
+    return symbol;
 }
 
-bool SymbolTable::addLocalAlias(std::string alias,std::shared_ptr<TypeNode> type){
-    if(localAliases.count(alias)){
-        throw CodegenException(fmt::format("Duplicate local alias {}",alias));
-        return false;
+bool SymbolTable::addLocalAlias(const InternedName &alias,TypeNode *type){
+    auto scope=locals();
+    if(scope==nullptr){
+        throw CodegenException(fmt::format("local alias {} declared outside of a subroutine",alias.str()));
+    }
+    if(scope->aliases.count(alias.id)){
+        throw CodegenException(fmt::format("Duplicate local alias {}",alias.str()));
     }
-    if(localSymbols.count(alias)){
-        throw CodegenException(fmt::format("When creating local alias detecting an existed alias named \"{}\"",alias));
-        return false;
+    if(scope->index.count(alias.id)){
+        throw CodegenException(fmt::format("When creating local alias detecting an existed alias named \"{}\"",alias.str()));
     }
-    localAliases[alias]=type;
+    scope->aliases[alias.id]=type;
     return true;
 }
 
-std::shared_ptr<TypeNode> SymbolTable::getLocalAlias(std::string name){
-    if(localAliases.count(name)==0){
+TypeNode *SymbolTable::getLocalAlias(SymbolId name){
+    auto scope=locals();
+    if(scope==nullptr){
         return nullptr;
     }
-    return localAliases[name];
+    return scope->findAlias(name);
 }
 
-bool SymbolTable::addGlobalAlias(std::string alias,std::shared_ptr<TypeNode> type){
-    if(globalAliases.count(alias)){
-        throw CodegenException(fmt::format("Duplicate global alias {}",alias));
-        return false;
+bool SymbolTable::addGlobalAlias(const InternedName &alias,TypeNode *type){
+    if(globals.aliases.count(alias.id)){
+        throw CodegenException(fmt::format("Duplicate global alias {}",alias.str()));
     }
-    if(globalAliases.count(alias)){
-        throw CodegenException(fmt::format("When creating global alias detecting an existed alias named \"{}\"",alias));
-        return false;
+    if(globals.index.count(alias.id)){
+        throw CodegenException(fmt::format("When creating global alias detecting an existed alias named \"{}\"",alias.str()));
     }
-    globalAliases[alias]=type;
+    globals.aliases[alias.id]=type;
     return true;
 }
 
-std::shared_ptr<TypeNode> SymbolTable::getGlobalAlias(std::string name){
-    if(globalAliases.count(name)==0)
-    {
-        
-        return nullptr;
-    }
-    return globalAliases[name];
+TypeNode *SymbolTable::getGlobalAlias(SymbolId name){
+    return globals.findAlias(name);
 }
 
-void SymbolTable::resetLocals(){
-    localAliases.clear();
-    localSymbols.clear();
-}
\ No newline at end of file
+void SymbolTable::pushLocals(){
+    localScopes.emplace_back();
+}
+
+void SymbolTable::popLocals(){
+    assert(!localScopes.empty() && "popLocals without matching pushLocals");
+    localScopes.pop_back();
+}
@@ -12,7 +12,8 @@
 #ifndef SYMBOL_H
 #define SYMBOL_H
 #include "ast/ast_base.h"
-#include <map>
+#include <vector>
+#include <llvm/ADT/DenseMap.h>
 
 namespace spc
 {
@@ -20,57 +21,64 @@ namespace spc
     struct CodegenContext;
     /// 符号实体 用来存放变量与其对应的指针
     struct Symbol{
-        std::string name; //符号名称
+        InternedName name; //符号名称
         bool isConst;
         llvm::Value * ptr;
-        std::shared_ptr<TypeNode> typeNode;
+        TypeNode *typeNode;
         /**
          * @brief 获得此符号的指针
          * 
          * @return llvm::Value* 
          */
         llvm::Value* get_llvmptr(){return ptr;}
-        Symbol(std::string name,std::shared_ptr<TypeNode> type,llvm::Value* ptr,bool isConst=false):name(name),typeNode(type),ptr(ptr),isConst(isConst){}
+        Symbol(const InternedName &name,TypeNode *type,llvm::Value* ptr,bool isConst=false):name(name),typeNode(type),ptr(ptr),isConst(isConst){}
         friend struct SymbolTable;
     };
     /**
-     * @brief 一个基础款的符号表
+     * @brief 按作用域分层的符号表. 全局作用域之上是一个局部作用域栈，每个子过程压入一层;
+     * 每层作用域里的符号按声明顺序放在连续的槽位中，名字绑定之后代码生成只需按槽位下标取符号
      * 
      */
     struct SymbolTable{
         SymbolTable(CodegenContext* context):context(*context){}
         /**
-         * @brief 添加局部变量 如果成功返回true 失败程序将终止
+         * @brief 在当前局部作用域中添加局部变量 失败将抛出异常
          * 
          * @param name 变量名
          * @param isConst 
-         * @return true 
-         * @return false 
+         * @return Symbol* 新添加的符号 在同一作用域再添加符号之前有效
          */
-        bool addLocalSymbol(std::string name,std::shared_ptr<TypeNode>,bool isConst=false);
+        Symbol *addLocalSymbol(const InternedName &name,TypeNode *,bool isConst=false);
         /**
-         * @brief 获取局部变量，如果失败将返回nullptr
+         * @brief 获取当前局部作用域中的变量，如果失败将返回nullptr
          * 
-         * @param name 
-         * @return std::shared_ptr<Symbol> 
+         * @param name 变量名编号
+         * @return Symbol* 
          */
-        std::shared_ptr<Symbol> getLocalSymbol(std::string name);
+        Symbol *getLocalSymbol(SymbolId name);
         /**
-         * @brief 添加全局变量 如果成功返回true 失败程序将终止
+         * @brief 添加全局变量 失败将抛出异常
          * 
          * @param name 变量名
          * @param isConst 
-         * @return true 
-         * @return false 
+         * @return Symbol* 新添加的符号 在再添加全局符号之前有效
          */
-        bool addGlobalSymbol(std::string name,std::shared_ptr<TypeNode>,llvm::Constant* initializer,bool isConst=false);
+        Symbol *addGlobalSymbol(const InternedName &name,TypeNode *,llvm::Constant* initializer,bool isConst=false);
         /**
          * @brief 获取全局变量 如果失败返回nullptr
          * 
-         * @param name 
-         * @return std::shared_ptr<Symbol> 
+         * @param name 变量名编号
+         * @return Symbol* 
          */
-        std::shared_ptr<Symbol> getGlobalSymbol(std::string name);
+        Symbol *getGlobalSymbol(SymbolId name);
+        /**
+         * @brief 按名字绑定的结果取出符号. 已绑定时直接按槽位取，未绑定(或槽位与名字对不上)时先查局部再查全局
+         * 
+         * @param binding 名字绑定的结果
+         * @param name 变量名编号
+         * @return Symbol* 找不到时返回nullptr
+         */
+        Symbol *lookup(const Binding &binding,SymbolId name);
         /**
          * @brief 添加局部别名 成功返回true 失败程序终止
          * 
@@ -79,14 +87,14 @@ namespace spc
          * @return true 
          * @return false 
          */
-        bool addLocalAlias(std::string alias,std::shared_ptr<TypeNode> type);
+        bool addLocalAlias(const InternedName &alias,TypeNode *type);
         /**
          * @brief 获取局部别名 失败返回nullptr
          * 
-         * @param name 
-         * @return std::shared_ptr<TypeNode> 
+         * @param name 别名编号
+         * @return TypeNode* 
          */
-        std::shared_ptr<TypeNode> getLocalAlias(std::string name);
+        TypeNode *getLocalAlias(SymbolId name);
         /**
          * @brief 添加全局变量 成功返回true 失败程序终止
          * 
@@ -95,28 +103,44 @@ namespace spc
          * @return true 
          * @return false 
          */
-        bool addGlobalAlias(std::string alias,std::shared_ptr<TypeNode> type);
+        bool addGlobalAlias(const InternedName &alias,TypeNode *type);
         /**
          * @brief 获取局部变量 失败返回nullptr
          * 
-         * @param name 
-         * @return std::shared_ptr<TypeNode> 
+         * @param name 别名编号
+         * @return TypeNode* 
          */
-        std::shared_ptr<TypeNode> getGlobalAlias(std::string name);
+        TypeNode *getGlobalAlias(SymbolId name);
         /**
-         * @brief 当生成另一个函数时，清空局部变量
+         * @brief 开始生成一个子过程时压入一层新的局部作用域
          * 
          */
-        void resetLocals();
+        void pushLocals();
+        /**
+         * @brief 子过程生成结束时弹出它的局部作用域，恢复外层子过程的局部符号
+         * 
+         */
+        void popLocals();
     protected:
-        /// 局部变量表
-        std::map<std::string,std::shared_ptr<Symbol>> localSymbols;
-        /// 全局变量表
-        std::map<std::string,std::shared_ptr<Symbol>> globalSymbols;
-        /// 局部别名表
-        std::map<std::string,std::shared_ptr<TypeNode>> localAliases;
-        /// 全局别名表
-        std::map<std::string,std::shared_ptr<TypeNode>> globalAliases;
+        /// 一层作用域
+        struct Scope{
+            /// 名字到槽位的索引
+            llvm::DenseMap<SymbolId,unsigned> index;
+            /// 按声明顺序排列的符号
+            std::vector<Symbol> slots;
+            /// 类型别名
+            llvm::DenseMap<SymbolId,TypeNode *> aliases;
+
+            Symbol *find(SymbolId name);
+            TypeNode *findAlias(SymbolId name) const;
+            Symbol *add(Symbol symbol);
+        };
+        /// 当前局部作用域 不在子过程中时返回nullptr
+        Scope *locals();
+        /// 全局作用域
+        Scope globals;
+        /// 局部作用域栈 栈顶是正在生成的子过程
+        std::vector<Scope> localScopes;
         CodegenContext& context;
     };
 } // namespace spc
@@ -8,107 +8,334 @@
  * @copyright Copyright (c) 2021
  * 
  */
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/Support/Casting.h>
 #include "utils/ast.hpp"
 #include "codegen/codegen_context.hpp"
 
 namespace spc
 {
-    llvm::Value *SysCallNode::codegen(CodegenContext &context)
+    namespace
     {
-        if (routine->routine == SysRoutine::WRITE || routine->routine == SysRoutine::WRITELN)
+        /// 一条write/writeln语句中还没有输出的部分 对应spc_write_format的格式串与参数
+        class OutputFormat
         {
-            auto char_ptr = context.builder.getInt8Ty()->getPointerTo();
-            auto printf_type = llvm::FunctionType::get(context.builder.getInt32Ty(), char_ptr, true);
-            auto printf_func = context.module->getOrInsertFunction("printf", printf_type);
-            for (auto &arg : args->children())
+        public:
+            /// 追加一个参数 字符，整数，实数常量与字符串常量直接写进格式串
+            void add(llvm::Value *value)
             {
-                auto value = arg->codegen(context);
-                std::vector<llvm::Value*> args;
-                if (value->getType()->isIntegerTy(8))
-                { args.push_back(context.builder.CreateGlobalStringPtr("%c")); args.push_back(value); }
-                else if (value->getType()->isIntegerTy())
-                { args.push_back(context.builder.CreateGlobalStringPtr("%d")); args.push_back(value); }
-                else if (value->getType()->isDoubleTy())
-                { args.push_back(context.builder.CreateGlobalStringPtr("%f")); args.push_back(value); }
+                auto *type = value->getType();
+                llvm::StringRef text;
+                auto *constant_int = llvm::dyn_cast<llvm::ConstantInt>(value);
+                if (constant_int != nullptr && type->isIntegerTy(8))
+                {
+                    if (!constant_int->isZero()) //'\0'会截断格式串，仍作为参数输出
+                    {
+                        add_text(std::string(1, static_cast<char>(constant_int->getZExtValue())));
+                        return;
+                    }
+                }
+                else if (constant_int != nullptr)
+                {
+                    auto number = type->isIntegerTy(1) ? constant_int->getZExtValue() : constant_int->getSExtValue();
+                    add_text(std::to_string(static_cast<int32_t>(number)));
+                    return;
+                }
+                else if (auto *constant = llvm::dyn_cast<llvm::ConstantFP>(value))
+                {
+                    //与运行时库相同的printf("%f")
+                    char real[max_real_length];
+                    auto length = std::snprintf(real, sizeof(real), "%f", constant->getValueAPF().convertToDouble());
+                    add_text(std::string(real, static_cast<size_t>(length)));
+                    return;
+                }
+                else if (type->isPointerTy() && llvm::getConstantStringInfo(value, text))
+                {
+                    add_text(text);
+                    return;
+                }
+
+                if (type->isIntegerTy(8)) args.emplace_back(value, 'c');
+                else if (type->isIntegerTy()) args.emplace_back(value, 'd');
+                else if (type->isDoubleTy()) args.emplace_back(value, 'f');
                 // Pascal pointers are not supported, so this is an LLVM global string pointer.
-                else if (value->getType()->isPointerTy())
-                { args.push_back(value); }
+                else if (type->isPointerTy()) args.emplace_back(value, 's');
                 else
                 { throw CodegenException("incompatible type in write(): expected char, integer, real"); }
-                context.builder.CreateCall(printf_func, args);
+                format += '%';
+                format += args.back().second;
+            }
+
+            /// 追加原样输出的文本
+            void add_text(llvm::StringRef text)
+            {
+                literal += text;
+                for (auto c : text)
+                {
+                    if (c == '%') format += '%';
+                    format += c;
+                }
+            }
+
+            /**
+             * @brief 生成输出已追加部分的调用，之后从空的格式串开始
+             *
+             * @param before 调用插入在这条指令之前 为nullptr时插入在context.builder的当前位置
+             */
+            void emit(CodegenContext &context, llvm::Instruction *before)
+            {
+                if (format.empty()) return;
+                llvm::IRBuilder<> builder(context.builder.GetInsertBlock());
+                if (before != nullptr) builder.SetInsertPoint(before);
+                auto *void_ty = builder.getVoidTy();
+                auto *int32_ty = builder.getInt32Ty();
+                auto *int64_ty = builder.getInt64Ty();
+                auto *str_ty = builder.getInt8PtrTy();
+                //只有一项时调用按类型特化的函数
+                if (args.empty() && format == "\n")
+                { builder.CreateCall(context.runtime_function("spc_writeln", void_ty, {})); }
+                else if (args.empty() && literal.back() != '\n')
+                {
+                    auto func = context.runtime_function("spc_write_str", void_ty, str_ty);
+                    builder.CreateCall(func, context.string_constant(literal));
+                }
+                else if (args.size() == 1 && literal.empty())
+                {
+                    auto *value = args.front().first;
+                    switch (args.front().second)
+                    {
+                        case 'c':
+                            builder.CreateCall(context.runtime_function("spc_write_char", void_ty, value->getType()), value);
+                            break;
+                        case 'd':
+                            builder.CreateCall(context.runtime_function("spc_write_int", void_ty, int32_ty),
+                                               builder.CreateZExt(value, int32_ty));
+                            break;
+                        case 'f':
+                            builder.CreateCall(context.runtime_function("spc_write_real", void_ty, value->getType()), value);
+                            break;
+                        default:
+                            builder.CreateCall(context.runtime_function("spc_write_str", void_ty, value->getType()), value);
+                            break;
+                    }
+                }
+                else
+                {
+                    //参数数组是spc_arg的数组，分配在入口块中，循环中的输出语句不会让栈不断增长
+                    llvm::Value *packed = llvm::ConstantPointerNull::get(int64_ty->getPointerTo());
+                    if (!args.empty())
+                    {
+                        auto &entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+                        llvm::IRBuilder<> alloca_builder(&entry, entry.begin());
+                        auto *array_ty = llvm::ArrayType::get(int64_ty, args.size());
+                        auto *array = alloca_builder.CreateAlloca(array_ty, nullptr, "write.args");
+                        for (size_t i = 0; i < args.size(); ++i)
+                        {
+                            auto *value = args[i].first;
+                            auto *slot = builder.CreateConstInBoundsGEP2_32(array_ty, array, 0, static_cast<unsigned>(i));
+                            if (value->getType()->isIntegerTy(1))
+                                builder.CreateStore(builder.CreateZExt(value, int64_ty), slot);
+                            else if (value->getType()->isIntegerTy())
+                                builder.CreateStore(builder.CreateSExt(value, int64_ty), slot);
+                            else
+                                builder.CreateStore(value, builder.CreateBitCast(slot, value->getType()->getPointerTo()));
+                        }
+                        packed = builder.CreateConstInBoundsGEP2_32(array_ty, array, 0, 0);
+                    }
+                    auto func = context.runtime_function("spc_write_format", void_ty,
+                                                          {str_ty, int64_ty->getPointerTo()});
+                    builder.CreateCall(func, {context.string_constant(format), packed});
+                }
+                format.clear();
+                literal.clear();
+                args.clear();
+            }
+
+        private:
+            /// printf("%f")输出一个double最多需要的字符数
+            static constexpr size_t max_real_length = 320;
+
+            /// 传给spc_write_format的格式串
+            std::string format;
+            /// 格式串中原样输出的文本 没有参数时直接用spc_write_str输出它
+            std::string literal;
+            /// 参数与它的格式('c'，'d'，'f'，'s')
+            std::vector<std::pair<llvm::Value *, char>> args;
+        };
+
+        /**
+         * @brief 生成数学函数唯一的实数参数 整数转换为实数
+         *
+         * @param context
+         * @param routine 系统函数 用在错误信息中
+         * @param args 参数列表
+         * @return llvm::Value* double类型的参数
+         */
+        llvm::Value *real_argument(CodegenContext &context, SysRoutine routine, ArgListNode *args)
+        {
+            auto name = to_string(routine);
+            if (args->children().size() != 1)
+            { throw CodegenException("wrong number of arguments: " + name + "()"); }
+            auto value = args->children().front()->codegen(context);
+            if (value->getType()->isIntegerTy(32))
+            { value = context.builder.CreateSIToFP(value, context.builder.getDoubleTy()); }
+            else if (!value->getType()->isDoubleTy())
+            { throw CodegenException("incompatible type in " + name + "(): expected integer, real"); }
+            return value;
+        }
+
+        /// 调用double版本的LLVM内建数学函数 优化器可以常量折叠与向量化，没有对应指令的函数向量化时调用-fveclib指定的库
+        llvm::Value *real_intrinsic(CodegenContext &context, llvm::Intrinsic::ID id, llvm::Value *value)
+        {
+            auto func = llvm::Intrinsic::getDeclaration(context.module.get(), id, context.builder.getDoubleTy());
+            return context.builder.CreateCall(func, value);
+        }
+
+        /// block中last之后(last为nullptr时从头开始)的指令有没有副作用，比如调用了用户的函数
+        bool has_side_effects(llvm::BasicBlock *block, llvm::Instruction *last)
+        {
+            auto it = last != nullptr ? std::next(last->getIterator()) : block->begin();
+            return std::any_of(it, block->end(), [](const llvm::Instruction &inst) { return inst.mayHaveSideEffects(); });
+        }
+    }
+
+    llvm::Value *SysCallNode::codegen(CodegenContext &context)
+    {
+        return codegen_routine(context, routine->routine, args);
+    }
+
+    llvm::Value *SysCallNode::codegen_routine(CodegenContext &context, SysRoutine routine, ArgListNode *args)
+    {
+        if (routine == SysRoutine::WRITE || routine == SysRoutine::WRITELN)
+        {
+            //整条语句合并为一次运行时库调用(见runtime/spcrt.h): 常量直接写进格式串，其余参数按类型对应一个格式
+            OutputFormat format;
+            for (auto &arg : args->children())
+            {
+                if (is_a_ptr_of<StringNode>(arg)) //字符串字面量不必生成单独的常量
+                {
+                    format.add_text(cast_node<StringNode>(arg)->val);
+                    continue;
+                }
+                //参数中调用的函数可能也有输出，它之前的部分要先输出
+                auto *block = context.builder.GetInsertBlock();
+                auto *last = block->empty() ? nullptr : &block->back();
+                auto value = arg->codegen(context);
+                if (context.builder.GetInsertBlock() != block || has_side_effects(block, last))
+                    format.emit(context, last != nullptr ? last->getNextNode() : &block->front());
+                format.add(value);
             }
-            if (routine->routine == SysRoutine::WRITELN)
-            { context.builder.CreateCall(printf_func, context.builder.CreateGlobalStringPtr("\n")); }
+            if (routine == SysRoutine::WRITELN) format.add_text("\n");
+            format.emit(context, nullptr);
             return nullptr;
         }
-        else if (routine->routine == SysRoutine::READ || routine->routine == SysRoutine::READLN)
+        else if (routine == SysRoutine::READ || routine == SysRoutine::READLN)
         {
-            auto char_ptr = context.builder.getInt8Ty()->getPointerTo();
-            auto scanf_type = llvm::FunctionType::get(context.builder.getInt32Ty(), char_ptr, true);
-            auto scanf_func = context.module->getOrInsertFunction("scanf", scanf_type);
+            //与输出一样调用运行时库 读入失败或文件结束时变量不变
+            auto void_ty = context.builder.getVoidTy();
             for (auto &arg : args->children())
             {
                 auto ptr = cast_node<IdentifierNode>(arg)->get_ptr(context);
-                std::vector<llvm::Value*> args;
-                if (ptr->getType()->getPointerElementType()->isIntegerTy(8))
-                { args.push_back(context.builder.CreateGlobalStringPtr("%c")); args.push_back(ptr); }
-                else if (ptr->getType()->getPointerElementType()->isIntegerTy(32))
-                { args.push_back(context.builder.CreateGlobalStringPtr("%d")); args.push_back(ptr); }
-                else if (ptr->getType()->getPointerElementType()->isDoubleTy())
-                { args.push_back(context.builder.CreateGlobalStringPtr("%lf")); args.push_back(ptr); }
+                const char *name;
+                if (ptr->getType()->getPointerElementType()->isIntegerTy(8)) name = "spc_read_char";
+                else if (ptr->getType()->getPointerElementType()->isIntegerTy(32)) name = "spc_read_int";
+                else if (ptr->getType()->getPointerElementType()->isDoubleTy()) name = "spc_read_real";
                 else
                 { throw CodegenException("incompatible type in read(): expected char, integer, real"); }
-                context.builder.CreateCall(scanf_func, args);
-            }
-            if (routine->routine == SysRoutine::READLN)
-            {
-                context.builder.CreateCall(scanf_func, context.builder.CreateGlobalStringPtr("%*[^\n]"));
-                auto getchar_type = llvm::FunctionType::get(context.builder.getInt32Ty(), false);
-                auto getchar_func = context.module->getOrInsertFunction("getchar", getchar_type);
-                context.builder.CreateCall(getchar_func);
+                context.builder.CreateCall(context.runtime_function(name, void_ty, ptr->getType()), ptr);
             }
+            if (routine == SysRoutine::READLN)
+            { context.builder.CreateCall(context.runtime_function("spc_readln", void_ty, {})); }
             return nullptr;
         }
-        else if (routine->routine == SysRoutine::ABS)
+        else if (routine == SysRoutine::ABS)
         {
             if (args->children().size() != 1)
             { throw CodegenException("wrong number of arguments: abs()"); }
             auto value = args->children().front()->codegen(context);
             if (value->getType()->isIntegerTy(32))
             {
-                auto int32_ty = context.builder.getInt32Ty();
-                auto abs_type = llvm::FunctionType::get(int32_ty, int32_ty, false);
-                auto abs_func = context.module->getOrInsertFunction("abs", abs_type);
-                return context.builder.CreateCall(abs_func, value);
+                //不调用libc的abs，优化器把它识别为求绝对值，可以向量化
+                auto negative = context.builder.CreateICmpSLT(value, context.builder.getInt32(0));
+                return context.builder.CreateSelect(negative, context.builder.CreateNeg(value), value);
             }
             else if (value->getType()->isDoubleTy())
             {
-                auto double_ty = context.builder.getDoubleTy();
-                auto fabs_type = llvm::FunctionType::get(double_ty, double_ty, false);
-                auto fabs_func = context.module->getOrInsertFunction("fabs", fabs_type);
-                return context.builder.CreateCall(fabs_func, value);
+                return real_intrinsic(context, llvm::Intrinsic::fabs, value);
             }
             else
             {
                 throw CodegenException("incompatible type in abs(): expected integer, real");
             }
         }
-        else if (routine->routine == SysRoutine::SQRT)
+        else if (routine == SysRoutine::SQR)
         {
             if (args->children().size() != 1)
-            { throw CodegenException("wrong number of arguments: sqrt()"); }
+            { throw CodegenException("wrong number of arguments: sqr()"); }
             auto value = args->children().front()->codegen(context);
+            if (value->getType()->isIntegerTy(32))
+            { return context.builder.CreateMul(value, value); }
+            else if (value->getType()->isDoubleTy())
+            { return context.builder.CreateFMul(value, value); }
+            else
+            { throw CodegenException("incompatible type in sqr(): expected integer, real"); }
+        }
+        else if (routine == SysRoutine::SQRT || routine == SysRoutine::SIN ||
+                 routine == SysRoutine::COS || routine == SysRoutine::EXP ||
+                 routine == SysRoutine::LN)
+        {
+            auto value = real_argument(context, routine, args);
+            llvm::Intrinsic::ID id;
+            switch (routine)
+            {
+                case SysRoutine::SIN: id = llvm::Intrinsic::sin; break;
+                case SysRoutine::COS: id = llvm::Intrinsic::cos; break;
+                case SysRoutine::EXP: id = llvm::Intrinsic::exp; break;
+                case SysRoutine::LN: id = llvm::Intrinsic::log; break;
+                default: id = llvm::Intrinsic::sqrt; break;
+            }
+            return real_intrinsic(context, id, value);
+        }
+        else if (routine == SysRoutine::ARCTAN)
+        {
+            //LLVM没有atan的内建函数 libm的atan不读写内存(生成的代码不检查errno)，优化器按库函数常量折叠，向量化
+            auto value = real_argument(context, routine, args);
             auto double_ty = context.builder.getDoubleTy();
+            auto atan_func = context.runtime_function("atan", double_ty, double_ty);
+            if (auto *func = llvm::dyn_cast<llvm::Function>(atan_func.getCallee()))
+            { func->addFnAttr(llvm::Attribute::ReadNone); }
+            return context.builder.CreateCall(atan_func, value);
+        }
+        else if (routine == SysRoutine::ROUND || routine == SysRoutine::TRUNC)
+        {
+            auto name = to_string(routine);
+            if (args->children().size() != 1)
+            { throw CodegenException("wrong number of arguments: " + name + "()"); }
+            auto value = args->children().front()->codegen(context);
             if (value->getType()->isIntegerTy(32))
-            { value = context.builder.CreateSIToFP(value, double_ty); }
+            { return value; }
             else if (!value->getType()->isDoubleTy())
-            { throw CodegenException("incompatible type in sqrt(): expected integer, real"); }
-            auto sqrt_type = llvm::FunctionType::get(double_ty, double_ty, false);
-            auto sqrt_func = context.module->getOrInsertFunction("sqrt", sqrt_type);
-            return context.builder.CreateCall(sqrt_func, value);
+            { throw CodegenException("incompatible type in " + name + "(): expected integer, real"); }
+            //fptosi本身向0取整
+            if (routine == SysRoutine::ROUND) value = real_intrinsic(context, llvm::Intrinsic::round, value);
+            return context.builder.CreateFPToSI(value, context.builder.getInt32Ty());
+        }
+        else if (routine == SysRoutine::ODD)
+        {
+            if (args->children().size() != 1)
+            { throw CodegenException("wrong number of arguments: odd()"); }
+            auto value = args->children().front()->codegen(context);
+            if (!value->getType()->isIntegerTy(32))
+            { throw CodegenException("incompatible type in odd(): expected integer"); }
+            return context.builder.CreateTrunc(value, context.builder.getInt1Ty());
         }
-        else if (routine->routine == SysRoutine::CHR)
+        else if (routine == SysRoutine::CHR)
         {
             if (args->children().size() != 1)
             { throw CodegenException("wrong number of arguments: chr()"); }
@@ -117,7 +344,7 @@ namespace spc
             { throw CodegenException("incompatible type in chr(): expected integer"); }
             return context.builder.CreateTrunc(value, context.builder.getInt8Ty());
         }
-        else if (routine->routine == SysRoutine::ORD)
+        else if (routine == SysRoutine::ORD)
         {
             if (args->children().size() != 1)
             { throw CodegenException("wrong number of arguments: ord()"); }
@@ -126,7 +353,7 @@ namespace spc
             { throw CodegenException("incompatible type in ord(): expected char"); }
             return context.builder.CreateZExt(value, context.builder.getInt32Ty());
         }
-        else if (routine->routine == SysRoutine::PRED)
+        else if (routine == SysRoutine::PRED)
         {
             if (args->children().size() != 1)
             { throw CodegenException("wrong number of arguments: pred()"); }
@@ -135,7 +362,7 @@ namespace spc
             { throw CodegenException("incompatible type in pred(): expected char"); }
             return context.builder.CreateBinOp(llvm::Instruction::Sub, value, context.builder.getInt8(1));
         }
-        else if (routine->routine == SysRoutine::SUCC)
+        else if (routine == SysRoutine::SUCC)
         {
             if (args->children().size() != 1)
             { throw CodegenException("wrong number of arguments: succ()"); }
@@ -146,7 +373,7 @@ namespace spc
         }
         else
         {
-            throw CodegenException("unsupported built-in routine: " + to_string(routine->routine));
+            throw CodegenException("unsupported built-in routine: " + to_string(routine));
         }
     }
 }
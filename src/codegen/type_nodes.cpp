@@ -34,23 +34,30 @@ namespace spc
 
     llvm::Type *TypeNode::get_llvm_type(CodegenContext &context) const
     {
-        if (auto *simple_type = dynamic_cast<const SimpleTypeNode*>(this)) // 如果是简单数据类型 直接返回即可
-        { 
-            return llvm_type(simple_type->type, context); 
-        }
-        else if (auto *array_type = dynamic_cast<const ArrayTypeNode*>(this)) //如果是数组类型
-        {
-            auto itemtype=array_type->element_type->get_llvm_type(context);
-            return llvm::ArrayType::get(itemtype,array_type->range->length);
-        }
-        else if (auto *alias = dynamic_cast<const AliasTypeNode*>(this)) //或者是别名
-        {
-            return context.symbolTable.getGlobalAlias(alias->identifier->name)->get_llvm_type(context);
-            //return context.get_alias(alias->identifier->name); 
-        }
-        else if (auto *record_type = dynamic_cast<const RecordTypeNode*>(this)) //如果是结构体的话
+        switch (kind())
         {
-            return record_type->innertype;
+            case NodeKind::SimpleType: // 如果是简单数据类型 直接返回即可
+                return llvm_type(type, context);
+            case NodeKind::ArrayType: //如果是数组类型
+            {
+                auto *array_type = static_cast<const ArrayTypeNode*>(this);
+                auto itemtype=array_type->element_type->get_llvm_type(context);
+                return llvm::ArrayType::get(itemtype,array_type->range->length);
+            }
+            case NodeKind::AliasType: //或者是别名
+            {
+                auto *alias = static_cast<const AliasTypeNode*>(this);
+                return context.symbolTable.getGlobalAlias(alias->identifier->id())->get_llvm_type(context);
+                //return context.get_alias(alias->identifier->name); 
+            }
+            case NodeKind::RecordType: //如果是结构体的话 结构体类型属于LLVMContext，所以记录在代码生成上下文中而不是节点上
+            {
+                auto it = context.record_types.find(this);
+                if (it == context.record_types.end()) break;
+                return it->second;
+            }
+            default:
+                break;
         }
         
         throw CodegenException("unsupported type: " + type2string(type));
@@ -0,0 +1,123 @@
+/**
+ * @file batch.cpp
+ * @brief 批量编译的实现
+ * @version 0.1
+ * @date 2021-06-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <fstream>
+#include <sstream>
+#include "utils/thread_pool.hpp"
+#include "batch.h"
+
+namespace spc
+{
+    /**
+     * @brief 读取整个文件
+     *
+     * @param path 文件路径
+     * @param content 文件内容
+     * @return true 成功
+     */
+    static bool read_file(const std::string &path, std::string &content)
+    {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in.is_open()) return false;
+        std::ostringstream buffer;
+        buffer << in.rdbuf();
+        content = buffer.str();
+        return true;
+    }
+
+    /**
+     * @brief 写入整个文件
+     *
+     * @param path 文件路径
+     * @param content 文件内容
+     * @return true 成功
+     */
+    static bool write_file(const std::string &path, const std::string &content)
+    {
+        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return false;
+        out.write(content.data(), static_cast<std::streamsize>(content.size()));
+        return static_cast<bool>(out);
+    }
+
+    /**
+     * @brief 编译一个源文件并写出结果
+     *
+     * @param input 源文件
+     * @param options 编译选项
+     * @param compile 编译方法
+     * @param diagnostics 诊断信息
+     * @return true 成功
+     */
+    static bool compile_one(const BatchInput &input, const CompileOptions &options, const CompileFunction &compile,
+                            std::string &diagnostics)
+    {
+        std::string source;
+        if (!read_file(input.source_file, source))
+        {
+            diagnostics = "failed to open sourceFile " + input.source_file + "\n";
+            return false;
+        }
+
+        auto result = compile(source, options);
+        diagnostics = std::move(result.diagnostics);
+        if (options.ast && !result.ast_json.empty())
+        {
+            auto ast_file = output_stem(input.source_file) + "_ast.json";
+            if (!write_file(ast_file, result.ast_json))
+            {
+                diagnostics += "failed to open " + ast_file + "\n";
+                return false;
+            }
+        }
+        if (!result.success) return false;
+
+        auto output = (input.output.empty() ? output_stem(input.source_file) : input.output)
+                      + target_extension(options.target);
+        if (!write_file(output, result.output))
+        {
+            diagnostics += "Could not open file: " + output + "\n";
+            return false;
+        }
+        return true;
+    }
+
+    size_t compile_batch(const std::vector<BatchInput> &inputs, const CompileOptions &options, unsigned jobs,
+                         std::ostream &diagnostics, const CompileFunction &compile)
+    {
+        std::vector<std::string> messages(inputs.size());
+        std::vector<char> succeeded(inputs.size(), false);
+        parallel_for(jobs, inputs.size(), [&](size_t i) {
+            try
+            { succeeded[i] = compile_one(inputs[i], options, compile, messages[i]); }
+            catch (std::exception &e)
+            { messages[i] += std::string(e.what()) + "\n"; }
+        });
+
+        size_t failures = 0;
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            if (!succeeded[i]) ++failures;
+            if (messages[i].empty()) continue;
+            if (inputs.size() > 1) diagnostics << inputs[i].source_file << ":\n";
+            diagnostics << messages[i];
+        }
+        diagnostics.flush();
+        return failures;
+    }
+
+    bool read_response_file(const std::string &path, std::vector<std::string> &args)
+    {
+        std::ifstream in(path);
+        if (!in.is_open()) return false;
+        std::string arg;
+        while (in >> arg) args.push_back(arg);
+        return true;
+    }
+}
@@ -0,0 +1,52 @@
+/**
+ * @file batch.h
+ * @brief 批量编译. 一个进程内用多个工作线程并行编译互不相关的源文件，省去每个文件启动进程与初始化LLVM的开销
+ * @version 0.1
+ * @date 2021-06-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_BATCH_H
+#define NAIVE_PASCAL_COMPILER_BATCH_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "compiler.h"
+
+namespace spc
+{
+    /// 一个待编译的源文件
+    struct BatchInput
+    {
+        std::string source_file;
+        /// 输出文件名(不含扩展名) 为空时使用源文件名
+        std::string output;
+    };
+
+    /**
+     * @brief 并行编译一组源文件. 每个文件的输出文件与单独编译时相同；
+     * 诊断信息先按文件收集，全部完成后按输入顺序输出，所以输出与线程调度无关
+     *
+     * @param inputs 源文件
+     * @param options 编译选项
+     * @param jobs 工作线程数量
+     * @param diagnostics 诊断信息输出到这里
+     * @param compile 编译一份源代码的方法
+     * @return size_t 编译失败的文件数量
+     */
+    size_t compile_batch(const std::vector<BatchInput> &inputs, const CompileOptions &options, unsigned jobs,
+                         std::ostream &diagnostics, const CompileFunction &compile = compile_source);
+
+    /**
+     * @brief 读取响应文件(@file) 文件中以空白分隔的每一项都当作一个命令行参数
+     *
+     * @param path 响应文件路径
+     * @param args 读出的参数追加到这里
+     * @return true 成功
+     */
+    bool read_response_file(const std::string &path, std::vector<std::string> &args);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_BATCH_H
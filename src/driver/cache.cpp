@@ -0,0 +1,281 @@
+/**
+ * @file cache.cpp
+ * @brief 编译缓存的实现
+ * @version 0.1
+ * @date 2021-06-14
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <fmt/core.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/SHA1.h>
+#include "cache.h"
+
+namespace spc
+{
+    namespace
+    {
+        /// 缓存条目文件的开头 格式改变时要修改它
+        const char entry_magic[] = "SPC1";
+        /// 临时文件名中的标记 淘汰时跳过正在写入的临时文件
+        const char temp_marker[] = ".tmp.";
+        /// 超过这个时间(秒)的临时文件是写入者崩溃留下的，可以删除
+        constexpr std::time_t stale_temp_seconds = 3600;
+
+        /// 按顺序读写统计文件中的两个计数器
+        void read_counters(int fd, std::uint64_t &hits, std::uint64_t &misses)
+        {
+            char buffer[64] = {};
+            auto n = ::pread(fd, buffer, sizeof(buffer) - 1, 0);
+            hits = misses = 0;
+            if (n > 0)
+            {
+                unsigned long long h = 0, m = 0;
+                if (std::sscanf(buffer, "%llu %llu", &h, &m) == 2)
+                { hits = h; misses = m; }
+            }
+        }
+    }
+
+    CompileCache::CompileCache(std::string directory, std::uint64_t max_bytes)
+            : directory(std::move(directory)), max_bytes(std::max<std::uint64_t>(max_bytes, 1))
+    {
+        llvm::sys::fs::create_directories(this->directory);
+    }
+
+    CompileCache::~CompileCache()
+    {
+        flush_stats();
+    }
+
+    std::string CompileCache::default_directory()
+    {
+        if (auto dir = std::getenv("SPC_CACHE_DIR")) return dir;
+        if (auto dir = std::getenv("XDG_CACHE_HOME")) return std::string(dir) + "/spc";
+        if (auto dir = std::getenv("HOME")) return std::string(dir) + "/.cache/spc";
+        return ".spc-cache";
+    }
+
+    std::string CompileCache::key(const std::string &source, const CompileOptions &options)
+    {
+        //每一部分之后都加上分隔符，避免不同的拼接方式得到同样的字节序列
+        llvm::SHA1 hasher;
+        hasher.update(compiler_version());
+        hasher.update(llvm::StringRef("\0", 1));
+        hasher.update(target_id(options));
+        hasher.update(llvm::StringRef("\0", 1));
+        hasher.update(fmt::format("target={} O={}", static_cast<int>(options.target),
+                                  static_cast<int>(options.optimization)));
+        hasher.update(llvm::StringRef("\0", 1));
+        hasher.update(source);
+        return llvm::toHex(hasher.final(), true);
+    }
+
+    std::string CompileCache::path_of(const std::string &key) const
+    {
+        return directory + "/" + key.substr(0, 2) + "/" + key.substr(2);
+    }
+
+    bool CompileCache::lookup(const std::string &key, CompileResult &result)
+    {
+        auto path = path_of(key);
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        std::ostringstream buffer;
+        if (in.is_open()) buffer << in.rdbuf();
+        auto entry = buffer.str();
+
+        std::uint32_t diagnostics_size = 0;
+        auto header = sizeof(entry_magic) - 1 + sizeof(diagnostics_size);
+        if (entry.size() < header || entry.compare(0, sizeof(entry_magic) - 1, entry_magic) != 0)
+        {
+            ++misses;
+            return false;
+        }
+        std::memcpy(&diagnostics_size, entry.data() + sizeof(entry_magic) - 1, sizeof(diagnostics_size));
+        if (entry.size() - header < diagnostics_size)
+        {
+            ++misses;
+            return false;
+        }
+
+        result.success = true;
+        result.diagnostics = entry.substr(header, diagnostics_size);
+        result.output = entry.substr(header + diagnostics_size);
+        ::utime(path.c_str(), nullptr); //更新修改时间 LRU淘汰时按它排序
+        ++hits;
+        return true;
+    }
+
+    void CompileCache::store(const std::string &key, const CompileResult &result)
+    {
+        auto bucket = directory + "/" + key.substr(0, 2);
+        llvm::sys::fs::create_directories(bucket);
+
+        //先写到进程与线程各自的临时文件中，写完后rename，其他进程只会看到完整的条目
+        static std::atomic<unsigned> sequence{0};
+        auto path = path_of(key);
+        auto temp = fmt::format("{}{}{}.{}", path, temp_marker, ::getpid(), sequence++);
+        {
+            std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return;
+            auto diagnostics_size = static_cast<std::uint32_t>(result.diagnostics.size());
+            out.write(entry_magic, sizeof(entry_magic) - 1);
+            out.write(reinterpret_cast<const char *>(&diagnostics_size), sizeof(diagnostics_size));
+            out << result.diagnostics << result.output;
+            if (!out)
+            {
+                out.close();
+                std::remove(temp.c_str());
+                return;
+            }
+        }
+        if (std::rename(temp.c_str(), path.c_str()) != 0)
+        {
+            std::remove(temp.c_str());
+            return;
+        }
+        evict(bucket);
+    }
+
+    void CompileCache::evict(const std::string &bucket) const
+    {
+        struct Entry
+        {
+            std::time_t mtime;
+            std::uint64_t size;
+            std::string path;
+        };
+        std::vector<Entry> entries;
+        std::uint64_t total = 0;
+        auto now = std::time(nullptr);
+
+        auto dir = ::opendir(bucket.c_str());
+        if (dir == nullptr) return;
+        while (auto item = ::readdir(dir))
+        {
+            if (item->d_name[0] == '.') continue;
+            auto path = bucket + "/" + item->d_name;
+            struct stat info;
+            if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) continue;
+            if (std::strstr(item->d_name, temp_marker) != nullptr)
+            {
+                if (now - info.st_mtime > stale_temp_seconds) std::remove(path.c_str());
+                continue;
+            }
+            entries.push_back(Entry{info.st_mtime, static_cast<std::uint64_t>(info.st_size), path});
+            total += static_cast<std::uint64_t>(info.st_size);
+        }
+        ::closedir(dir);
+
+        auto limit = std::max<std::uint64_t>(max_bytes / 256, 1);
+        if (total <= limit) return;
+        //淘汰到容量的90%，避免每次写入都要淘汰
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.mtime < b.mtime; });
+        for (const auto &entry : entries)
+        {
+            if (total <= limit / 10 * 9) break;
+            if (std::remove(entry.path.c_str()) == 0) total -= entry.size;
+        }
+    }
+
+    void CompileCache::flush_stats()
+    {
+        std::uint64_t new_hits = hits.exchange(0), new_misses = misses.exchange(0);
+        if (new_hits == 0 && new_misses == 0) return;
+
+        auto path = directory + "/stats";
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return;
+        if (::flock(fd, LOCK_EX) == 0) //多个进程同时更新时加锁
+        {
+            std::uint64_t old_hits, old_misses;
+            read_counters(fd, old_hits, old_misses);
+            auto text = fmt::format("{} {}\n", old_hits + new_hits, old_misses + new_misses);
+            if (::ftruncate(fd, 0) == 0)
+                (void)::pwrite(fd, text.data(), text.size(), 0);
+            ::flock(fd, LOCK_UN);
+        }
+        ::close(fd);
+    }
+
+    CacheStats CompileCache::stats() const
+    {
+        CacheStats stats;
+        int fd = ::open((directory + "/stats").c_str(), O_RDONLY);
+        if (fd >= 0)
+        {
+            if (::flock(fd, LOCK_SH) == 0)
+            {
+                read_counters(fd, stats.hits, stats.misses);
+                ::flock(fd, LOCK_UN);
+            }
+            ::close(fd);
+        }
+        stats.hits += hits;
+        stats.misses += misses;
+
+        auto dir = ::opendir(directory.c_str());
+        if (dir == nullptr) return stats;
+        while (auto bucket = ::readdir(dir))
+        {
+            if (bucket->d_name[0] == '.' || std::strlen(bucket->d_name) != 2) continue;
+            auto bucket_path = directory + "/" + bucket->d_name;
+            auto entries = ::opendir(bucket_path.c_str());
+            if (entries == nullptr) continue;
+            while (auto item = ::readdir(entries))
+            {
+                if (item->d_name[0] == '.' || std::strstr(item->d_name, temp_marker) != nullptr) continue;
+                struct stat info;
+                if (::stat((bucket_path + "/" + item->d_name).c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+                    continue;
+                ++stats.entries;
+                stats.bytes += static_cast<std::uint64_t>(info.st_size);
+            }
+            ::closedir(entries);
+        }
+        ::closedir(dir);
+        return stats;
+    }
+
+    void CompileCache::print_stats(std::ostream &out) const
+    {
+        auto stats = this->stats();
+        auto lookups = stats.hits + stats.misses;
+        out << fmt::format("cache directory: {}\n", directory)
+            << fmt::format("hits:            {}\n", stats.hits)
+            << fmt::format("misses:          {}\n", stats.misses)
+            << fmt::format("hit rate:        {:.1f}%\n", lookups == 0 ? 0.0 : 100.0 * stats.hits / lookups)
+            << fmt::format("entries:         {}\n", stats.entries)
+            << fmt::format("size:            {:.1f} MiB / {:.1f} MiB\n",
+                           stats.bytes / 1048576.0, max_bytes / 1048576.0);
+    }
+
+    CompileFunction CompileCache::wrap(CompileFunction compile)
+    {
+        return [this, compile](const std::string &source, const CompileOptions &options) {
+            if (options.ast) return compile(source, options); //ast树不放进缓存
+            auto cache_key = key(source, options);
+            CompileResult result;
+            if (lookup(cache_key, result)) return result;
+            result = compile(source, options);
+            if (result.success) store(cache_key, result);
+            return result;
+        };
+    }
+}
@@ -0,0 +1,126 @@
+/**
+ * @file cache.h
+ * @brief 按内容寻址的编译缓存. 以源代码，编译选项，目标平台与编译器版本的哈希为键，把编译结果保存在磁盘上，
+ * 命中时不需要语法分析也不需要运行LLVM
+ *
+ * 缓存目录结构: <dir>/<哈希前两位>/<哈希其余部分>，以及记录命中次数的<dir>/stats.
+ * 写入时先写临时文件再rename，所以多个spc进程可以同时使用同一个缓存目录.
+ * 命中时会更新文件的修改时间，超出容量时按修改时间淘汰最久没有使用的条目(LRU)
+ * @version 0.1
+ * @date 2021-06-14
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_CACHE_H
+#define NAIVE_PASCAL_COMPILER_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "compiler.h"
+
+namespace spc
+{
+    /// 缓存统计信息
+    struct CacheStats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t entries = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    /**
+     * @brief 编译缓存
+     *
+     */
+    class CompileCache final
+    {
+    public:
+        /// 默认容量 1GiB
+        static constexpr std::uint64_t default_max_bytes = std::uint64_t(1) << 30;
+
+        /**
+         * @brief Construct a new Compile Cache object
+         *
+         * @param directory 缓存目录 不存在时自动创建
+         * @param max_bytes 容量上限
+         */
+        CompileCache(std::string directory, std::uint64_t max_bytes = default_max_bytes);
+        CompileCache(const CompileCache &) = delete;
+        CompileCache &operator=(const CompileCache &) = delete;
+        /// 析构时把本进程的命中次数累加到缓存目录的统计文件中
+        ~CompileCache();
+
+        /**
+         * @brief 包装一个编译方法: 先查缓存，未命中时编译并把成功的结果写入缓存
+         *
+         * @param compile 被包装的编译方法
+         * @return CompileFunction
+         */
+        CompileFunction wrap(CompileFunction compile);
+
+        /**
+         * @brief 计算缓存键
+         *
+         * @param source 源代码
+         * @param options 编译选项
+         * @return std::string 十六进制的哈希值
+         */
+        static std::string key(const std::string &source, const CompileOptions &options);
+
+        /**
+         * @brief 查找缓存
+         *
+         * @param key 缓存键
+         * @param result 命中时填入编译结果
+         * @return true 命中
+         */
+        bool lookup(const std::string &key, CompileResult &result);
+
+        /**
+         * @brief 写入缓存 并在需要时淘汰旧条目
+         *
+         * @param key 缓存键
+         * @param result 编译结果
+         */
+        void store(const std::string &key, const CompileResult &result);
+
+        /**
+         * @brief 统计信息 包括之前所有进程累计的命中次数与缓存当前的大小
+         *
+         * @return CacheStats
+         */
+        CacheStats stats() const;
+
+        /**
+         * @brief 输出统计信息(--cache-stats)
+         *
+         * @param out 输出流
+         */
+        void print_stats(std::ostream &out) const;
+
+        /**
+         * @brief 默认的缓存目录 $SPC_CACHE_DIR，$XDG_CACHE_HOME/spc 或 ~/.cache/spc
+         *
+         * @return std::string
+         */
+        static std::string default_directory();
+
+    private:
+        std::string path_of(const std::string &key) const;
+        /// 淘汰一个子目录中最久没有使用的条目 每个子目录的容量是总容量的1/256
+        void evict(const std::string &bucket) const;
+        /// 把本进程的命中次数累加到统计文件中
+        void flush_stats();
+
+        std::string directory;
+        std::uint64_t max_bytes;
+        std::atomic<std::uint64_t> hits{0};
+        std::atomic<std::uint64_t> misses{0};
+    };
+}
+
+#endif //NAIVE_PASCAL_COMPILER_CACHE_H
@@ -0,0 +1,538 @@
+/**
+ * @file compiler.cpp
+ * @brief 编译流程的实现
+ * @version 0.1
+ * @date 2021-06-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/CodeGen/ParallelCG.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Target/TargetMachine.h>
+#include "utils/ast.hpp"
+#include "utils/parser.hpp"
+#include "codegen/codegen_context.hpp"
+#include "compiler.h"
+#include "runtime_bitcode.h"
+
+namespace spc
+{
+    void initialize_targets()
+    {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            llvm::InitializeAllTargetInfos();
+            llvm::InitializeAllTargets();
+            llvm::InitializeAllTargetMCs();
+            llvm::InitializeAllAsmParsers();
+            llvm::InitializeAllAsmPrinters();
+        });
+    }
+
+    /// 本机CPU支持的全部特性 排好序，同一台机器上总是得到同样的字符串
+    static std::string host_features()
+    {
+        llvm::StringMap<bool> host;
+        if (!llvm::sys::getHostCPUFeatures(host)) return "";
+        std::vector<std::string> features;
+        for (const auto &feature : host) features.push_back((feature.second ? "+" : "-") + feature.first().str());
+        std::sort(features.begin(), features.end());
+        return llvm::join(features, ",");
+    }
+
+    TargetCpu target_cpu(const CompileOptions &options)
+    {
+        TargetCpu result;
+        if (options.cpu == "native")
+        {
+            result.cpu = llvm::sys::getHostCPUName().str();
+            result.features = host_features();
+        }
+        else result.cpu = options.cpu.empty() ? "generic" : options.cpu;
+        //-mattr追加在后面，同一个特性以后出现的为准
+        if (!options.features.empty())
+            result.features += (result.features.empty() ? "" : ",") + options.features;
+        result.tune = options.tune == "native" ? llvm::sys::getHostCPUName().str() : options.tune;
+        return result;
+    }
+
+    llvm::CodeGenOpt::Level codegen_level(OptLevel level)
+    {
+        switch (level)
+        {
+            case OptLevel::O0: return llvm::CodeGenOpt::None;
+            case OptLevel::O1: return llvm::CodeGenOpt::Less;
+            case OptLevel::O3: return llvm::CodeGenOpt::Aggressive;
+            default: return llvm::CodeGenOpt::Default;
+        }
+    }
+
+    /**
+     * @brief 创建一个新的TargetMachine
+     *
+     * @param options 编译选项 使用其中的优化级别与目标CPU
+     * @param diagnostics 错误信息输出到这里
+     * @return std::unique_ptr<llvm::TargetMachine> 失败时返回nullptr
+     */
+    static std::unique_ptr<llvm::TargetMachine> create_target_machine(const CompileOptions &options,
+                                                                      std::ostream &diagnostics)
+    {
+        initialize_targets();
+        //设置默认输出Target
+        auto target_triple = llvm::sys::getDefaultTargetTriple();
+
+        //错误检查
+        std::string error;
+        auto target = llvm::TargetRegistry::lookupTarget(target_triple, error);
+        if (!target)
+        {
+            diagnostics << error << std::endl;
+            return nullptr;
+        }
+
+        //设置平台细节 不认识的CPU名LLVM只会警告后按generic处理，这里直接报错
+        auto cpu = target_cpu(options);
+        std::unique_ptr<llvm::MCSubtargetInfo> subtarget(target->createMCSubtargetInfo(target_triple, "", ""));
+        for (const auto &name : {cpu.cpu, cpu.tune})
+        {
+            if (name.empty() || name == "generic" || subtarget->isCPUStringValid(name)) continue;
+            diagnostics << "unknown target CPU '" << name << "'" << std::endl;
+            return nullptr;
+        }
+        llvm::TargetOptions opt;
+        auto rm = llvm::Optional<llvm::Reloc::Model>(llvm::Reloc::PIC_);
+        return std::unique_ptr<llvm::TargetMachine>(
+                target->createTargetMachine(target_triple, cpu.cpu, cpu.features, opt, rm, llvm::None,
+                                            codegen_level(options.optimization)));
+    }
+
+    /**
+     * @brief 返回当前线程缓存的TargetMachine. 创建TargetMachine的开销不小，
+     * 批量编译与编译服务器中同一个工作线程会连续编译很多文件，所以每个线程只创建一次，只按需要修改优化级别，
+     * 目标CPU或特性不同时才重新创建
+     *
+     * @param options 编译选项 使用其中的优化级别与目标CPU
+     * @param diagnostics 错误信息输出到这里
+     * @return llvm::TargetMachine* 失败时返回nullptr
+     */
+    static llvm::TargetMachine *target_machine(const CompileOptions &options, std::ostream &diagnostics)
+    {
+        thread_local std::unique_ptr<llvm::TargetMachine> cached;
+        auto cpu = target_cpu(options);
+        if (!cached || cached->getTargetCPU() != cpu.cpu || cached->getTargetFeatureString() != cpu.features)
+            cached = create_target_machine(options, diagnostics);
+        if (cached) cached->setOptLevel(codegen_level(options.optimization));
+        return cached.get();
+    }
+
+    /// 设置module的目标平台与数据布局 优化与生成目标代码都依赖它们
+    static void set_target(llvm::Module &module, llvm::TargetMachine &machine)
+    {
+        module.setTargetTriple(machine.getTargetTriple().str());
+        module.setDataLayout(machine.createDataLayout());
+    }
+
+#if LLVM_VERSION_MAJOR >= 12
+#define SPC_VF(n) llvm::ElementCount::getFixed(n)
+#else
+#define SPC_VF(n) n
+#endif
+    /**
+     * @brief 登记glibc的libmvec中的double函数 LLVM 13才内置libmvec的表，这里与它相同，其他版本也可以使用:
+     * 'b'是SSE的2路版本，'d'是AVX2的4路版本；生成的内建函数(llvm.sin.f64等)与直接调用的库函数都可以换成它们
+     *
+     * @param library 优化使用的库函数信息
+     */
+    static void add_libmvec(llvm::TargetLibraryInfoImpl &library)
+    {
+        const llvm::VecDesc functions[] = {
+                {"sin", "_ZGVbN2v_sin", SPC_VF(2)}, {"sin", "_ZGVdN4v_sin", SPC_VF(4)},
+                {"llvm.sin.f64", "_ZGVbN2v_sin", SPC_VF(2)}, {"llvm.sin.f64", "_ZGVdN4v_sin", SPC_VF(4)},
+                {"cos", "_ZGVbN2v_cos", SPC_VF(2)}, {"cos", "_ZGVdN4v_cos", SPC_VF(4)},
+                {"llvm.cos.f64", "_ZGVbN2v_cos", SPC_VF(2)}, {"llvm.cos.f64", "_ZGVdN4v_cos", SPC_VF(4)},
+                {"exp", "_ZGVbN2v_exp", SPC_VF(2)}, {"exp", "_ZGVdN4v_exp", SPC_VF(4)},
+                {"llvm.exp.f64", "_ZGVbN2v_exp", SPC_VF(2)}, {"llvm.exp.f64", "_ZGVdN4v_exp", SPC_VF(4)},
+                {"log", "_ZGVbN2v_log", SPC_VF(2)}, {"log", "_ZGVdN4v_log", SPC_VF(4)},
+                {"llvm.log.f64", "_ZGVbN2v_log", SPC_VF(2)}, {"llvm.log.f64", "_ZGVdN4v_log", SPC_VF(4)},
+        };
+        library.addVectorizableFunctions(functions);
+    }
+#undef SPC_VF
+
+    /**
+     * @brief 登记向量化时可以调用的向量数学函数 循环向量化把标量的内建数学函数(llvm.sin.f64等)换成库中的向量版本
+     *
+     * @param library 优化使用的库函数信息
+     * @param options 编译选项 使用其中的向量数学函数库
+     * @param diagnostics 错误信息输出到这里
+     * @return true 成功
+     */
+    static bool add_vector_library(llvm::TargetLibraryInfoImpl &library, const CompileOptions &options,
+                                   std::ostream &diagnostics)
+    {
+        switch (options.veclib)
+        {
+            case VecLib::NONE: return true;
+            case VecLib::LIBMVEC:
+                //libmvec的函数名按x86的向量调用约定编码
+                if (llvm::Triple(llvm::sys::getDefaultTargetTriple()).getArch() != llvm::Triple::x86_64)
+                {
+                    diagnostics << "-fveclib=libmvec is only supported on x86-64" << std::endl;
+                    return false;
+                }
+                add_libmvec(library);
+                return true;
+            case VecLib::SVML: library.addVectorizableFunctionsFromVecLib(llvm::TargetLibraryInfoImpl::SVML); return true;
+            case VecLib::MASSV: library.addVectorizableFunctionsFromVecLib(llvm::TargetLibraryInfoImpl::MASSV); return true;
+            case VecLib::ACCELERATE:
+                library.addVectorizableFunctionsFromVecLib(llvm::TargetLibraryInfoImpl::Accelerate);
+                return true;
+        }
+        return true;
+    }
+
+    bool optimize_module(llvm::Module &module, const CompileOptions &options, std::ostream &diagnostics)
+    {
+        auto level = options.optimization;
+        auto machine = target_machine(options, diagnostics);
+        if (machine == nullptr) return false;
+        set_target(module, *machine);
+        link_runtime(module, diagnostics);
+
+        llvm::PassBuilder::OptimizationLevel pipeline;
+        switch (level)
+        {
+            case OptLevel::O1: pipeline = llvm::PassBuilder::OptimizationLevel::O1; break;
+            case OptLevel::O3: pipeline = llvm::PassBuilder::OptimizationLevel::O3; break;
+            case OptLevel::Os: pipeline = llvm::PassBuilder::OptimizationLevel::Os; break;
+            case OptLevel::Oz: pipeline = llvm::PassBuilder::OptimizationLevel::Oz; break;
+            default: pipeline = llvm::PassBuilder::OptimizationLevel::O2; break;
+        }
+        //与clang相同: O2以上做循环向量化与SLP向量化，优化体积时不展开交错循环，Oz不做SLP向量化
+        llvm::PipelineTuningOptions tuning;
+        tuning.LoopVectorization = level == OptLevel::O2 || level == OptLevel::O3 || level == OptLevel::Os;
+        tuning.SLPVectorization = level == OptLevel::O2 || level == OptLevel::O3 || level == OptLevel::Os;
+        tuning.LoopInterleaving = level != OptLevel::Os && level != OptLevel::Oz;
+        tuning.LoopUnrolling = level != OptLevel::Oz;
+
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cam;
+        llvm::ModuleAnalysisManager mam;
+        llvm::TargetLibraryInfoImpl library(llvm::Triple(module.getTargetTriple()));
+        if (!add_vector_library(library, options, diagnostics)) return false;
+        llvm::PassBuilder builder(machine, tuning);
+        fam.registerPass([&] { return builder.buildDefaultAAPipeline(); });
+        //先登记的分析优先，registerFunctionAnalyses不会再替换它
+        fam.registerPass([&] { return llvm::TargetLibraryAnalysis(library); });
+        builder.registerModuleAnalyses(mam);
+        builder.registerCGSCCAnalyses(cam);
+        builder.registerFunctionAnalyses(fam);
+        builder.registerLoopAnalyses(lam);
+        builder.crossRegisterProxies(lam, fam, cam, mam);
+
+        auto passes = builder.buildPerModuleDefaultPipeline(pipeline);
+        passes.run(module, mam);
+        return true;
+    }
+
+    /**
+     * @brief 生成目标代码，可以选择生成ASM 或者 OBJ
+     *
+     * @param dest 输出流
+     * @param type 输出文件类型
+     * @param module LLVM的module，这个里面存放着生成的代码
+     * @param options 编译选项 使用其中的优化级别与目标CPU
+     * @param diagnostics 错误信息输出到这里
+     * @return true 成功
+     */
+    static bool emit_target(llvm::raw_pwrite_stream &dest, llvm::TargetMachine::CodeGenFileType type,
+                            llvm::Module &module, const CompileOptions &options, std::ostream &diagnostics)
+    {
+        auto machine = target_machine(options, diagnostics);
+        if (machine == nullptr) return false;
+        set_target(module, *machine);
+
+        llvm::legacy::PassManager pass;
+        if (machine->addPassesToEmitFile(pass, dest, nullptr, type))
+        {
+            diagnostics << "The target machine cannot emit an object file" << std::endl;
+            return false;
+        }
+
+        pass.run(module);
+        return true;
+    }
+
+    /**
+     * @brief 把module按函数分成parts份，在各自的线程上生成目标文件，再用系统链接器(ld -r)合并成一个可重定位目标文件.
+     * 内部链接的全局变量与函数会被改为hidden的外部符号，以便在各部分之间引用，合并后再用objcopy改回局部符号，
+     * 否则两个spc生成的目标文件中同名的全局变量会在链接时冲突. 不用splitCodeGen的PreserveLocals:
+     * 所有子过程都引用内部链接的全局变量，它们会被分到同一份中.
+     * 汇编输出不能这样合并: 各部分的局部标号(.LBB0_1等)会重名
+     *
+     * @param dest 输出流
+     * @param module LLVM的module 分割后被销毁
+     * @param parts 分割的份数
+     * @param options 编译选项 使用其中的优化级别与目标CPU
+     * @param diagnostics 错误信息输出到这里
+     * @return true 成功
+     */
+    static bool emit_object_split(llvm::raw_pwrite_stream &dest, std::unique_ptr<llvm::Module> &module, unsigned parts,
+                                  const CompileOptions &options, std::ostream &diagnostics)
+    {
+        auto linker = llvm::sys::findProgramByName("ld");
+        auto objcopy = llvm::sys::findProgramByName("objcopy");
+        if (!linker || !objcopy) //无法合并时退回单线程生成
+        {
+            diagnostics << "warning: " << (!linker ? "ld" : "objcopy")
+                        << " not found, generating the object file on a single thread" << std::endl;
+            return emit_target(dest, llvm::TargetMachine::CGFT_ObjectFile, *module, options, diagnostics);
+        }
+        auto machine = target_machine(options, diagnostics);
+        if (machine == nullptr) return false;
+        set_target(*module, *machine);
+
+        std::vector<llvm::SmallString<0>> buffers(parts);
+        std::vector<std::unique_ptr<llvm::raw_svector_ostream>> streams;
+        std::vector<llvm::raw_pwrite_stream *> outputs;
+        for (auto &buffer : buffers)
+        {
+            streams.push_back(std::make_unique<llvm::raw_svector_ostream>(buffer));
+            outputs.push_back(streams.back().get());
+        }
+        llvm::splitCodeGen(std::move(module), outputs, {}, [&options] {
+            std::ostringstream ignored; //同样的参数在target_machine中已经成功创建过一次
+            return create_target_machine(options, ignored);
+        }, llvm::TargetMachine::CGFT_ObjectFile, false);
+
+        //各部分写到临时文件中，链接后读回合并的结果
+        std::vector<std::unique_ptr<llvm::FileRemover>> removers;
+        auto temporary = [&](llvm::SmallVectorImpl<char> &path, int &fd) {
+            if (auto error = llvm::sys::fs::createTemporaryFile("spc", "o", fd, path))
+            {
+                diagnostics << "failed to create a temporary file: " << error.message() << std::endl;
+                return false;
+            }
+            removers.push_back(std::make_unique<llvm::FileRemover>(path));
+            return true;
+        };
+        std::vector<llvm::SmallString<128>> inputs(parts);
+        for (unsigned i = 0; i < parts; ++i)
+        {
+            int fd;
+            if (!temporary(inputs[i], fd)) return false;
+            llvm::raw_fd_ostream out(fd, true);
+            out << buffers[i];
+        }
+        llvm::SmallString<128> combined;
+        int fd;
+        if (!temporary(combined, fd)) return false;
+        llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+
+        std::vector<llvm::StringRef> args{*linker, "-r", "-o", combined};
+        for (auto &input : inputs) args.push_back(input);
+        std::string error;
+        if (llvm::sys::ExecuteAndWait(*linker, args, llvm::None, {}, 0, 0, &error) != 0)
+        {
+            diagnostics << "failed to combine the object files: " << (error.empty() ? "ld failed" : error) << std::endl;
+            return false;
+        }
+        std::vector<llvm::StringRef> localize{*objcopy, "--localize-hidden", combined};
+        if (llvm::sys::ExecuteAndWait(*objcopy, localize, llvm::None, {}, 0, 0, &error) != 0)
+        {
+            diagnostics << "failed to localize the combined object file: " << (error.empty() ? "objcopy failed" : error)
+                        << std::endl;
+            return false;
+        }
+        auto object = llvm::MemoryBuffer::getFile(combined);
+        if (!object)
+        {
+            diagnostics << "failed to read the combined object file: " << object.getError().message() << std::endl;
+            return false;
+        }
+        dest << (*object)->getBuffer();
+        return true;
+    }
+
+    /**
+     * @brief -mtune只影响调度与代价模型，TargetMachine没有对应的参数，与clang一样记录为每个函数的tune-cpu属性.
+     * LLVM 12以前的版本忽略这个属性，这时-mtune是错误而不是什么都不做
+     *
+     * @param module 代码生成完成的module
+     * @param options 编译选项
+     * @param diagnostics 错误信息输出到这里
+     * @return true 成功
+     */
+    static bool set_tune_cpu(llvm::Module &module, const CompileOptions &options, std::ostream &diagnostics)
+    {
+        auto tune = target_cpu(options).tune;
+        if (tune.empty()) return true;
+#if LLVM_VERSION_MAJOR < 12
+        diagnostics << "-mtune requires LLVM 12 or later (spc was built with LLVM " LLVM_VERSION_STRING ")" << std::endl;
+        return false;
+#else
+        for (auto &func : module)
+            if (!func.isDeclaration()) func.addFnAttr("tune-cpu", tune);
+        return true;
+#endif
+    }
+
+    /// 分割后每一份至少有一个函数定义
+    static unsigned split_parts(const llvm::Module &module, unsigned jobs)
+    {
+        unsigned definitions = 0;
+        for (auto &func : module)
+        {
+            if (!func.isDeclaration() && ++definitions >= jobs) break;
+        }
+        return definitions;
+    }
+
+    std::unique_ptr<CodegenContext> generate_module(const std::string &source, const CompileOptions &options,
+                                                    std::ostream &diagnostics, std::string *ast_json)
+    {
+        NodeArena arena; //本次编译的AST节点都分配在这里，生成结束时一次性释放
+        NodeArena::Scope arena_scope(arena);
+        ParserState parser_state(arena, diagnostics);
+        auto program = parse(source, parser_state);
+        if (program == nullptr) return nullptr;
+        if (ast_json != nullptr)
+            *ast_json = program->to_json();
+
+        //设置代码生成的上下文
+        auto context = std::make_unique<CodegenContext>("main", options.optimization != OptLevel::O0);
+        //逐函数的清理(见CodegenContext)在生成时就运行，它需要知道目标平台与数据布局
+        auto *machine = target_machine(options, diagnostics);
+        if (machine == nullptr) return nullptr;
+        set_target(*context->module, *machine);
+        context->routine_cache = options.routine_cache;
+        context->jobs = options.jobs;
+        try
+        { program->codegen(*context); }
+        catch (CodegenException &e)
+        {
+            diagnostics << e.what() << std::endl;
+            return nullptr;
+        }
+
+        //整个module生成完以后再运行一次优化流水线，这样过程间优化能看到所有函数
+        if (!set_tune_cpu(*context->module, options, diagnostics)) return nullptr;
+        if (options.optimization != OptLevel::O0 && !optimize_module(*context->module, options, diagnostics))
+            return nullptr;
+        return context;
+    }
+
+    CompileResult compile_source(const std::string &source, const CompileOptions &options)
+    {
+        CompileResult result;
+        std::ostringstream diagnostics;
+        auto generated = generate_module(source, options, diagnostics, options.ast ? &result.ast_json : nullptr);
+        if (generated == nullptr)
+        {
+            result.diagnostics = diagnostics.str();
+            return result;
+        }
+        auto &context = *generated;
+
+        llvm::SmallString<0> buffer;
+        llvm::raw_svector_ostream out(buffer);
+        switch (options.target)
+        {
+            case Target::LLVM:
+                context.module->print(out, nullptr);
+                result.success = true;
+                break;
+            case Target::ASM:
+                result.success = emit_target(out, llvm::TargetMachine::CGFT_AssemblyFile, *context.module,
+                                             options, diagnostics);
+                break;
+            case Target::OBJ:
+            {
+                auto parts = options.jobs > 1 ? split_parts(*context.module, options.jobs) : 1;
+                if (parts > 1)
+                    result.success = emit_object_split(out, context.module, parts, options, diagnostics);
+                else
+                    result.success = emit_target(out, llvm::TargetMachine::CGFT_ObjectFile, *context.module,
+                                                 options, diagnostics);
+                break;
+            }
+            default:
+                diagnostics << "no output type specified" << std::endl;
+                break;
+        }
+        result.output.assign(buffer.begin(), buffer.end());
+        result.diagnostics = diagnostics.str();
+        return result;
+    }
+
+    /// spc的源代码与嵌入的运行时库bitcode的哈希 由构建目录中生成的spc_build_id.cpp定义
+    extern const char build_id[];
+
+    const char *compiler_version()
+    {
+        static const std::string version = std::string("spc 0.1 (build ") + build_id + ", LLVM " LLVM_VERSION_STRING ")";
+        return version.c_str();
+    }
+
+    std::string target_id(const CompileOptions &options)
+    {
+        auto cpu = target_cpu(options);
+        return llvm::sys::getDefaultTargetTriple() + " " + cpu.cpu + " " + cpu.features + " " + cpu.tune + " " +
+               veclib_name(options.veclib);
+    }
+
+    const char *veclib_name(VecLib veclib)
+    {
+        switch (veclib)
+        {
+            case VecLib::LIBMVEC: return "libmvec";
+            case VecLib::SVML: return "SVML";
+            case VecLib::MASSV: return "MASSV";
+            case VecLib::ACCELERATE: return "Accelerate";
+            default: return "none";
+        }
+    }
+
+    const char *target_extension(Target target)
+    {
+        switch (target)
+        {
+            case Target::LLVM: return ".ll";
+            case Target::ASM:  return ".s";
+            case Target::OBJ:  return ".o";
+            default: return "";
+        }
+    }
+
+    std::string output_stem(const std::string &source_file)
+    {
+        auto slash = source_file.rfind('/');
+        auto stem = slash == std::string::npos ? source_file : source_file.substr(slash + 1);
+        auto dot = stem.rfind('.');
+        if (dot != std::string::npos) stem.erase(dot);
+        return stem;
+    }
+}
@@ -0,0 +1,180 @@
+/**
+ * @file compiler.h
+ * @brief 编译一个源文件的完整流程(语法分析，代码生成，生成目标代码). 每次编译的状态都是独立的，可以在多个线程中同时调用
+ * @version 0.1
+ * @date 2021-06-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_COMPILER_H
+#define NAIVE_PASCAL_COMPILER_COMPILER_H
+
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <llvm/Support/CodeGen.h>
+
+namespace llvm
+{
+    class Module;
+}
+
+namespace spc
+{
+    class CompileCache;
+    struct CodegenContext;
+
+    /// 输出文件类型
+    enum class Target
+    { UNDEFINED, LLVM, ASM, OBJ };
+
+    /// 优化级别 与clang的-O0/-O1/-O2/-O3/-Os/-Oz相同
+    enum class OptLevel
+    { O0, O1, O2, O3, Os, Oz };
+
+    /// 向量化时可以调用的向量数学函数库(-fveclib=) 与clang的同名选项相同
+    enum class VecLib
+    { NONE, LIBMVEC, SVML, MASSV, ACCELERATE };
+
+    /// 编译选项
+    struct CompileOptions
+    {
+        Target target = Target::UNDEFINED;
+        OptLevel optimization = OptLevel::O0;
+        /// 是否同时输出ast树(json)
+        bool ast = false;
+        /// 不为空时逐个子过程地缓存生成的IR，只重新生成改动过的子过程
+        CompileCache *routine_cache = nullptr;
+        /// 生成子过程使用的线程数 大于1时并行生成，输出与串行生成相同
+        unsigned jobs = 1;
+        /// 目标CPU(-mcpu=，-march=) 为空时是"generic"，"native"表示本机的CPU与它支持的全部特性
+        std::string cpu;
+        /// 额外打开或关闭的目标特性(-mattr=) 例如"+avx2,-avx512f"
+        std::string features;
+        /// 只按这个CPU调整指令调度与代价模型(-mtune=)，不改变可以使用的指令
+        std::string tune;
+        /// 循环中的sin，cos，exp，ln等向量化时调用的库 链接时需要同时链接这个库(比如libmvec的-lmvec)
+        VecLib veclib = VecLib::NONE;
+    };
+
+    /// 解析后的目标CPU native已经换成本机的CPU名与特性
+    struct TargetCpu
+    {
+        std::string cpu;
+        std::string features;
+        std::string tune;
+    };
+
+    /// 一个源文件的编译结果
+    struct CompileResult
+    {
+        bool success = false;
+        /// 生成的LLVM IR，汇编或目标文件内容
+        std::string output;
+        /// ast树(json) 只有CompileOptions::ast为true时才有
+        std::string ast_json;
+        /// 编译过程中的错误信息
+        std::string diagnostics;
+    };
+
+    /// 编译一份源代码的方法 默认在本进程内编译(compile_source)，也可以交给编译服务器或者先查缓存
+    using CompileFunction = std::function<CompileResult(const std::string &source, const CompileOptions &options)>;
+
+    /**
+     * @brief 初始化LLVM的所有目标平台 只有第一次调用会真正执行，可以在多个线程中调用
+     *
+     */
+    void initialize_targets();
+
+    /**
+     * @brief 后端(指令选择，寄存器分配等)使用的优化级别
+     *
+     * @param level 优化级别
+     * @return llvm::CodeGenOpt::Level
+     */
+    llvm::CodeGenOpt::Level codegen_level(OptLevel level);
+
+    /**
+     * @brief 解析编译选项中的-mcpu，-mattr与-mtune 数据布局，优化的代价模型与生成目标代码都使用它
+     *
+     * @param options 编译选项
+     * @return TargetCpu
+     */
+    TargetCpu target_cpu(const CompileOptions &options);
+
+    /**
+     * @brief 语法分析，代码生成，并按优化级别优化整个module 编译与JIT执行共用这一部分
+     *
+     * @param source 源代码
+     * @param options 编译选项 只使用优化级别，routine_cache与jobs
+     * @param diagnostics 错误信息输出到这里
+     * @param ast_json 不为空时把ast树(json)写到这里
+     * @return std::unique_ptr<CodegenContext> 失败时返回nullptr
+     */
+    std::unique_ptr<CodegenContext> generate_module(const std::string &source, const CompileOptions &options,
+                                                    std::ostream &diagnostics, std::string *ast_json = nullptr);
+
+    /**
+     * @brief 用新的pass manager的默认流水线优化整个module 包括循环优化，向量化与过程间优化，
+     * 代价模型由TargetMachine提供的TargetTransformInfo决定；优化前先链接运行时库的bitcode(见runtime_bitcode.h)
+     *
+     * @param module 代码生成完成的module
+     * @param options 编译选项 使用其中的优化级别(不能是O0)，目标CPU与向量数学函数库
+     * @param diagnostics 错误信息输出到这里
+     * @return true 成功
+     */
+    bool optimize_module(llvm::Module &module, const CompileOptions &options, std::ostream &diagnostics);
+
+    /**
+     * @brief 编译内存中的一份源代码
+     *
+     * @param source 源代码
+     * @param options 编译选项
+     * @return CompileResult
+     */
+    CompileResult compile_source(const std::string &source, const CompileOptions &options);
+
+    /**
+     * @brief 编译器版本 包括构建标识(源代码与运行时库bitcode的哈希)与LLVM版本，
+     * 同一版本的编译器对同样的输入总是生成同样的输出；编译缓存，子过程缓存与JIT的目标文件缓存都以它为键的一部分
+     *
+     * @return const char*
+     */
+    const char *compiler_version();
+
+    /**
+     * @brief 生成代码的目标平台描述(target triple，cpu，features，tune与向量数学函数库)
+     *
+     * @param options 编译选项 使用其中的目标CPU
+     * @return std::string
+     */
+    std::string target_id(const CompileOptions &options);
+
+    /**
+     * @brief 向量数学函数库的名字 与-fveclib=的参数相同
+     *
+     * @param veclib 向量数学函数库
+     * @return const char* 比如"libmvec"，没有时为"none"
+     */
+    const char *veclib_name(VecLib veclib);
+
+    /**
+     * @brief 输出文件的扩展名
+     *
+     * @param target 输出文件类型
+     * @return const char* 比如".ll"
+     */
+    const char *target_extension(Target target);
+
+    /**
+     * @brief 去掉源文件路径中的目录与扩展名 输出文件默认放在当前目录下
+     *
+     * @param source_file 源文件路径
+     * @return std::string 比如"test/hello.pas"返回"hello"
+     */
+    std::string output_stem(const std::string &source_file);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_COMPILER_H
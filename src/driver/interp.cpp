@@ -0,0 +1,60 @@
+/**
+ * @file interp.cpp
+ * @brief 解释执行的实现
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "utils/ast.hpp"
+#include "utils/parser.hpp"
+#include "codegen/codegen_context.hpp"
+#include "runtime/spcrt.h"
+#include "vm/interpreter.h"
+#include "vm/lowering.h"
+#include "interp.h"
+#include "tier.h"
+
+namespace spc
+{
+    int interpret_program(const std::string &source_file, std::ostream &diagnostics, const TierOptions &tier)
+    {
+        std::ifstream in(source_file, std::ios::in | std::ios::binary);
+        if (!in.is_open())
+        {
+            diagnostics << "failed to open source file " << source_file << std::endl;
+            return -1;
+        }
+        std::ostringstream source;
+        source << in.rdbuf();
+
+        BytecodeProgram program;
+        {
+            NodeArena arena; //字节码不引用语法树，翻译完就释放
+            NodeArena::Scope arena_scope(arena);
+            ParserState parser_state(arena, diagnostics);
+            auto root = parse(source.str(), parser_state);
+            if (root == nullptr) return -1;
+            try
+            { program = lower_to_bytecode(cast_node<ProgramNode>(root)); }
+            catch (CodegenException &e)
+            {
+                diagnostics << e.what() << std::endl;
+                return -1;
+            }
+        }
+        int status;
+        if (!tier.enabled) status = interpret(program, diagnostics);
+        else
+        {
+            auto native = create_jit_tier(source.str(), program, tier.verbose, diagnostics);
+            status = interpret(program, diagnostics, native.get(), std::max<uint32_t>(tier.threshold, 1));
+        }
+        spc_flush(); //程序的输出不等到spc退出时才写出
+        return status;
+    }
+}
@@ -0,0 +1,43 @@
+/**
+ * @file interp.h
+ * @brief 解释执行Pascal程序(spc -interp). 语法树翻译成字节码后直接解释执行，完全不经过LLVM，
+ * 小程序的启动时间远小于生成module再JIT编译
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_INTERP_H
+#define NAIVE_PASCAL_COMPILER_INTERP_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace spc
+{
+    /// 分层执行选项(spc -tiered)
+    struct TierOptions
+    {
+        /// 为true时热点子过程用LLVM JIT以-O2编译，之后对它的调用执行本地代码
+        bool enabled = false;
+        /// 子过程的调用次数与循环回边次数之和达到这个值时编译它
+        uint32_t threshold = 1000;
+        /// 每次编译时输出编译了哪些子过程
+        bool verbose = false;
+    };
+
+    /**
+     * @brief 翻译并解释执行一个源文件
+     *
+     * @param source_file 源文件路径
+     * @param diagnostics 编译错误与运行时错误输出到这里
+     * @param tier 分层执行选项
+     * @return int 程序main的返回值 编译失败或发生运行时错误时返回-1
+     */
+    int interpret_program(const std::string &source_file, std::ostream &diagnostics,
+                          const TierOptions &tier = TierOptions());
+}
+
+#endif //NAIVE_PASCAL_COMPILER_INTERP_H
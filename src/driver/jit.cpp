@@ -0,0 +1,267 @@
+/**
+ * @file jit.cpp
+ * @brief JIT执行的实现
+ * @version 0.1
+ * @date 2021-06-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <fstream>
+#include <sstream>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include "codegen/codegen_context.hpp"
+#include "runtime/spcrt.h"
+#include "object_cache.h"
+#include "jit.h"
+
+namespace spc
+{
+    /// 把LLVM的错误信息写到diagnostics
+    static void report(llvm::Error error, std::ostream &diagnostics)
+    {
+        diagnostics << llvm::toString(std::move(error)) << std::endl;
+    }
+
+    /// 把另一个module中的全局变量与函数映射为当前module中的同名声明
+    class DeclarationMaterializer final : public llvm::ValueMaterializer
+    {
+    public:
+        explicit DeclarationMaterializer(llvm::Module &module) : module(module)
+        {}
+
+        llvm::Value *materialize(llvm::Value *value) override
+        {
+            auto *global = llvm::dyn_cast<llvm::GlobalValue>(value);
+            if (global == nullptr || global->getParent() == &module) return nullptr;
+            if (auto *declared = module.getNamedValue(global->getName())) return declared;
+            llvm::GlobalValue *declaration;
+            if (auto *func = llvm::dyn_cast<llvm::Function>(global))
+            {
+                auto *copy = llvm::Function::Create(func->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+                                                    func->getName(), &module);
+                copy->copyAttributesFrom(func);
+                declaration = copy;
+            }
+            else
+            {
+                auto *var = llvm::cast<llvm::GlobalVariable>(global);
+                declaration = new llvm::GlobalVariable(module, var->getValueType(), var->isConstant(),
+                                                       llvm::GlobalValue::ExternalLinkage, nullptr, var->getName());
+            }
+            declaration->setLinkage(llvm::GlobalValue::ExternalLinkage);
+            declaration->setVisibility(global->getVisibility());
+            return declaration;
+        }
+
+    private:
+        llvm::Module &module;
+    };
+
+    /**
+     * @brief 把每个函数定义移到单独的module中，原来的module只剩全局变量与外部声明.
+     * CompileOnDemandLayer每编译一个函数都要复制一次它所在的整个module，一个module只有一个函数时
+     * 惰性编译的开销才只与实际执行的函数有关. 内部符号改为hidden的外部符号以便跨module引用
+     *
+     * @param module 整个程序的module
+     * @return std::vector<std::unique_ptr<llvm::Module>> 每个函数一个module
+     */
+    static std::vector<std::unique_ptr<llvm::Module>> split_functions(llvm::Module &module)
+    {
+        unsigned unnamed = 0;
+        for (auto &global : module.global_values())
+        {
+            if (!global.hasLocalLinkage()) continue;
+            if (!global.hasName()) global.setName("spc.local." + std::to_string(unnamed++));
+            global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+            global.setVisibility(llvm::GlobalValue::HiddenVisibility);
+        }
+
+        std::vector<llvm::Function *> definitions;
+        for (auto &func : module)
+            if (!func.isDeclaration()) definitions.push_back(&func);
+        std::vector<std::unique_ptr<llvm::Module>> parts;
+        for (auto *func : definitions)
+        {
+            auto part = std::make_unique<llvm::Module>(func->getName(), module.getContext());
+            part->setDataLayout(module.getDataLayout());
+            part->setTargetTriple(module.getTargetTriple());
+            //原module中留下同名的声明，其他函数对它的引用保持不变，移动后再映射为各自module中的声明
+            auto *declaration = llvm::Function::Create(func->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+                                                       "", &module);
+            declaration->copyAttributesFrom(func);
+            func->replaceAllUsesWith(declaration);
+            func->removeFromParent();
+            part->getFunctionList().push_back(func);
+            declaration->setName(func->getName());
+
+            llvm::ValueToValueMapTy map;
+            DeclarationMaterializer materializer(*part);
+            llvm::RemapFunction(*func, map, llvm::RF_IgnoreMissingLocals, nullptr, &materializer);
+            parts.push_back(std::move(part));
+        }
+        for (auto it = module.begin(); it != module.end();)
+        {
+            auto &func = *it++;
+            if (func.isDeclaration() && func.use_empty()) func.eraseFromParent();
+        }
+        return parts;
+    }
+
+    /// 用Builder(LLJITBuilder或LLLazyJITBuilder)创建JIT object_cache不为空时编译结果经过它缓存
+    template<typename Builder>
+    static std::unique_ptr<llvm::orc::LLJIT> create_jit(llvm::orc::JITTargetMachineBuilder machine_builder,
+                                                        llvm::ObjectCache *object_cache, std::ostream &diagnostics)
+    {
+        Builder builder;
+        builder.setJITTargetMachineBuilder(std::move(machine_builder));
+        if (object_cache != nullptr)
+            builder.setCompileFunctionCreator([object_cache](llvm::orc::JITTargetMachineBuilder target)
+                                                      -> llvm::Expected<llvm::orc::IRCompileLayer::CompileFunction> {
+                //与LLJIT默认的单线程编译相同，只创建一个TargetMachine
+                auto machine = target.createTargetMachine();
+                if (!machine) return machine.takeError();
+                return llvm::orc::TMOwningSimpleCompiler(std::move(*machine), object_cache);
+            });
+        auto jit = builder.create();
+        if (!jit)
+        {
+            report(jit.takeError(), diagnostics);
+            return nullptr;
+        }
+        return std::move(*jit);
+    }
+
+    llvm::Error define_runtime(llvm::orc::LLJIT &jit)
+    {
+        llvm::orc::SymbolMap symbols;
+        auto prefix = jit.getDataLayout().getGlobalPrefix();
+        auto &session = jit.getExecutionSession();
+#define SPC_RUNTIME_SYMBOL(name) \
+        symbols[session.intern(prefix ? std::string(1, prefix) + #name : #name)] = \
+                llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(&name), llvm::JITSymbolFlags::Exported);
+        SPC_RUNTIME_SYMBOLS(SPC_RUNTIME_SYMBOL)
+#undef SPC_RUNTIME_SYMBOL
+        return jit.getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(symbols)));
+    }
+
+    int run_program(const std::string &source_file, const CompileOptions &options, const RunOptions &run_options,
+                    const std::vector<std::string> &args, std::ostream &diagnostics)
+    {
+        //只有libmvec随glibc安装，可以加载进本进程；其他向量数学函数库中的函数在JIT中无法解析
+        if (options.veclib != VecLib::NONE && options.veclib != VecLib::LIBMVEC)
+        {
+            diagnostics << "-fveclib=" << veclib_name(options.veclib) << " is not supported with -run" << std::endl;
+            return -1;
+        }
+        std::ifstream in(source_file, std::ios::in | std::ios::binary);
+        if (!in.is_open())
+        {
+            diagnostics << "failed to open source file " << source_file << std::endl;
+            return -1;
+        }
+        std::ostringstream source;
+        source << in.rdbuf();
+
+        //JIT编译的代码就在本机上执行，没有指定-mcpu时使用本机的CPU
+        auto jit_options = options;
+        if (jit_options.cpu.empty()) jit_options.cpu = "native";
+        auto context = generate_module(source.str(), jit_options, diagnostics);
+        if (context == nullptr) return -1;
+
+        initialize_targets();
+        auto machine_builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+        if (!machine_builder)
+        {
+            report(machine_builder.takeError(), diagnostics);
+            return -1;
+        }
+        machine_builder->setCodeGenOptLevel(codegen_level(options.optimization));
+        auto cpu = target_cpu(jit_options);
+        machine_builder->setCPU(cpu.cpu);
+        machine_builder->getFeatures() = llvm::SubtargetFeatures(cpu.features);
+        std::unique_ptr<JitObjectCache> object_cache;
+        if (run_options.object_cache != nullptr)
+        {
+            auto host = machine_builder->getTargetTriple().str() + " " + cpu.cpu + " " + cpu.features + " " +
+                        veclib_name(options.veclib);
+            object_cache = std::make_unique<JitObjectCache>(*run_options.object_cache, options.optimization, host);
+        }
+        auto jit = run_options.lazy
+                   ? create_jit<llvm::orc::LLLazyJITBuilder>(std::move(*machine_builder), object_cache.get(),
+                                                             diagnostics)
+                   : create_jit<llvm::orc::LLJITBuilder>(std::move(*machine_builder), object_cache.get(), diagnostics);
+        if (jit == nullptr) return -1;
+
+        //运行时库之外的C库函数(scanf等)从本进程中查找
+        if (auto error = define_runtime(*jit))
+        {
+            report(std::move(error), diagnostics);
+            return -1;
+        }
+        //向量化的循环调用libmvec中的函数 spc本身没有链接它，先加载进本进程
+        std::string load_error;
+        if (options.veclib == VecLib::LIBMVEC &&
+            llvm::sys::DynamicLibrary::LoadLibraryPermanently("libmvec.so.1", &load_error))
+        {
+            diagnostics << "failed to load libmvec: " << load_error << std::endl;
+            return -1;
+        }
+        auto &main_dylib = jit->getMainJITDylib();
+        auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                jit->getDataLayout().getGlobalPrefix());
+        if (!process)
+        {
+            report(process.takeError(), diagnostics);
+            return -1;
+        }
+        main_dylib.setGenerator(std::move(*process));
+
+        //module与它的LLVMContext一起交给JIT；逐函数优化的pass manager引用着module，先释放它
+        context->fpm.reset();
+        context->module->setDataLayout(jit->getDataLayout());
+        context->module->setTargetTriple(jit->getTargetTriple().str());
+        std::vector<std::unique_ptr<llvm::Module>> functions;
+        if (run_options.lazy) functions = split_functions(*context->module);
+        llvm::orc::ThreadSafeContext llvm_context(std::move(context->llvm_context));
+        if (auto error = jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(context->module), llvm_context)))
+        {
+            report(std::move(error), diagnostics);
+            return -1;
+        }
+        //惰性模式下每个函数都通过桩函数调用，第一次被调用时才编译它所在的module
+        for (auto &func : functions)
+        {
+            auto &lazy_jit = static_cast<llvm::orc::LLLazyJIT &>(*jit);
+            if (auto error = lazy_jit.addLazyIRModule(llvm::orc::ThreadSafeModule(std::move(func), llvm_context)))
+            {
+                report(std::move(error), diagnostics);
+                return -1;
+            }
+        }
+
+        auto main_symbol = jit->lookup("main");
+        if (!main_symbol)
+        {
+            report(main_symbol.takeError(), diagnostics);
+            return -1;
+        }
+        //Pascal程序的main没有参数，按C的调用约定多传的argc与argv会被忽略
+        std::vector<char *> argv;
+        argv.push_back(const_cast<char *>(source_file.c_str()));
+        for (const auto &arg : args) argv.push_back(const_cast<char *>(arg.c_str()));
+        argv.push_back(nullptr);
+        auto main_func = reinterpret_cast<int (*)(int, char **)>(main_symbol->getAddress());
+        auto status = main_func(static_cast<int>(argv.size() - 1), argv.data());
+        spc_flush(); //程序的输出写在统计信息之前，也不会等到spc退出时才写出
+        if (object_cache && run_options.cache_stats) object_cache->print_stats(diagnostics);
+        return status;
+    }
+}
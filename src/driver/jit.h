@@ -0,0 +1,63 @@
+/**
+ * @file jit.h
+ * @brief 在本进程内JIT执行Pascal程序(spc -run). 生成的module交给ORC的LLJIT编译后直接调用main，
+ * 省去先输出.ll再启动lli解析文本IR的开销
+ * @version 0.1
+ * @date 2021-06-18
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_JIT_H
+#define NAIVE_PASCAL_COMPILER_JIT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <llvm/Support/Error.h>
+#include "compiler.h"
+
+namespace llvm
+{
+    namespace orc
+    {
+        class LLJIT;
+    }
+}
+
+namespace spc
+{
+    class CompileCache;
+
+    /// JIT执行选项
+    struct RunOptions
+    {
+        /// 惰性编译: 每个函数第一次被调用时才编译 大程序中只有少数子过程会执行时能缩短启动时间
+        bool lazy = false;
+        /// 不为空时把JIT编译出的目标文件保存在这个缓存中，再次执行同一个程序时跳过LLVM后端
+        CompileCache *object_cache = nullptr;
+        /// 程序结束后输出目标文件缓存的命中统计
+        bool cache_stats = false;
+    };
+
+    /**
+     * @brief 在jit的主JITDylib中定义运行时库(runtime/spcrt.h)的全部函数与状态 它们链接在spc中，
+     * 按名字定义为本进程中的地址，不依赖可执行文件导出符号
+     */
+    llvm::Error define_runtime(llvm::orc::LLJIT &jit);
+
+    /**
+     * @brief 编译并执行一个源文件
+     *
+     * @param source_file 源文件路径
+     * @param options 编译选项 使用其中的优化级别
+     * @param run_options JIT执行选项
+     * @param args 传给程序的参数(不含程序名)
+     * @param diagnostics 编译错误输出到这里
+     * @return int 程序main的返回值 编译失败时返回-1
+     */
+    int run_program(const std::string &source_file, const CompileOptions &options, const RunOptions &run_options,
+                    const std::vector<std::string> &args, std::ostream &diagnostics);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_JIT_H
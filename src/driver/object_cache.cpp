@@ -0,0 +1,86 @@
+/**
+ * @file object_cache.cpp
+ * @brief JIT目标文件缓存的实现
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <fmt/core.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include "cache.h"
+#include "object_cache.h"
+
+namespace spc
+{
+    JitObjectCache::JitObjectCache(CompileCache &cache, OptLevel level, std::string host)
+            : cache(cache), level(level), host(std::move(host))
+    {}
+
+    std::string JitObjectCache::key(const llvm::Module &module) const
+    {
+        llvm::SmallVector<char, 0> bitcode;
+        llvm::raw_svector_ostream out(bitcode);
+        llvm::WriteBitcodeToFile(module, out);
+
+        llvm::SHA1 hasher;
+        auto separator = llvm::StringRef("\0", 1);
+        hasher.update("jit");
+        hasher.update(separator);
+        hasher.update(compiler_version());
+        hasher.update(separator);
+        hasher.update(host);
+        hasher.update(separator);
+        hasher.update(fmt::format("O={}", static_cast<int>(level)));
+        hasher.update(separator);
+        hasher.update(llvm::StringRef(bitcode.data(), bitcode.size()));
+        return llvm::toHex(hasher.final(), true);
+    }
+
+    void JitObjectCache::notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object)
+    {
+        std::string module_key;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            auto it = pending.find(module);
+            if (it != pending.end())
+            {
+                module_key = std::move(it->second);
+                pending.erase(it);
+            }
+        }
+        if (module_key.empty()) module_key = key(*module);
+
+        CompileResult entry;
+        entry.success = true;
+        entry.output = object.getBuffer().str();
+        cache.store(module_key, entry);
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> JitObjectCache::getObject(const llvm::Module *module)
+    {
+        auto module_key = key(*module);
+        CompileResult entry;
+        if (!cache.lookup(module_key, entry))
+        {
+            ++misses;
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            pending[module] = std::move(module_key);
+            return nullptr;
+        }
+        ++hits;
+        return llvm::MemoryBuffer::getMemBufferCopy(entry.output, module->getModuleIdentifier());
+    }
+
+    void JitObjectCache::print_stats(std::ostream &out) const
+    {
+        out << fmt::format("jit object cache: {} hits, {} misses\n", hits.load(), misses.load());
+    }
+}
@@ -0,0 +1,68 @@
+/**
+ * @file object_cache.h
+ * @brief JIT执行(spc -run)的目标文件缓存. 以交给JIT编译的module(bitcode)，优化级别与本机平台的哈希为键，
+ * 把编译出的目标文件放进编译缓存；同一个程序再次执行时跳过LLVM后端，只需要链接后执行
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_OBJECT_CACHE_H
+#define NAIVE_PASCAL_COMPILER_OBJECT_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include "compiler.h"
+
+namespace spc
+{
+    class CompileCache;
+
+    /**
+     * @brief 把JIT编译的目标文件保存在CompileCache中 可以在多个编译线程中同时使用
+     *
+     */
+    class JitObjectCache final : public llvm::ObjectCache
+    {
+    public:
+        /**
+         * @brief Construct a new Jit Object Cache object
+         *
+         * @param cache 保存目标文件的缓存
+         * @param level 优化级别
+         * @param host JIT目标平台的描述(triple，cpu与features)
+         */
+        JitObjectCache(CompileCache &cache, OptLevel level, std::string host);
+
+        void notifyObjectCompiled(const llvm::Module *module, llvm::MemoryBufferRef object) override;
+
+        std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *module) override;
+
+        /**
+         * @brief 输出本次执行的命中统计
+         *
+         * @param out 输出流
+         */
+        void print_stats(std::ostream &out) const;
+
+    private:
+        std::string key(const llvm::Module &module) const;
+
+        CompileCache &cache;
+        OptLevel level;
+        std::string host;
+        std::atomic<std::uint64_t> hits{0};
+        std::atomic<std::uint64_t> misses{0};
+        /// 未命中的module的键 编译完成写入缓存时不必再算一次哈希
+        std::unordered_map<const llvm::Module *, std::string> pending;
+        std::mutex pending_mutex;
+    };
+}
+
+#endif //NAIVE_PASCAL_COMPILER_OBJECT_CACHE_H
@@ -0,0 +1,61 @@
+/**
+ * @file runtime_bitcode.cpp
+ * @brief 链接运行时库bitcode的实现
+ * @version 0.1
+ * @date 2021-06-23
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <llvm/ADT/Triple.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include "runtime_bitcode.h"
+
+namespace spc
+{
+    void link_runtime(llvm::Module &module, std::ostream &diagnostics)
+    {
+        if (runtime_bitcode_size == 0) return;
+        llvm::StringRef data(reinterpret_cast<const char *>(runtime_bitcode), runtime_bitcode_size);
+        //按需读入函数体，只有链接进来的函数才会解析
+        auto loaded = llvm::getLazyBitcodeModule(llvm::MemoryBufferRef(data, "spcrt.bc"), module.getContext());
+        if (!loaded)
+        {
+            diagnostics << "warning: failed to read the embedded runtime library: "
+                        << llvm::toString(loaded.takeError()) << std::endl;
+            return;
+        }
+        auto runtime = std::move(*loaded);
+        //bitcode是为构建spc的平台编译的，结构体布局与调用约定对其他平台不成立
+        if (llvm::Triple(runtime->getTargetTriple()).getArch() != llvm::Triple(module.getTargetTriple()).getArch())
+            return;
+        runtime->setTargetTriple(module.getTargetTriple());
+        runtime->setDataLayout(module.getDataLayout());
+        //clang记录的PIC级别等会改变module生成目标代码的方式
+        if (auto *flags = runtime->getModuleFlagsMetadata()) runtime->eraseNamedMetadata(flags);
+
+        for (auto &func : *runtime)
+        {
+            if (func.isDeclaration()) continue;
+            //与用户的函数一样使用-mcpu，-mattr指定的目标，否则特性不同的函数之间不能内联
+            func.removeFnAttr("target-cpu");
+            func.removeFnAttr("target-features");
+            func.removeFnAttr("tune-cpu");
+            if (func.hasExternalLinkage()) func.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        }
+        //退出时写出缓冲区的析构函数属于libspcrt 链接进来会让每个module都多一份(appending的全局变量总会被链接)
+        for (auto name : {"llvm.global_ctors", "llvm.global_dtors"})
+        {
+            if (auto *var = runtime->getNamedGlobal(name)) var->eraseFromParent();
+        }
+        for (auto &var : runtime->globals())
+        {
+            if (var.hasExternalLinkage() && var.hasInitializer()) var.setInitializer(nullptr);
+        }
+        if (llvm::Linker::linkModules(module, std::move(runtime), llvm::Linker::LinkOnlyNeeded))
+            diagnostics << "warning: failed to link the embedded runtime library" << std::endl;
+    }
+}
@@ -0,0 +1,39 @@
+/**
+ * @file runtime_bitcode.h
+ * @brief 嵌入spc的运行时库bitcode. 构建时用与LLVM同一版本的clang把runtime/spcrt.cpp编译为bitcode，
+ * 优化前链接进用户的module，输出，输入这些热点函数可以内联进调用它的循环并按常量参数特化
+ * @version 0.1
+ * @date 2021-06-23
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_RUNTIME_BITCODE_H
+#define NAIVE_PASCAL_COMPILER_RUNTIME_BITCODE_H
+
+#include <cstddef>
+#include <iostream>
+
+namespace llvm
+{
+    class Module;
+}
+
+namespace spc
+{
+    /// 运行时库的bitcode 由构建目录中生成的spcrt_bitcode.cpp定义，构建环境中没有clang时长度为0
+    extern const unsigned char runtime_bitcode[];
+    extern const size_t runtime_bitcode_size;
+
+    /**
+     * @brief 把运行时库中module用到的函数链接进来 它们是available_externally的: 优化器可以内联，
+     * 优化流水线结束时删除剩下的函数体，没有内联的调用仍然调用libspcrt(或JIT中spc自身)里的函数；
+     * 运行时库的状态(spc_runtime_state)只是外部声明，内联的代码与libspcrt读写同一个缓冲区
+     *
+     * @param module 设置好目标平台与数据布局、还没有优化的module
+     * @param diagnostics 嵌入的bitcode无法读取时在这里输出警告，module不变
+     */
+    void link_runtime(llvm::Module &module, std::ostream &diagnostics);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_RUNTIME_BITCODE_H
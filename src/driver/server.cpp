@@ -0,0 +1,289 @@
+/**
+ * @file server.cpp
+ * @brief 编译服务器与客户端的实现
+ * @version 0.1
+ * @date 2021-06-12
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "utils/thread_pool.hpp"
+#include "server.h"
+
+namespace spc
+{
+    namespace
+    {
+        /// 请求类型
+        enum class RequestKind : std::uint32_t
+        { COMPILE = 1, SHUTDOWN = 2 };
+
+        /// CompileOptions中的开关在请求中的位 优化级别与向量数学函数库分别放在第8位，第16位开始的一个字节中
+        enum : std::uint32_t
+        {
+            FLAG_AST = 1u << 1, FLAG_OPT_LEVEL_SHIFT = 8, FLAG_OPT_LEVEL_MASK = 0xffu << FLAG_OPT_LEVEL_SHIFT,
+            FLAG_VECLIB_SHIFT = 16, FLAG_VECLIB_MASK = 0xffu << FLAG_VECLIB_SHIFT
+        };
+
+        /// 单个字符串的长度上限 防止错误的请求让服务器分配过多内存
+        constexpr std::uint32_t max_string_size = 256u << 20;
+
+        bool read_all(int fd, void *data, size_t size)
+        {
+            auto *p = static_cast<char *>(data);
+            while (size > 0)
+            {
+                auto n = ::read(fd, p, size);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                p += n;
+                size -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        bool write_all(int fd, const void *data, size_t size)
+        {
+            auto *p = static_cast<const char *>(data);
+            while (size > 0)
+            {
+                auto n = ::send(fd, p, size, MSG_NOSIGNAL); //对方断开时不要因为SIGPIPE退出
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                p += n;
+                size -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        bool read_u32(int fd, std::uint32_t &value)
+        { return read_all(fd, &value, sizeof(value)); }
+
+        bool write_u32(int fd, std::uint32_t value)
+        { return write_all(fd, &value, sizeof(value)); }
+
+        bool read_string(int fd, std::string &value)
+        {
+            std::uint32_t size;
+            if (!read_u32(fd, size) || size > max_string_size) return false;
+            value.resize(size);
+            return read_all(fd, &value[0], size);
+        }
+
+        bool write_string(int fd, const std::string &value)
+        {
+            return write_u32(fd, static_cast<std::uint32_t>(value.size())) && write_all(fd, value.data(), value.size());
+        }
+
+        /**
+         * @brief 填写套接字地址
+         *
+         * @return true 路径长度合法
+         */
+        bool make_address(const std::string &socket_path, sockaddr_un &address)
+        {
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (socket_path.size() >= sizeof(address.sun_path)) return false;
+            std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+            return true;
+        }
+
+        /// 连接编译服务器 失败时返回-1
+        int connect_server(const std::string &socket_path)
+        {
+            sockaddr_un address;
+            if (!make_address(socket_path, address)) return -1;
+            int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) return -1;
+            if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+            {
+                ::close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        /**
+         * @brief 删除上次没有正常退出时留下的套接字文件 路径不是套接字或者仍有服务器在监听时不删除
+         *
+         * @return true 路径现在可以用来bind
+         */
+        bool remove_stale_socket(const std::string &socket_path, std::ostream &log)
+        {
+            struct stat status;
+            if (::lstat(socket_path.c_str(), &status) < 0)
+            {
+                if (errno == ENOENT) return true;
+                log << "failed to inspect " << socket_path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            if (!S_ISSOCK(status.st_mode))
+            {
+                log << socket_path << " exists and is not a socket" << std::endl;
+                return false;
+            }
+            int fd = connect_server(socket_path);
+            if (fd >= 0)
+            {
+                ::close(fd);
+                log << "a compile server is already listening on " << socket_path << std::endl;
+                return false;
+            }
+            if (::unlink(socket_path.c_str()) < 0 && errno != ENOENT)
+            {
+                log << "failed to remove stale socket " << socket_path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * @brief 处理一个连接上的所有请求
+         *
+         * @return true 收到了停止请求
+         */
+        bool handle_connection(int fd, const CompileFunction &compile)
+        {
+            std::uint32_t kind;
+            while (read_u32(fd, kind))
+            {
+                if (kind == static_cast<std::uint32_t>(RequestKind::SHUTDOWN)) return true;
+                if (kind != static_cast<std::uint32_t>(RequestKind::COMPILE)) return false;
+
+                std::uint32_t target, flags;
+                std::string source;
+                CompileOptions options;
+                if (!read_u32(fd, target) || !read_u32(fd, flags) || !read_string(fd, source) ||
+                    !read_string(fd, options.cpu) || !read_string(fd, options.features) ||
+                    !read_string(fd, options.tune))
+                    return false;
+
+                if (target != static_cast<std::uint32_t>(Target::LLVM) && target != static_cast<std::uint32_t>(Target::ASM) &&
+                    target != static_cast<std::uint32_t>(Target::OBJ))
+                    return false;
+                options.target = static_cast<Target>(target);
+                options.optimization = static_cast<OptLevel>((flags & FLAG_OPT_LEVEL_MASK) >> FLAG_OPT_LEVEL_SHIFT);
+                if (options.optimization > OptLevel::Oz) return false;
+                options.veclib = static_cast<VecLib>((flags & FLAG_VECLIB_MASK) >> FLAG_VECLIB_SHIFT);
+                if (options.veclib > VecLib::ACCELERATE) return false;
+                options.ast = (flags & FLAG_AST) != 0;
+
+                CompileResult result;
+                try
+                { result = compile(source, options); }
+                catch (std::exception &e)
+                { result.diagnostics += std::string(e.what()) + "\n"; }
+
+                if (!write_u32(fd, result.success ? 1 : 0) || !write_string(fd, result.output) ||
+                    !write_string(fd, result.ast_json) || !write_string(fd, result.diagnostics))
+                    return false;
+            }
+            return false;
+        }
+    }
+
+    int serve(const std::string &socket_path, unsigned jobs, std::ostream &log, const CompileFunction &compile)
+    {
+        sockaddr_un address;
+        if (!make_address(socket_path, address))
+        {
+            log << "socket path is too long: " << socket_path << std::endl;
+            return 1;
+        }
+        int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+        {
+            log << "failed to create socket: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        if (!remove_stale_socket(socket_path, log))
+        {
+            ::close(listen_fd);
+            return 1;
+        }
+        if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+            ::listen(listen_fd, SOMAXCONN) < 0)
+        {
+            log << "failed to listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+            ::close(listen_fd);
+            return 1;
+        }
+
+        initialize_targets(); //在接受请求之前完成初始化，之后的请求不再付出这部分开销
+        log << "spc: serving on " << socket_path << " with " << jobs << " worker(s)" << std::endl;
+
+        //每个工作线程各自accept 线程本地的TargetMachine缓存在连接之间保持有效
+        std::atomic<bool> stopping{false};
+        parallel_for(jobs, jobs, [&](size_t) {
+            while (!stopping)
+            {
+                int fd = ::accept(listen_fd, nullptr, nullptr);
+                if (fd < 0)
+                {
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    break; //监听套接字被关闭(停止服务)或出现不可恢复的错误
+                }
+                if (handle_connection(fd, compile))
+                {
+                    stopping = true;
+                    ::shutdown(listen_fd, SHUT_RDWR); //唤醒阻塞在accept上的其他工作线程
+                }
+                ::close(fd);
+            }
+        });
+
+        ::close(listen_fd);
+        ::unlink(socket_path.c_str());
+        return 0;
+    }
+
+    CompileResult compile_remote(const std::string &socket_path, const std::string &source,
+                                 const CompileOptions &options)
+    {
+        CompileResult result;
+        int fd = connect_server(socket_path);
+        if (fd < 0)
+        {
+            result.diagnostics = "failed to connect to compile server " + socket_path + ": " +
+                                 std::strerror(errno) + "\n";
+            return result;
+        }
+
+        std::uint32_t flags = (static_cast<std::uint32_t>(options.optimization) << FLAG_OPT_LEVEL_SHIFT) |
+                              (static_cast<std::uint32_t>(options.veclib) << FLAG_VECLIB_SHIFT) |
+                              (options.ast ? FLAG_AST : 0u);
+        std::uint32_t success = 0;
+        bool ok = write_u32(fd, static_cast<std::uint32_t>(RequestKind::COMPILE)) &&
+                  write_u32(fd, static_cast<std::uint32_t>(options.target)) &&
+                  write_u32(fd, flags) && write_string(fd, source) && write_string(fd, options.cpu) &&
+                  write_string(fd, options.features) && write_string(fd, options.tune) &&
+                  read_u32(fd, success) && read_string(fd, result.output) &&
+                  read_string(fd, result.ast_json) && read_string(fd, result.diagnostics);
+        ::close(fd);
+        if (!ok)
+        {
+            result.diagnostics += "lost connection to compile server " + socket_path + "\n";
+            return result;
+        }
+        result.success = success != 0;
+        return result;
+    }
+
+    bool stop_server(const std::string &socket_path)
+    {
+        int fd = connect_server(socket_path);
+        if (fd < 0) return false;
+        bool ok = write_u32(fd, static_cast<std::uint32_t>(RequestKind::SHUTDOWN));
+        ::close(fd);
+        return ok;
+    }
+}
@@ -0,0 +1,57 @@
+/**
+ * @file server.h
+ * @brief 编译服务器. 常驻进程保持LLVM目标平台与TargetMachine已初始化，通过Unix域套接字接收编译请求，
+ * 省去每次编译启动进程与初始化LLVM的开销
+ *
+ * 协议(所有整数都是本机字节序的uint32，字符串是长度+内容):
+ * - 请求: kind; kind为COMPILE时后面跟 target, flags, source, cpu, features, tune
+ * - 响应: success, output, ast_json, diagnostics
+ * 一个连接上可以依次发送多个请求
+ * @version 0.1
+ * @date 2021-06-12
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_SERVER_H
+#define NAIVE_PASCAL_COMPILER_SERVER_H
+
+#include <iostream>
+#include <string>
+#include "compiler.h"
+
+namespace spc
+{
+    /**
+     * @brief 启动编译服务器 直到收到停止请求才返回
+     *
+     * @param socket_path 套接字路径 已存在的同名文件会被删除
+     * @param jobs 同时处理连接的工作线程数量
+     * @param log 启动与错误信息输出到这里
+     * @param compile 编译一份源代码的方法
+     * @return int 进程返回值
+     */
+    int serve(const std::string &socket_path, unsigned jobs, std::ostream &log,
+              const CompileFunction &compile = compile_source);
+
+    /**
+     * @brief 把一份源代码交给编译服务器编译 可以作为compile_batch的编译方法
+     *
+     * @param socket_path 套接字路径
+     * @param source 源代码
+     * @param options 编译选项
+     * @return CompileResult 连接失败时success为false，diagnostics中是失败原因
+     */
+    CompileResult compile_remote(const std::string &socket_path, const std::string &source,
+                                 const CompileOptions &options);
+
+    /**
+     * @brief 请求编译服务器退出
+     *
+     * @param socket_path 套接字路径
+     * @return true 请求已发出
+     */
+    bool stop_server(const std::string &socket_path);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_SERVER_H
@@ -0,0 +1,284 @@
+/**
+ * @file tier.cpp
+ * @brief 分层执行第二层的实现
+ * @version 0.1
+ * @date 2021-06-20
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <chrono>
+#include <vector>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include "codegen/codegen_context.hpp"
+#include "compiler.h"
+#include "jit.h"
+#include "tier.h"
+
+namespace spc
+{
+    namespace
+    {
+        /// 把LLVM的错误信息写到diagnostics
+        void report(llvm::Error error, std::ostream &diagnostics)
+        {
+            diagnostics << llvm::toString(std::move(error)) << std::endl;
+        }
+
+        /**
+         * @brief 生成func的本地代码入口(NativeEntry) 从VmValue数组中取出参数，调用func，
+         * 再把返回值按解释器的表示写回: 整数与字符符号扩展，布尔值零扩展
+         */
+        llvm::Function *create_entry(llvm::Function &func)
+        {
+            auto &context = func.getContext();
+            auto *value_ptr = llvm::Type::getInt64PtrTy(context);
+            auto *type = llvm::FunctionType::get(llvm::Type::getVoidTy(context), {value_ptr, value_ptr}, false);
+            auto *entry = llvm::Function::Create(type, llvm::GlobalValue::ExternalLinkage,
+                                                 "spc.entry." + func.getName(), func.getParent());
+            auto *args = entry->arg_begin();
+            auto *result = args + 1;
+            llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", entry));
+            std::vector<llvm::Value *> params;
+            for (auto &param : func.args())
+            {
+                auto *slot = builder.CreateConstInBoundsGEP1_64(builder.getInt64Ty(), args, param.getArgNo());
+                auto *param_type = param.getType();
+                if (param_type->isDoubleTy())
+                    params.push_back(builder.CreateLoad(param_type,
+                                                        builder.CreateBitCast(slot, param_type->getPointerTo())));
+                else
+                    params.push_back(builder.CreateTrunc(builder.CreateLoad(builder.getInt64Ty(), slot), param_type));
+            }
+            auto *value = builder.CreateCall(&func, params);
+            auto *result_type = func.getReturnType();
+            if (result_type->isDoubleTy())
+                builder.CreateStore(value, builder.CreateBitCast(result, result_type->getPointerTo()));
+            else if (result_type->isIntegerTy(1))
+                builder.CreateStore(builder.CreateZExt(value, builder.getInt64Ty()), result);
+            else if (!result_type->isVoidTy())
+                builder.CreateStore(builder.CreateSExt(value, builder.getInt64Ty()), result);
+            builder.CreateRetVoid();
+            return entry;
+        }
+
+        class JitTier final : public NativeTier
+        {
+        public:
+            JitTier(std::string source, const BytecodeProgram &program, bool verbose, std::ostream &diagnostics)
+                    : source(std::move(source)), program(program), verbose(verbose), diagnostics(diagnostics)
+            {
+                options.optimization = OptLevel::O2;
+                options.cpu = "native";
+                for (uint32_t i = 0; i < program.functions.size(); ++i)
+                    if (i != program.main) functions[program.functions[i].name] = i;
+            }
+
+            bool compile(uint32_t function, uint8_t *globals, std::vector<NativeEntry> &entries) override;
+
+        private:
+            bool initialize(uint8_t *globals);
+
+            std::string source;
+            const BytecodeProgram &program;
+            bool verbose;
+            std::ostream &diagnostics;
+            /// 函数名到BytecodeProgram::functions中的下标
+            llvm::StringMap<uint32_t> functions;
+            /// 生成module或创建JIT失败后不再尝试
+            bool failed = false;
+            /// 以-O2为本机的CPU优化与编译
+            CompileOptions options;
+
+            std::unique_ptr<llvm::orc::LLJIT> jit;
+            llvm::orc::ThreadSafeContext llvm_context;
+            /// 整个程序未优化的module 每次编译从中复制需要的函数，它要先于llvm_context销毁
+            std::unique_ptr<llvm::Module> module;
+            /// 已经交给JIT的函数 之后的module中只声明它们
+            llvm::SmallPtrSet<const llvm::Function *, 16> compiled;
+        };
+
+        bool JitTier::initialize(uint8_t *globals)
+        {
+            //生成时不优化，每次编译只对复制出的函数运行-O2的流水线
+            auto context = generate_module(source, CompileOptions(), diagnostics);
+            if (context == nullptr) return false;
+
+            initialize_targets();
+            auto machine_builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+            if (!machine_builder)
+            {
+                report(machine_builder.takeError(), diagnostics);
+                return false;
+            }
+            machine_builder->setCodeGenOptLevel(codegen_level(OptLevel::O2));
+            auto cpu = target_cpu(options);
+            machine_builder->setCPU(cpu.cpu);
+            machine_builder->getFeatures() = llvm::SubtargetFeatures(cpu.features);
+            auto created = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*machine_builder)).create();
+            if (!created)
+            {
+                report(created.takeError(), diagnostics);
+                return false;
+            }
+            jit = std::move(*created);
+
+            //运行时库之外的C库函数(scanf等)从本进程中查找
+            if (auto error = define_runtime(*jit))
+            {
+                report(std::move(error), diagnostics);
+                return false;
+            }
+            auto &main_dylib = jit->getMainJITDylib();
+            auto prefix = jit->getDataLayout().getGlobalPrefix();
+            auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(prefix);
+            if (!process)
+            {
+                report(process.takeError(), diagnostics);
+                return false;
+            }
+            main_dylib.setGenerator(std::move(*process));
+
+            //全局变量定义为解释器全局存储区中的绝对地址，本地代码与解释器读写的是同一个变量
+            llvm::StringMap<uint32_t> offsets;
+            llvm::orc::SymbolMap symbols;
+            for (const auto &symbol : program.symbols)
+            {
+                offsets[symbol.name] = symbol.offset;
+                auto name = prefix ? std::string(1, prefix) + symbol.name : symbol.name;
+                symbols[jit->getExecutionSession().intern(name)] = llvm::JITEvaluatedSymbol(
+                        llvm::pointerToJITTargetAddress(globals + symbol.offset), llvm::JITSymbolFlags::Exported);
+            }
+            for (auto &var : context->module->globals())
+            {
+                if (var.hasPrivateLinkage()) continue; //字符串常量
+                if (!offsets.count(var.getName()))
+                {
+                    diagnostics << "tiered: global variable " << var.getName().str()
+                                << " has no counterpart in the interpreter" << std::endl;
+                    return false;
+                }
+            }
+            if (auto error = main_dylib.define(llvm::orc::absoluteSymbols(std::move(symbols))))
+            {
+                report(std::move(error), diagnostics);
+                return false;
+            }
+
+            context->fpm.reset();
+            module = std::move(context->module);
+            module->setDataLayout(jit->getDataLayout());
+            module->setTargetTriple(jit->getTargetTriple().str());
+            llvm_context = llvm::orc::ThreadSafeContext(std::move(context->llvm_context));
+            return true;
+        }
+
+        bool JitTier::compile(uint32_t function, uint8_t *globals, std::vector<NativeEntry> &entries)
+        {
+            if (failed) return false;
+            if (jit == nullptr && !initialize(globals))
+            {
+                failed = true;
+                return false;
+            }
+            auto begin = std::chrono::steady_clock::now();
+            auto *root = module->getFunction(program.functions[function].name);
+            if (root == nullptr || root->isDeclaration() || compiled.count(root)) return false;
+
+            //本地代码不会回到解释器，所以它直接或间接调用的子过程要一起编译
+            llvm::SmallPtrSet<const llvm::Function *, 16> batch;
+            std::vector<llvm::Function *> pending{root};
+            batch.insert(root);
+            while (!pending.empty())
+            {
+                auto *func = pending.back();
+                pending.pop_back();
+                for (auto &inst : llvm::instructions(*func))
+                {
+                    auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+                    auto *callee = call != nullptr ? call->getCalledFunction() : nullptr;
+                    if (callee == nullptr || callee->isDeclaration() || compiled.count(callee)) continue;
+                    if (batch.insert(callee).second) pending.push_back(callee);
+                }
+            }
+
+            //与缓存子过程的IR一样: 复制这一批函数与字符串常量，其他函数与全局变量只是外部声明
+            llvm::ValueToValueMapTy map;
+            auto part = llvm::CloneModule(*module, map, [&](const llvm::GlobalValue *value) {
+                if (auto *func = llvm::dyn_cast<llvm::Function>(value)) return batch.count(func) > 0;
+                return value->hasPrivateLinkage();
+            });
+            for (auto it = part->global_begin(); it != part->global_end();)
+            {
+                auto &var = *it++;
+                var.removeDeadConstantUsers();
+                if ((var.isDeclaration() || var.hasPrivateLinkage()) && var.use_empty()) var.eraseFromParent();
+            }
+            for (auto it = part->begin(); it != part->end();)
+            {
+                auto &func = *it++;
+                if (func.isDeclaration() && func.use_empty()) func.eraseFromParent();
+            }
+            std::vector<std::pair<uint32_t, std::string>> created;
+            for (auto *func : batch)
+            {
+                auto it = functions.find(func->getName());
+                if (it == functions.end()) continue;
+                auto *entry = create_entry(*llvm::cast<llvm::Function>(map[func]));
+                created.emplace_back(it->second, entry->getName().str());
+            }
+            //解释器比代码生成宽松(比如实参会转换为形参的类型)，生成的IR有问题时这一批留在解释器中
+            if (llvm::verifyModule(*part))
+            {
+                if (verbose)
+                    diagnostics << "tiered: " << root->getName().str() << " stays in the interpreter" << std::endl;
+                return false;
+            }
+            if (!optimize_module(*part, options, diagnostics)) return false;
+            if (auto error = jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(part), llvm_context)))
+            {
+                report(std::move(error), diagnostics);
+                failed = true;
+                return false;
+            }
+            for (auto *func : batch) compiled.insert(func);
+
+            //把入口填进解释器的入口表，之后对这些子过程的调用都直接进入本地代码
+            for (const auto &item : created)
+            {
+                auto symbol = jit->lookup(item.second);
+                if (!symbol)
+                {
+                    report(symbol.takeError(), diagnostics);
+                    failed = true;
+                    return false;
+                }
+                entries[item.first] = reinterpret_cast<NativeEntry>(symbol->getAddress());
+            }
+            if (verbose)
+            {
+                auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                diagnostics << "tiered: compiled " << root->getName().str() << " with " << batch.size() - 1
+                            << " callee(s) in " << ms << " ms" << std::endl;
+            }
+            return true;
+        }
+    }
+
+    std::unique_ptr<NativeTier> create_jit_tier(const std::string &source, const BytecodeProgram &program,
+                                                bool verbose, std::ostream &diagnostics)
+    {
+        return std::make_unique<JitTier>(source, program, verbose, diagnostics);
+    }
+}
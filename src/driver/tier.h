@@ -0,0 +1,35 @@
+/**
+ * @file tier.h
+ * @brief 分层执行(spc -tiered)的第二层. 程序先在字节码解释器中执行，热点子过程交给LLVM JIT以-O2编译，
+ * 本地代码与解释器共用同一份全局变量
+ * @version 0.1
+ * @date 2021-06-20
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_TIER_H
+#define NAIVE_PASCAL_COMPILER_TIER_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include "vm/interpreter.h"
+
+namespace spc
+{
+    /**
+     * @brief 创建用LLVM JIT编译热点子过程的NativeTier 第一次编译时才生成整个程序的module，
+     * 没有热点的短程序完全不经过LLVM
+     *
+     * @param source 源代码
+     * @param program 由同一份源代码翻译出的字节码 按名字把函数与全局变量对应到module中
+     * @param verbose 每次编译时输出编译了哪些子过程
+     * @param diagnostics 编译错误与编译信息输出到这里
+     * @return std::unique_ptr<NativeTier>
+     */
+    std::unique_ptr<NativeTier> create_jit_tier(const std::string &source, const BytecodeProgram &program,
+                                                bool verbose, std::ostream &diagnostics);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_TIER_H
@@ -7,206 +7,250 @@
  * @copyright Copyright (c) 2021
  * 
  */
+#include <cctype>
 #include <cstdio>
 #include <iostream>
-#include <fstream>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
-#include <system_error>
-#include <llvm/IR/LegacyPassManager.h>
-#include <llvm/Support/FileSystem.h>
-#include <llvm/Support/Host.h>
-#include <llvm/Support/TargetSelect.h>
-#include <llvm/Support/TargetRegistry.h>
-#include <llvm/Support/raw_ostream.h>
-#include <llvm/Target/TargetMachine.h>
-#include "utils/ast.hpp"
-#include "codegen/codegen_context.hpp"
-#include "y.tab.h"
-#include<unistd.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "driver/batch.h"
+#include "driver/cache.h"
+#include "driver/compiler.h"
+#include "driver/interp.h"
+#include "driver/jit.h"
+#include "driver/server.h"
+#include "utils/thread_pool.hpp"
 
 
 using namespace std;
-using namespace llvm;
 using namespace spc;
 
-/**
- * @brief 语法分析最后得出的语法树根结点 这是一个external变量，实际位于bison生成的代码文件中. 
- * "YYSTYPE"实际上就是std::shared_ptr<AbstractNode>的别名,由parse.y的19行定义
- */
-extern YYSTYPE program;
-
-/**
- * @brief 生成目标代码，可以选择生成LLVM IR，ASM 或者 OBJ文件
- * 
- * @param dest 输出的文件句柄
- * @param type 输出文件类型
- * @param module LLVM的module，这个里面存放着生成的代码
- */
-void emit_target(raw_fd_ostream &dest, TargetMachine::CodeGenFileType type, Module &module)
-{
-    //初始化环境信息
-    InitializeAllTargetInfos();
-    InitializeAllTargets();
-    InitializeAllTargetMCs();
-    InitializeAllAsmParsers();
-    InitializeAllAsmPrinters();
-
-    //设置默认输出Target
-    auto target_triple = sys::getDefaultTargetTriple();
-    module.setTargetTriple(target_triple);
-
-    //错误检查
-    string error;
-    auto target = TargetRegistry::lookupTarget(target_triple, error);
-    if (!target)
-    { errs() << error; exit(1); }
-
-    //设置平台细节
-    auto cpu = "generic";
-    auto features = "";
-    TargetOptions opt;
-    auto rm = Optional<Reloc::Model>(Reloc::PIC_);
-    auto target_machine = target->createTargetMachine(target_triple, cpu, features, opt, rm);
-    module.setDataLayout(target_machine->createDataLayout());
-
-    legacy::PassManager pass;
-    if (target_machine->addPassesToEmitFile(pass, dest, nullptr,type))
-    { errs() << "The target machine cannot emit an object file"; exit(1); }
-
-    pass.run(module);
-    dest.flush();
-}
-
 int main(int argc, char *argv[])
 {
-    
-    enum class Target
-    { UNDEFINED, LLVM, ASM, OBJ };
-    Target target = Target::UNDEFINED;
-    bool optimization = false;
-    bool ast=false;
-    char *sourceFile = nullptr; // Pascal 源代码文件
-    char *outFile=nullptr;//输出文件参数
-    target = Target::UNDEFINED;
+    CompileOptions options;
+    unsigned jobs = 0; //0表示没有指定-j
+    string servePath; //--serve 以编译服务器方式运行
+    string connectPath; //--connect 交给编译服务器编译
+    string cacheDir; //编译缓存目录 为空时不使用缓存
+    if (getenv("SPC_CACHE_DIR")) cacheDir = CompileCache::default_directory();
+    auto cacheMaxSize = CompileCache::default_max_bytes;
+    bool cacheStats = false;
+    vector<string> sourceFiles; // Pascal 源代码文件
+    bool run = false; //-run 在本进程内JIT执行
+    bool interp = false; //-interp 翻译成字节码解释执行
+    TierOptions tierOptions; //-tiered 先解释执行，热点子过程再JIT编译
+    RunOptions runOptions;
+    vector<string> programArgs; //-run与-interp时源文件之后的参数都传给程序
+    string outFile;//输出文件参数
 
+    //展开响应文件 @file中的每一项都当作一个参数
+    vector<string> args;
     for (int i = 1; i < argc; ++i)
     {
-        if (strcmp(argv[i], "-emit-llvm") == 0) target = Target::LLVM;
-        else if (strcmp(argv[i], "-S") == 0) target = Target::ASM;
-        else if (strcmp(argv[i], "-c") == 0) target = Target::OBJ;
-        else if (strcmp(argv[i], "-O") == 0) optimization = true;
-        else if (strcmp(argv[i], "-ast") == 0){
-            ast=true;//输出ast树
+        if (argv[i][0] == '@')
+        {
+            if (!read_response_file(&argv[i][1], args))
+            { cout << "failed to open response file " << &argv[i][1] << endl; exit(1); }
+        }
+        else args.push_back(argv[i]);
+    }
+
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        const auto &arg = args[i];
+        if (arg == "-emit-llvm") options.target = Target::LLVM;
+        else if (arg == "-S") options.target = Target::ASM;
+        else if (arg == "-c") options.target = Target::OBJ;
+        else if (arg == "-run") run = true;
+        else if (arg == "-interp") interp = true;
+        else if (arg == "-tiered") interp = tierOptions.enabled = true;
+        else if (arg == "-tier-threshold") {
+            if (i + 1 >= args.size() || atoi(args[i + 1].c_str()) <= 0)
+            { printf("Error: %s requires a positive count", arg.c_str()); exit(1); }
+            tierOptions.threshold = static_cast<uint32_t>(atoi(args[++i].c_str()));
+        }
+        else if (arg == "-tier-log") tierOptions.verbose = true;
+        else if (arg == "-lazy") runOptions.lazy = true;
+        else if (arg == "-O" || arg == "-O2") options.optimization = OptLevel::O2;
+        else if (arg == "-O0") options.optimization = OptLevel::O0;
+        else if (arg == "-O1") options.optimization = OptLevel::O1;
+        else if (arg == "-O3") options.optimization = OptLevel::O3;
+        else if (arg == "-Os") options.optimization = OptLevel::Os;
+        else if (arg == "-Oz") options.optimization = OptLevel::Oz;
+        else if (arg.compare(0, 6, "-mcpu=") == 0 || arg.compare(0, 7, "-march=") == 0)
+            options.cpu = arg.substr(arg.find('=') + 1); //x86上-march与-mcpu相同，-march=native使用本机的CPU与特性
+        else if (arg.compare(0, 7, "-mtune=") == 0) options.tune = arg.substr(7);
+        else if (arg.compare(0, 7, "-mattr=") == 0) {//逗号分隔的特性 没有+/-前缀的特性表示打开
+            stringstream list(arg.substr(7));
+            string feature;
+            while (getline(list, feature, ',')) {
+                if (feature.empty()) continue;
+                if (!options.features.empty()) options.features += ',';
+                if (feature[0] != '+' && feature[0] != '-') options.features += '+';
+                options.features += feature;
+            }
+        }
+        else if (arg.compare(0, 9, "-fveclib=") == 0) {//与clang相同的名字
+            auto name = arg.substr(9);
+            auto veclib = VecLib::NONE;
+            for (auto candidate : {VecLib::NONE, VecLib::LIBMVEC, VecLib::SVML, VecLib::MASSV, VecLib::ACCELERATE})
+                if (name == veclib_name(candidate)) veclib = candidate;
+            if (veclib == VecLib::NONE && name != "none")
+            { printf("Error: unknown vector library: %s", name.c_str()); exit(1); }
+            options.veclib = veclib;
         }
-        else if (strcmp(argv[i], "-o") == 0) {//输出文件名
+        else if (arg == "-ast"){
+            options.ast=true;//输出ast树
+        }
+        else if (arg == "-o") {//输出文件名
         //./spc -S -o outputname srcname
             i++;
-            if(i>=argc){
+            if(i>=args.size()){
                 cout<<"para error"<<endl;
             }
             else{
-                outFile=argv[i];
+                outFile=args[i];
             }
         }
-        else if (argv[i][0] == '-')
-        { printf("Error: unknown argument: %s", argv[i]); exit(1); }
-        else sourceFile = argv[i];
-    }
-    if (target == Target::UNDEFINED || sourceFile == nullptr)
-    {
-        puts("USAGE: spc <option> <source.pas>");
-        puts("OPTION:");
-        puts("  -emit-llvm    Emit LLVM IR code (.ll)");
-        puts("  -S            Emit assembly code (.s)");
-        puts("  -c            Emit object code (.o)");
-        puts("  -ast          puts ast");
-        puts("  -o des        name output file as des");
-        exit(1);
-    }
-    // 命令行解析及帮助
-
-    if(freopen(sourceFile, "r", stdin)==nullptr){//将stdin重定向为Pascal源代码 以供flex进行词法分析
-        cout<<"failed to open sourceFile "+ string(sourceFile)<<endl;
-        exit(-1);
-    } 
-
-    yyparse();  //开始词法分析
-
-    if(ast){
-        
-        int i=-1;
-     
-        for(i=strlen(sourceFile)-1;i>=0;i--){
-            if(sourceFile[i]=='/'){
-                break;
+        else if (arg.compare(0, 2, "-j") == 0) {//并行编译的线程数 -j8 或 -j 8 不带数字时使用全部硬件线程
+            string value = arg.substr(2);
+            if (value.empty() && i + 1 < args.size() && isdigit(static_cast<unsigned char>(args[i + 1][0])))
+                value = args[++i];
+            jobs = value.empty() ? default_jobs() : static_cast<unsigned>(atoi(value.c_str()));
+            if (jobs == 0)
+            { printf("Error: invalid job count: %s", arg.c_str()); exit(1); }
+        }
+        else if (arg == "--serve" || arg == "--connect" || arg == "--stop-server") {
+            if (i + 1 >= args.size())
+            { printf("Error: %s requires a socket path", arg.c_str()); exit(1); }
+            if (arg == "--serve") servePath = args[++i];
+            else if (arg == "--connect") connectPath = args[++i];
+            else {
+                if (!stop_server(args[++i]))
+                { printf("Error: failed to connect to compile server %s", args[i].c_str()); exit(1); }
+                return 0;
             }
         }
-        string astFile(&sourceFile[i+1]);
-        astFile.erase(astFile.rfind('.'));
-        astFile+="_ast.json";
-        std::ofstream ast(astFile,ios::out);
-       
-        if(!ast.is_open()){
-            cout<<"failed to open "<<astFile<<endl;
-            exit(0);
+        else if (arg == "--cache") cacheDir = CompileCache::default_directory();
+        else if (arg == "--cache-dir" || arg == "--cache-max-size") {
+            if (i + 1 >= args.size())
+            { printf("Error: %s requires a value", arg.c_str()); exit(1); }
+            if (arg == "--cache-dir") cacheDir = args[++i];
+            else {
+                //容量可以带K/M/G后缀
+                char *end = nullptr;
+                cacheMaxSize = strtoull(args[++i].c_str(), &end, 10);
+                switch (*end) {
+                    case 'G': case 'g': cacheMaxSize <<= 10; //fallthrough
+                    case 'M': case 'm': cacheMaxSize <<= 10; //fallthrough
+                    case 'K': case 'k': cacheMaxSize <<= 10; break;
+                    default: break;
+                }
+            }
         }
-        ast<<program->to_json();
-        ast.close();
-
+        else if (arg == "--cache-stats") cacheStats = true;
+        else if (arg[0] == '-')
+        { printf("Error: unknown argument: %s", arg.c_str()); exit(1); }
+        else if (run || interp) {
+            sourceFiles.push_back(arg);
+            programArgs.assign(args.begin() + i + 1, args.end());
+            break;
+        }
+        else sourceFiles.push_back(arg);
     }
-        
-    
-    
-
-    CodegenContext context("main", optimization); //设置代码生成的上下文
-    try
-    { program->codegen(context); }
-    catch (CodegenException &e)
-    { 
-        cerr << e.what()<<endl;
-        exit(-1);
+    if (interp)
+    {
+        if (sourceFiles.empty())
+        { puts("USAGE: spc -interp|-tiered [-tier-threshold n] [-tier-log] <source.pas> [args...]"); exit(1); }
+        return interpret_program(sourceFiles[0], cerr, tierOptions);
     }
-
-    string output ;
-
-    if(outFile==nullptr){
-        int i=-1;
-     
-        for(i=strlen(sourceFile)-1;i>=0;i--){
-            if(sourceFile[i]=='/'){
-                break;
-            }
+    if (run)
+    {
+        if (sourceFiles.empty())
+        { puts("USAGE: spc -run [-O...] [-lazy] <source.pas> [args...]"); exit(1); }
+        if (jobs != 0) options.jobs = jobs;
+        unique_ptr<CompileCache> objectCache; //启用缓存时JIT编译出的目标文件也放进缓存
+        if (!cacheDir.empty())
+        {
+            objectCache = make_unique<CompileCache>(cacheDir, cacheMaxSize);
+            runOptions.object_cache = objectCache.get();
+            runOptions.cache_stats = cacheStats;
         }
-        output=string(&sourceFile[i+1]);
-        output.erase(output.rfind('.'));
-
+        return run_program(sourceFiles[0], options, runOptions, programArgs, cerr);
     }
-    else{
-        output=string(outFile);
+    if (cacheStats)
+    {
+        CompileCache(cacheDir.empty() ? CompileCache::default_directory() : cacheDir, cacheMaxSize).print_stats(cout);
+        return 0;
     }
-    
 
-    switch (target)
+    //启用缓存时先查缓存 未命中再真正编译(在本进程内或交给编译服务器)
+    CompileFunction compile = compile_source;
+    if (!connectPath.empty())
+        compile = [&](const string &source, const CompileOptions &options) {
+            return compile_remote(connectPath, source, options);
+        };
+    unique_ptr<CompileCache> cache;
+    if (!cacheDir.empty())
     {
-        case Target::LLVM: output.append(".ll"); break;
-        case Target::ASM:  output.append(".s");  break;
-        case Target::OBJ:  output.append(".o");  break;
-        default: break;
+        cache = make_unique<CompileCache>(cacheDir, cacheMaxSize);
+        if (connectPath.empty()) //在本进程内编译时，整个文件未命中的情况下再逐个子过程地查缓存
+            compile = [&](const string &source, const CompileOptions &options) {
+                auto incremental = options;
+                incremental.routine_cache = cache.get();
+                return compile_source(source, incremental);
+            };
+        compile = cache->wrap(compile);
     }
-   
-    error_code ec;
-    raw_fd_ostream fd(output, ec, sys::fs::F_None);
-    if (ec)
-    { errs() << "Could not open file: " << ec.message(); exit(1); }
 
-    switch (target)
+    if (!servePath.empty())
+        return serve(servePath, jobs == 0 ? default_jobs() : jobs, cerr, compile);
+
+    if (options.target == Target::UNDEFINED || sourceFiles.empty())
     {
-        case Target::LLVM: context.module->print(fd, nullptr); break;
-        case Target::ASM: emit_target(fd, TargetMachine::CGFT_AssemblyFile, *context.module); break;
-        case Target::OBJ: emit_target(fd, TargetMachine::CGFT_ObjectFile, *context.module); break;
-        default: break;
+        puts("USAGE: spc <option> <source.pas>...");
+        puts("OPTION:");
+        puts("  -emit-llvm    Emit LLVM IR code (.ll)");
+        puts("  -S            Emit assembly code (.s)");
+        puts("  -c            Emit object code (.o)");
+        puts("  -run src [args]  compile src in memory and run it, passing args to the program");
+        puts("  -lazy         with -run, compile each routine the first time it is called");
+        puts("  -interp src   run src on the bytecode interpreter without LLVM (fast startup)");
+        puts("  -tiered src   interpret src, compiling hot routines with the LLVM JIT at -O2");
+        puts("  -tier-threshold n  with -tiered, compile a routine after n calls and loop iterations (default 1000)");
+        puts("  -tier-log     with -tiered, report each routine compiled by the JIT");
+        puts("  -O0/-O1/-O2/-O3  optimization level (-O is -O2)");
+        puts("  -Os/-Oz       optimize for size");
+        puts("  -mcpu=cpu     generate code for cpu (default generic; -march=native uses the host cpu and features)");
+        puts("  -mattr=a,b    enable (+a) or disable (-a) target features, e.g. -mattr=+avx2");
+        puts("  -mtune=cpu    tune scheduling and cost models for cpu without changing the instruction set (LLVM 12+)");
+        puts("  -fveclib=lib  vectorize math calls with lib (libmvec, SVML, MASSV, Accelerate or none); link it too");
+        puts("  -ast          puts ast");
+        puts("  -o des        name output file as des");
+        puts("  -jN           compile N files in parallel (or the routines of a single file)");
+        puts("  @file         read more options and source files from file");
+        puts("  --serve sock  run as a compile server listening on unix socket sock");
+        puts("  --connect sock  compile through the compile server at sock");
+        puts("  --stop-server sock  stop the compile server at sock");
+        puts("  --cache       cache compiled outputs (also enabled by SPC_CACHE_DIR)");
+        puts("  --cache-dir dir  cache compiled outputs in dir");
+        puts("  --cache-max-size n  limit the cache to n bytes (K/M/G suffixes allowed)");
+        puts("  --cache-stats print cache hit/miss statistics (with -run, after the program exits)");
+        exit(1);
     }
-    return 0;
+    // 命令行解析及帮助
+
+    if (!outFile.empty() && sourceFiles.size() > 1)
+    { puts("Error: -o cannot be used with multiple source files"); exit(1); }
+
+    vector<BatchInput> inputs;
+    for (const auto &sourceFile : sourceFiles) inputs.push_back(BatchInput{sourceFile, outFile});
+
+    if (jobs == 0) jobs = 1;
+    if (inputs.size() == 1) options.jobs = jobs; //只有一个源文件时用这些线程并行生成它的子过程
+    auto failures = compile_batch(inputs, options, jobs, cerr, compile);
+    return failures == 0 ? 0 : -1;
 }
@@ -1,5 +1,13 @@
 %require "3.0"
 
+%code requires {
+    #include "utils/parser.hpp"
+    #ifndef YY_TYPEDEF_YY_SCANNER_T
+    #define YY_TYPEDEF_YY_SCANNER_T
+    typedef void *yyscan_t;
+    #endif
+}
+
 %{
     #include <cstdio>
     #include <memory>
@@ -10,13 +18,14 @@
 
     using namespace spc;
 
-    int yylex();
-    int yyerror(const char *s);
-
-    YYSTYPE program;
+    int yylex(YYSTYPE *lvalp, yyscan_t scanner);
+    void yyerror(yyscan_t scanner, ParserState *state, const char *s);
 %}
 
-%define api.value.type {std::shared_ptr<spc::AbstractNode>}
+%define api.value.type {spc::AbstractNode *}
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {spc::ParserState *state}
 %define parse.error verbose
 %define parse.lac full
 
@@ -55,7 +64,7 @@
 %%
 
 export
-    : program { program = $1; }
+    : program { state->program = $1; }
     ;
 
 program
@@ -356,9 +365,7 @@ args_list
 
 %%
 
-extern int line_no;
-
-inline int yyerror(const char *s) {
-    fprintf(stderr, "Bison error at line %d: %s\n", line_no, s);
-    exit(-1);
+void yyerror(yyscan_t scanner, ParserState *state, const char *s) {
+    state->diagnostics << "Bison error at line " << state->line_no << ": " << s << std::endl;
+    ++state->errors;
 }
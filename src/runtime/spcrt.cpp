@@ -0,0 +1,470 @@
+/**
+ * @file spcrt.cpp
+ * @brief 运行时库的实现 只依赖C库与POSIX的read/write/mmap，可以单独编译为libspcrt.a与生成的目标文件链接
+ * @version 0.1
+ * @date 2021-06-22
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "spcrt.h"
+
+namespace
+{
+    /// 输出缓冲区的大小
+    constexpr size_t output_capacity = size_t(1) << 16;
+    /// printf("%f")输出一个double最多需要的字符数(最大的double有309位整数部分)
+    constexpr size_t max_real_length = 320;
+    /// 输入缓冲区的大小 标准输入不是普通文件时每次read()最多读入这么多
+    constexpr size_t input_capacity = size_t(1) << 16;
+    /// 交给strtod的实数最多保留的字符数
+    constexpr size_t max_real_token = 1024;
+
+    enum class Terminal
+    {
+        UNKNOWN, NO, YES
+    };
+
+    enum class InputMode
+    {
+        UNKNOWN, MAPPED, STREAM
+    };
+}
+
+/// Pascal程序是单线程的，缓冲区不加锁 全部成员初始为0，不占可执行文件的空间
+struct spc_state
+{
+    char output[output_capacity];
+    size_t output_size;
+    /// 标准输出是不是终端 第一次换行时检查
+    Terminal terminal;
+    char input_buffer[input_capacity];
+    /// 还没有解析的输入[input, input_end) 都为nullptr表示还没有读入
+    const char *input;
+    const char *input_end;
+    InputMode input_mode;
+    /// 与stdio相同，遇到文件结束后不再读入
+    bool input_eof;
+};
+
+spc_state spc_runtime_state;
+
+namespace
+{
+    /// 按成员的名字访问状态
+    auto &output = spc_runtime_state.output;
+    auto &output_size = spc_runtime_state.output_size;
+    auto &terminal = spc_runtime_state.terminal;
+    auto &input_buffer = spc_runtime_state.input_buffer;
+    auto &input = spc_runtime_state.input;
+    auto &input_end = spc_runtime_state.input_end;
+    auto &input_mode = spc_runtime_state.input_mode;
+    auto &input_eof = spc_runtime_state.input_eof;
+
+    const char digit_pairs[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+    void write_all(const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            auto written = ::write(STDOUT_FILENO, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR) continue;
+                return; //与stdio一样，写失败时丢弃输出
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    /// 保证缓冲区中还有size字节的空间(size不超过缓冲区大小)，返回写入的位置
+    inline char *reserve(size_t size)
+    {
+        if (output_size + size > output_capacity) spc_flush();
+        return output + output_size;
+    }
+
+    inline void append(const char *data, size_t size)
+    {
+        if (size > output_capacity)
+        {
+            spc_flush();
+            write_all(data, size);
+            return;
+        }
+        std::memcpy(reserve(size), data, size);
+        output_size += size;
+    }
+
+    /// 把value的十进制表示写在end之前，每次除以100查表得到两位，返回第一个字符的位置
+    inline char *format_unsigned(uint64_t value, char *end)
+    {
+        while (value >= 100)
+        {
+            auto pair = static_cast<size_t>(value % 100) * 2;
+            value /= 100;
+            *--end = digit_pairs[pair + 1];
+            *--end = digit_pairs[pair];
+        }
+        if (value >= 10)
+        {
+            auto pair = static_cast<size_t>(value) * 2;
+            *--end = digit_pairs[pair + 1];
+            *--end = digit_pairs[pair];
+        }
+        else *--end = static_cast<char>('0' + value);
+        return end;
+    }
+
+    /**
+     * @brief 小数部分fraction(0 <= fraction < 1)乘以10^6后按最近偶数舍入，与printf("%f")的结果相同.
+     * fraction = a * 2^(exponent - 53)，a < 2^53: exponent < -22时fraction < 2^-23 < 5e-7，舍入为0；
+     * 否则fraction恰好是M / 2^75，M < 2^75，用128位整数精确计算M * 10^6
+     */
+    inline uint64_t round_decimals(double fraction)
+    {
+        if (fraction == 0) return 0;
+        int exponent;
+        auto a = static_cast<uint64_t>(std::ldexp(std::frexp(fraction, &exponent), 53));
+        if (exponent < -22) return 0;
+        auto scaled = (static_cast<unsigned __int128>(a) << (exponent + 22)) * 1000000u;
+        auto decimals = static_cast<uint64_t>(scaled >> 75);
+        auto rest = scaled & ((static_cast<unsigned __int128>(1) << 75) - 1);
+        auto half = static_cast<unsigned __int128>(1) << 74;
+        if (rest > half || (rest == half && (decimals & 1) != 0)) ++decimals;
+        return decimals;
+    }
+
+    /// 输出了换行 与stdio的行缓冲相同，标准输出是终端时写出缓冲区，交互式程序逐行看到输出
+    inline void end_line()
+    {
+        if (terminal == Terminal::UNKNOWN) terminal = isatty(STDOUT_FILENO) ? Terminal::YES : Terminal::NO;
+        if (terminal == Terminal::YES) spc_flush();
+    }
+
+    /// 标准输入是普通文件时映射整个文件，从当前的文件位置开始解析 映射在程序结束前一直保留
+    bool map_input()
+    {
+        struct stat info;
+        if (fstat(STDIN_FILENO, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0) return false;
+        auto offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        if (offset < 0 || offset > info.st_size) return false;
+        auto size = static_cast<size_t>(info.st_size);
+        auto *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+        if (data == MAP_FAILED) return false;
+        input = static_cast<const char *>(data) + offset;
+        input_end = static_cast<const char *>(data) + size;
+        return true;
+    }
+
+    /// 缓冲区中的输入解析完时再读入 返回false表示文件结束
+    bool refill()
+    {
+        if (input_eof) return false;
+        if (input_mode == InputMode::UNKNOWN)
+        {
+            input_mode = map_input() ? InputMode::MAPPED : InputMode::STREAM;
+            if (input != input_end) return true;
+        }
+        if (input_mode == InputMode::MAPPED)
+        {
+            input_eof = true;
+            return false;
+        }
+        spc_flush(); //等待输入前先写出输出，交互式程序的提示才能看到
+        for (;;)
+        {
+            auto count = ::read(STDIN_FILENO, input_buffer, input_capacity);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0)
+            {
+                input_eof = true;
+                return false;
+            }
+            input = input_buffer;
+            input_end = input_buffer + count;
+            return true;
+        }
+    }
+
+    /// 下一个字符 文件结束时返回EOF
+    inline int peek()
+    {
+        return input != input_end || refill() ? static_cast<unsigned char>(*input) : EOF;
+    }
+
+    inline bool is_space(int c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    inline bool is_digit(int c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    inline bool is_alnum(int c)
+    {
+        return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    }
+
+    /// 跳过空白 返回之后的字符
+    inline int skip_space()
+    {
+        int c;
+        while (is_space(c = peek())) ++input;
+        return c;
+    }
+
+    /// 10^0到10^22都可以精确表示为double
+    const double exact_powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+}
+
+extern "C"
+{
+    void spc_write_int(int32_t value)
+    {
+        char text[16];
+        auto *end = text + sizeof(text);
+        auto magnitude = value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+        auto *begin = format_unsigned(magnitude, end);
+        if (value < 0) *--begin = '-';
+        append(begin, static_cast<size_t>(end - begin));
+    }
+
+    void spc_write_real(double value)
+    {
+        auto magnitude = std::fabs(value);
+        //2^53以上的数，无穷大与NaN很少见，交给snprintf
+        if (!(magnitude < 9007199254740992.0))
+        {
+            char text[max_real_length];
+            auto length = std::snprintf(text, sizeof(text), "%f", value);
+            if (length > 0) append(text, static_cast<size_t>(length));
+            return;
+        }
+        auto integral = static_cast<uint64_t>(magnitude);
+        auto decimals = round_decimals(magnitude - static_cast<double>(integral)); //整数部分小于2^53时相减是精确的
+        if (decimals == 1000000)
+        {
+            decimals = 0;
+            ++integral;
+        }
+        char text[32];
+        auto *end = text + sizeof(text);
+        auto *point = end - 7;
+        *point = '.';
+        for (int i = 6; i >= 1; --i)
+        {
+            point[i] = static_cast<char>('0' + decimals % 10);
+            decimals /= 10;
+        }
+        auto *begin = format_unsigned(integral, point);
+        if (std::signbit(value)) *--begin = '-'; //与printf相同，-0.0与舍入为0的负数也输出负号
+        append(begin, static_cast<size_t>(end - begin));
+    }
+
+    void spc_write_char(int8_t value)
+    {
+        *reserve(1) = static_cast<char>(value);
+        ++output_size;
+    }
+
+    void spc_write_str(const char *value)
+    {
+        append(value, std::strlen(value));
+    }
+
+    void spc_writeln()
+    {
+        *reserve(1) = '\n';
+        ++output_size;
+        end_line();
+    }
+
+    void spc_write_format(const char *format, const spc_arg *args)
+    {
+        //格式串都很短，扫描的同时把普通字符复制进缓冲区
+        auto *p = format;
+        for (;;)
+        {
+            auto *out = output + output_size;
+            auto *limit = output + output_capacity;
+            char c;
+            while ((c = *p) != '%' && c != '\0' && out != limit)
+            {
+                *out++ = c;
+                ++p;
+            }
+            output_size = static_cast<size_t>(out - output);
+            if (c == '\0')
+            {
+                if (p != format && p[-1] == '\n') end_line();
+                return;
+            }
+            if (out == limit)
+            {
+                spc_flush();
+                continue;
+            }
+            switch (*++p)
+            {
+                case 'd': spc_write_int(static_cast<int32_t>((args++)->i)); break;
+                case 'c': spc_write_char(static_cast<int8_t>((args++)->i)); break;
+                case 'f': spc_write_real((args++)->f); break;
+                case 's': spc_write_str((args++)->s); break;
+                default: spc_write_char('%'); break;
+            }
+            ++p;
+        }
+    }
+
+    void spc_flush()
+    {
+        write_all(output, output_size);
+        output_size = 0;
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    /// 与libspcrt静态链接的程序在exit()时(包括其他代码直接调用exit)写出剩下的输出 生成的main返回前已经写出过
+    __attribute__((destructor)) static void spc_flush_at_exit()
+    {
+        spc_flush();
+    }
+#endif
+
+    void spc_read_int(int32_t *value)
+    {
+        auto c = skip_space();
+        auto negative = c == '-';
+        if (c == '-' || c == '+')
+        {
+            ++input;
+            c = peek();
+        }
+        if (!is_digit(c)) return;
+        //与scanf相同，先按64位整数转换(超出范围时取最小值或最大值)，再截断为32位
+        uint64_t magnitude = 0;
+        auto limit = static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + (negative ? 1 : 0);
+        do
+        {
+            auto digit = static_cast<uint64_t>(c - '0');
+            magnitude = magnitude <= (limit - digit) / 10 ? magnitude * 10 + digit : limit;
+            ++input;
+        } while (is_digit(c = peek()));
+        *value = static_cast<int32_t>(negative ? 0 - magnitude : magnitude);
+    }
+
+    void spc_read_real(double *value)
+    {
+        auto c = skip_space();
+        char token[max_real_token + 1];
+        size_t length = 0;
+        auto keep = [&]() {
+            if (length < max_real_token) token[length++] = static_cast<char>(c);
+            ++input;
+            c = peek();
+        };
+        auto negative = c == '-';
+        if (c == '-' || c == '+') keep();
+        if (!is_digit(c) && c != '.')
+        {
+            //inf与nan很少见，连续的字母数字交给strtod
+            if (c != 'i' && c != 'I' && c != 'n' && c != 'N') return;
+            while (is_alnum(c)) keep();
+            token[length] = '\0';
+            char *end;
+            auto result = std::strtod(token, &end);
+            if (end != token && is_alnum(static_cast<unsigned char>(end[-1]))) *value = result;
+            return;
+        }
+
+        //最多19位有效数字的尾数
+        uint64_t mantissa = 0;
+        int significant = 0, exponent = 0;
+        auto digits = false;
+        auto digit = [&](bool fraction) {
+            digits = true;
+            if (mantissa != 0 || c != '0')
+            {
+                if (++significant <= 19) mantissa = mantissa * 10 + static_cast<uint64_t>(c - '0');
+                else if (!fraction) ++exponent;
+            }
+            if (fraction && significant <= 19) --exponent;
+            keep();
+        };
+        while (is_digit(c)) digit(false);
+        if (c == '.')
+        {
+            keep();
+            while (is_digit(c)) digit(true);
+        }
+        if (!digits) return;
+        if (c == 'e' || c == 'E')
+        {
+            keep();
+            auto exponent_negative = c == '-';
+            if (c == '-' || c == '+') keep();
+            int written = 0;
+            while (is_digit(c))
+            {
+                if (written < 100000) written = written * 10 + (c - '0');
+                keep();
+            }
+            exponent += exponent_negative ? -written : written;
+        }
+
+        //尾数不超过2^53且10的幂可以精确表示时，一次乘法或除法就是正确舍入的结果；否则交给strtod
+        double result;
+        if (significant <= 19 && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+        {
+            auto scaled = static_cast<double>(mantissa);
+            result = exponent < 0 ? scaled / exact_powers[-exponent] : scaled * exact_powers[exponent];
+            if (negative) result = -result;
+        }
+        else
+        {
+            token[length] = '\0';
+            result = std::strtod(token, nullptr);
+        }
+        *value = result;
+    }
+
+    void spc_read_char(int8_t *value)
+    {
+        auto c = peek();
+        if (c == EOF) return;
+        ++input;
+        *value = static_cast<int8_t>(c);
+    }
+
+    void spc_readln()
+    {
+        for (;;)
+        {
+            if (input == input_end && !refill()) return;
+            auto *newline = static_cast<const char *>(std::memchr(input, '\n', static_cast<size_t>(input_end - input)));
+            if (newline != nullptr)
+            {
+                input = newline + 1;
+                return;
+            }
+            input = input_end;
+        }
+    }
+}
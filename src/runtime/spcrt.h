@@ -0,0 +1,65 @@
+/**
+ * @file spcrt.h
+ * @brief Pascal程序的运行时库(libspcrt). 生成的代码与字节码解释器都调用这里按类型特化的输入输出函数，
+ * 不再每个参数调用一次printf/scanf解析格式串；输出先写进进程内的大缓冲区，满了、等待输入或程序结束时才写到标准输出，
+ * 输入从大缓冲区中解析，标准输入是普通文件时直接映射整个文件
+ * @version 0.1
+ * @date 2021-06-22
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_SPCRT_H
+#define NAIVE_PASCAL_COMPILER_SPCRT_H
+
+#include <cstdint>
+
+extern "C"
+{
+    /// 运行时库的全部状态(输入输出缓冲区) 内联进生成代码的运行时函数(见driver/runtime_bitcode.h)也读写这一份
+    struct spc_state;
+    extern spc_state spc_runtime_state;
+
+    /// spc_write_format的一个参数 整数与字符在i中，实数在f中，字符串在s中
+    union spc_arg
+    {
+        int64_t i;
+        double f;
+        const char *s;
+    };
+
+    /// 输出一个整数 与printf("%d")相同，布尔值按0或1输出
+    void spc_write_int(int32_t value);
+    /// 输出一个实数 与printf("%f")相同
+    void spc_write_real(double value);
+    /// 输出一个字符
+    void spc_write_char(int8_t value);
+    /// 输出以'\0'结尾的字符串 不解释其中的'%'
+    void spc_write_str(const char *value);
+    /// 输出换行 标准输出是终端时同时写出缓冲区
+    void spc_writeln();
+    /**
+     * 一次输出一条write/writeln语句 format中的普通字符原样输出，"%d"，"%c"，"%f"，"%s"依次取args中的一个参数，
+     * 与对应的spc_write_int，spc_write_char，spc_write_real，spc_write_str相同，"%%"输出'%'；
+     * format以换行结尾时与spc_writeln一样，标准输出是终端时写出缓冲区
+     */
+    void spc_write_format(const char *format, const spc_arg *args);
+    /// 把缓冲区中的输出写到标准输出 生成的main返回前调用，libspcrt在程序退出时也会调用
+    void spc_flush();
+
+    /// 与scanf("%d")相同: 跳过空白后读入一个整数，失败或文件结束时*value不变
+    void spc_read_int(int32_t *value);
+    /// 与scanf("%lf")相同: 跳过空白后读入一个实数，失败或文件结束时*value不变
+    void spc_read_real(double *value);
+    /// 与scanf("%c")相同: 读入下一个字符(包括空白)，文件结束时*value不变
+    void spc_read_char(int8_t *value);
+    /// 跳过本行剩余的字符与换行符
+    void spc_readln();
+}
+
+/// 运行时库的全部函数与全局变量 X(名字) 的形式，JIT按名字把它们定义为本进程中的地址
+#define SPC_RUNTIME_SYMBOLS(X) \
+    X(spc_write_int) X(spc_write_real) X(spc_write_char) X(spc_write_str) X(spc_writeln) X(spc_write_format) X(spc_flush) \
+    X(spc_read_int) X(spc_read_real) X(spc_read_char) X(spc_readln) X(spc_runtime_state)
+
+#endif //NAIVE_PASCAL_COMPILER_SPCRT_H
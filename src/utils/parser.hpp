@@ -0,0 +1,65 @@
+/**
+ * @file parser.hpp
+ * @brief 语法分析入口. 词法分析器与语法分析器都是可重入的，状态全部放在ParserState里，
+ * 所以不同线程可以同时分析不同的源文件
+ * @version 0.1
+ * @date 2021-06-09
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_PARSER_HPP
+#define NAIVE_PASCAL_COMPILER_PARSER_HPP
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include "ast/ast_base.h"
+
+namespace spc
+{
+    /**
+     * @brief 一次语法分析的状态 由flex的yyextra与bison的parse-param共享
+     *
+     */
+    struct ParserState
+    {
+        /**
+         * @brief Construct a new Parser State object
+         *
+         * @param arena 语法树节点与标识符分配在这里
+         * @param diagnostics 词法/语法错误输出到这里
+         */
+        explicit ParserState(NodeArena &arena, std::ostream &diagnostics = std::cerr)
+                : arena(arena), diagnostics(diagnostics)
+        {}
+
+        NodeArena &arena;
+        std::ostream &diagnostics;
+        /// 当前行号
+        int line_no = 1;
+        /// 已报告的错误数量
+        int errors = 0;
+        /// 语法树根节点 分析成功后才有效
+        AbstractNode *program = nullptr;
+    };
+
+    /**
+     * @brief 分析一个已打开的源文件
+     *
+     * @param in 源文件
+     * @param state 本次分析的状态
+     * @return AbstractNode* 语法树根节点(ProgramNode) 有错误时返回nullptr
+     */
+    AbstractNode *parse(std::FILE *in, ParserState &state);
+    /**
+     * @brief 分析内存中的源代码
+     *
+     * @param source 源代码
+     * @param state 本次分析的状态
+     * @return AbstractNode* 语法树根节点(ProgramNode) 有错误时返回nullptr
+     */
+    AbstractNode *parse(const std::string &source, ParserState &state);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_PARSER_HPP
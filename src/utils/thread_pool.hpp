@@ -0,0 +1,54 @@
+/**
+ * @file thread_pool.hpp
+ * @brief 简单的工作线程池. 任务按编号从一个共享计数器中领取，所以各线程的负载会自动均衡
+ * @version 0.1
+ * @date 2021-06-10
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_THREAD_POOL_HPP
+#define NAIVE_PASCAL_COMPILER_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace spc
+{
+    /**
+     * @brief 返回默认的工作线程数量(硬件线程数)
+     *
+     * @return unsigned 至少为1
+     */
+    inline unsigned default_jobs()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    /**
+     * @brief 用jobs个线程(包括调用者自己)执行task(0) ... task(count - 1) 所有任务完成后才返回
+     *
+     * @tparam Task 形如void(size_t)的可调用对象 它必须自己处理异常
+     * @param jobs 线程数量
+     * @param count 任务数量
+     * @param task 任务
+     */
+    template<typename Task>
+    void parallel_for(unsigned jobs, size_t count, Task &&task)
+    {
+        std::atomic<size_t> next{0};
+        auto worker = [&] {
+            for (size_t i = next++; i < count; i = next++) task(i);
+        };
+        jobs = static_cast<unsigned>(std::min<size_t>(std::max(1u, jobs), count));
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < jobs; ++i) threads.emplace_back(worker);
+        worker();
+        for (auto &thread : threads) thread.join();
+    }
+}
+
+#endif //NAIVE_PASCAL_COMPILER_THREAD_POOL_HPP
@@ -0,0 +1,153 @@
+/**
+ * @file bytecode.h
+ * @brief 解释执行用的字节码. 基于寄存器: 每条指令8字节，操作数a，b，c是当前栈帧中的寄存器编号，
+ * 或者由b与c拼成的32位立即数(wide)
+ *
+ * 栈帧的前面是寄存器: 参数，返回值(函数名对应的变量)，标量局部变量，最后是表达式的临时值；
+ * 寄存器之后是局部数组与记录的存储区. 全局变量放在单独的全局存储区中，按字节偏移访问，
+ * 布局与LLVM生成的全局变量相同(boolean与char占1字节，integer占4字节，real占8字节，按自身大小对齐)，
+ * 分层执行时编译出的本地代码直接读写同一份全局变量
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_BYTECODE_H
+#define NAIVE_PASCAL_COMPILER_BYTECODE_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace spc
+{
+    /**
+     * @brief 所有指令 X(名字) 的形式方便生成枚举与跳转表
+     * 整数运算按32位回绕，布尔值是0或1，字符是符号扩展的8位整数(与LLVM生成的i8一致)
+     */
+#define SPC_VM_OPCODES(X) \
+    X(MOVE)    /* a = b */ \
+    X(LOADI)   /* a = wide(32位有符号立即数) */ \
+    X(LOADK)   /* a = 常量表[wide] */ \
+    X(GETGC) X(GETGI) X(GETGF) /* a = 全局存储中偏移wide处的boolean或char，integer，real */ \
+    X(SETGC) X(SETGI) X(SETGF) /* 全局存储中偏移wide处的boolean或char，integer，real = a */ \
+    X(GETL)    /* a = 局部存储[wide] */ \
+    X(SETL)    /* 局部存储[wide] = a */ \
+    X(LDGAC) X(LDGAI) X(LDGAF) /* a = 全局数组b[c] 按元素类型区分 */ \
+    X(STGAC) X(STGAI) X(STGAF) /* 全局数组b[c] = a */ \
+    X(LDLA)    /* a = 局部数组b[c] */ \
+    X(STLA)    /* 局部数组b[c] = a */ \
+    X(I2F)     /* a = (real)b */ \
+    X(ADDI) X(SUBI) X(MULI) X(DIVI) X(MODI) X(AND) X(OR) X(XOR) /* a = b op c */ \
+    X(ADDIK) X(SUBIK) /* a = b op (int16)c */ \
+    X(ADDF) X(SUBF) X(MULF) X(DIVF) \
+    X(EQI) X(NEI) X(LTI) X(LEI) X(GTI) X(GEI) \
+    X(EQF) X(NEF) X(LTF) X(LEF) X(GTF) X(GEF) \
+    X(JMP)     /* 跳转到wide */ \
+    X(JMPF)    /* a为假时跳转到wide */ \
+    X(LOOP)    /* 循环回边: 跳转到wide，并计入当前函数的热度 */ \
+    X(LOOPF)   /* 循环回边: a为假时跳转到wide，并计入当前函数的热度 */ \
+    X(SWITCH)  /* 按分支表b跳转 */ \
+    X(CALL)    /* a = 函数b(从寄存器c开始的参数) */ \
+    X(RET)     /* 返回a */ \
+    X(RETV)    /* 无返回值 */ \
+    X(ABSI) X(ABSF) X(SQRTF) X(CHR) X(ORD) X(PRED) X(SUCC) /* a = f(b) */ \
+    X(SQRI) X(SQRF) X(SINF) X(COSF) X(ATANF) X(EXPF) X(LNF) X(ROUNDF) X(TRUNCF) X(ODD) \
+    X(WRITEI) X(WRITEC) X(WRITEF) /* 输出a */ \
+    X(WRITES)  /* 输出字符串常量wide */ \
+    X(WRITELN) \
+    X(READI) X(READC) X(READF) /* 读入a 失败时a不变 */ \
+    X(READLN)
+
+    enum class Opcode : uint8_t
+    {
+#define SPC_VM_OPCODE_ENUM(name) name,
+        SPC_VM_OPCODES(SPC_VM_OPCODE_ENUM)
+#undef SPC_VM_OPCODE_ENUM
+    };
+
+    /// 一条指令
+    struct Instruction
+    {
+        Opcode op;
+        uint8_t unused = 0;
+        uint16_t a = 0;
+        uint16_t b = 0;
+        uint16_t c = 0;
+
+        /// b与c拼成的32位操作数(跳转目标，全局下标，常量编号等)
+        uint32_t wide() const noexcept
+        { return b | static_cast<uint32_t>(c) << 16; }
+
+        void set_wide(uint32_t value) noexcept
+        {
+            b = static_cast<uint16_t>(value);
+            c = static_cast<uint16_t>(value >> 16);
+        }
+    };
+    static_assert(sizeof(Instruction) == 8, "instructions should stay compact");
+
+    /// 寄存器与存储区中的一个值 integer，boolean，char用i，real用f
+    union VmValue
+    {
+        int64_t i;
+        double f;
+    };
+
+    /// 数组变量的位置 存储区中从offset开始连续存放length个元素
+    struct ArraySlot
+    {
+        /// 全局数组是全局存储区中的字节偏移，局部数组是局部存储区中的下标
+        uint32_t offset;
+        int32_t low;
+        uint32_t length;
+    };
+
+    /// case语句的分支表 按值排好序
+    struct CaseTable
+    {
+        std::vector<std::pair<int64_t, uint32_t>> targets;
+        /// 没有匹配的分支时跳转到这里
+        uint32_t otherwise = 0;
+    };
+
+    /// 一个子过程(或主程序)的字节码
+    struct BytecodeFunction
+    {
+        std::string name;
+        /// 参数数量 参数依次在0号寄存器开始
+        uint16_t params = 0;
+        /// 寄存器数量
+        uint16_t registers = 0;
+        /// 整个栈帧的大小 寄存器加上局部数组与记录
+        uint32_t frame_size = 0;
+        std::vector<Instruction> code;
+        std::vector<VmValue> constants;
+        std::vector<ArraySlot> arrays;
+        std::vector<CaseTable> cases;
+    };
+
+    /// 全局变量的名字与它在全局存储区中的字节偏移 名字与代码生成中的LLVM全局变量相同
+    struct GlobalSymbol
+    {
+        std::string name;
+        uint32_t offset;
+    };
+
+    /// 整个程序的字节码
+    struct BytecodeProgram
+    {
+        std::vector<BytecodeFunction> functions;
+        /// 主程序在functions中的下标
+        uint32_t main = 0;
+        /// 全局存储区的初值
+        std::vector<uint8_t> globals;
+        std::vector<GlobalSymbol> symbols;
+        /// write输出的字符串常量
+        std::vector<std::string> strings;
+    };
+}
+
+#endif //NAIVE_PASCAL_COMPILER_BYTECODE_H
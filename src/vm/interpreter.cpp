@@ -0,0 +1,368 @@
+/**
+ * @file interpreter.cpp
+ * @brief 字节码解释器的实现
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "runtime/spcrt.h"
+#include "interpreter.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SPC_VM_THREADED_DISPATCH 1
+#endif
+
+namespace spc
+{
+    namespace
+    {
+        /// 值栈的大小(VmValue个数) 只是保留地址空间，用到时才真正分配内存
+        constexpr size_t stack_size = size_t(1) << 23;
+
+        /// 调用者的状态 返回时恢复
+        struct CallFrame
+        {
+            const BytecodeFunction *function;
+            const Instruction *pc;
+            VmValue *registers;
+        };
+
+        /// 按32位整数回绕
+        inline int64_t wrap(uint32_t value)
+        {
+            return static_cast<int32_t>(value);
+        }
+
+        inline uint32_t u32(int64_t value)
+        {
+            return static_cast<uint32_t>(value);
+        }
+
+        /// 按T读取全局存储区中的值 boolean与char按有符号8位整数读取
+        template<typename T>
+        inline T load(const uint8_t *address)
+        {
+            T value;
+            std::memcpy(&value, address, sizeof(T));
+            return value;
+        }
+
+        template<typename T>
+        inline void store(uint8_t *address, T value)
+        {
+            std::memcpy(address, &value, sizeof(T));
+        }
+    }
+
+    int interpret(const BytecodeProgram &program, std::ostream &diagnostics, NativeTier *tier, uint32_t threshold)
+    {
+        std::unique_ptr<VmValue[]> stack(new VmValue[stack_size]);
+        //按max_align_t分配，保证每个全局变量的16字节对齐
+        auto global_words = (program.globals.size() + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+        std::unique_ptr<std::max_align_t[]> global_memory(new std::max_align_t[std::max<size_t>(global_words, 1)]);
+        std::memcpy(global_memory.get(), program.globals.data(), program.globals.size());
+        std::vector<CallFrame> frames;
+        const char *error = nullptr;
+
+        auto *const functions = program.functions.data();
+        auto *const globals = reinterpret_cast<uint8_t *>(global_memory.get());
+        VmValue *const stack_end = stack.get() + stack_size;
+
+        //分层执行: 每个函数的热度(调用次数加循环回边次数)与本地代码入口
+        if (tier == nullptr) threshold = 0; //计数回绕到0之前不会达到
+        std::vector<uint32_t> hotness(program.functions.size(), 0);
+        std::vector<NativeEntry> entries(program.functions.size(), nullptr);
+        auto tier_up = [&](uint32_t index) {
+            if (entries[index] != nullptr) return true;
+            if (tier == nullptr || index == program.main) return false; //主程序不是子过程，总是解释执行
+            return tier->compile(index, globals, entries) && entries[index] != nullptr;
+        };
+
+        //当前函数的状态
+        const BytecodeFunction *function;
+        const Instruction *code;
+        const Instruction *pc;
+        const VmValue *constants;
+        const ArraySlot *arrays;
+        VmValue *regs;
+        VmValue *locals; //寄存器之后的局部数组与记录
+        uint32_t *heat;
+
+        auto enter = [&](const BytecodeFunction *callee, VmValue *base) {
+            function = callee;
+            heat = &hotness[callee - functions];
+            code = callee->code.data();
+            constants = callee->constants.data();
+            arrays = callee->arrays.data();
+            regs = base;
+            locals = base + callee->registers;
+        };
+
+        const auto &main = functions[program.main];
+        if (main.frame_size > stack_size)
+        {
+            diagnostics << "runtime error: stack overflow" << std::endl;
+            return -1;
+        }
+        std::fill(stack.get(), stack.get() + main.frame_size, VmValue{0});
+        enter(&main, stack.get());
+        pc = code;
+
+#define A (pc->a)
+#define B (pc->b)
+#define C (pc->c)
+#define RA (regs[pc->a])
+#define RB (regs[pc->b])
+#define RC (regs[pc->c])
+#define FAIL(message) do { error = message; goto fail; } while (false)
+
+#ifdef SPC_VM_THREADED_DISPATCH
+#define SPC_VM_LABEL(name) &&op_##name,
+        static const void *const dispatch_table[] = {SPC_VM_OPCODES(SPC_VM_LABEL)};
+#undef SPC_VM_LABEL
+#define CASE(name) op_##name:
+#define DISPATCH() goto *dispatch_table[static_cast<uint8_t>(pc->op)]
+        DISPATCH();
+#else
+#define CASE(name) case Opcode::name:
+#define DISPATCH() goto dispatch
+        dispatch:
+        switch (pc->op)
+        {
+#endif
+#define NEXT() do { ++pc; DISPATCH(); } while (false)
+
+        CASE(MOVE) RA = RB; NEXT();
+        CASE(LOADI) RA.i = static_cast<int32_t>(pc->wide()); NEXT();
+        CASE(LOADK) RA = constants[pc->wide()]; NEXT();
+        CASE(GETGC) RA.i = load<int8_t>(globals + pc->wide()); NEXT();
+        CASE(GETGI) RA.i = load<int32_t>(globals + pc->wide()); NEXT();
+        CASE(GETGF) RA.f = load<double>(globals + pc->wide()); NEXT();
+        CASE(SETGC) store(globals + pc->wide(), static_cast<int8_t>(RA.i)); NEXT();
+        CASE(SETGI) store(globals + pc->wide(), static_cast<int32_t>(RA.i)); NEXT();
+        CASE(SETGF) store(globals + pc->wide(), RA.f); NEXT();
+        CASE(GETL) RA = locals[pc->wide()]; NEXT();
+        CASE(SETL) locals[pc->wide()] = RA; NEXT();
+#define GLOBAL_ELEMENT(T) \
+        const auto &array = arrays[B]; \
+        auto index = static_cast<uint64_t>(RC.i - array.low); \
+        if (index >= array.length) FAIL("array index out of range"); \
+        auto *element = globals + array.offset + index * sizeof(T)
+
+        CASE(LDGAC) { GLOBAL_ELEMENT(int8_t); RA.i = load<int8_t>(element); NEXT(); }
+        CASE(LDGAI) { GLOBAL_ELEMENT(int32_t); RA.i = load<int32_t>(element); NEXT(); }
+        CASE(LDGAF) { GLOBAL_ELEMENT(double); RA.f = load<double>(element); NEXT(); }
+        CASE(STGAC) { GLOBAL_ELEMENT(int8_t); store(element, static_cast<int8_t>(RA.i)); NEXT(); }
+        CASE(STGAI) { GLOBAL_ELEMENT(int32_t); store(element, static_cast<int32_t>(RA.i)); NEXT(); }
+        CASE(STGAF) { GLOBAL_ELEMENT(double); store(element, RA.f); NEXT(); }
+#undef GLOBAL_ELEMENT
+        CASE(LDLA)
+        {
+            const auto &array = arrays[B];
+            auto index = static_cast<uint64_t>(RC.i - array.low);
+            if (index >= array.length) FAIL("array index out of range");
+            RA = locals[array.offset + index];
+            NEXT();
+        }
+        CASE(STLA)
+        {
+            const auto &array = arrays[B];
+            auto index = static_cast<uint64_t>(RC.i - array.low);
+            if (index >= array.length) FAIL("array index out of range");
+            locals[array.offset + index] = RA;
+            NEXT();
+        }
+        CASE(I2F) RA.f = static_cast<double>(RB.i); NEXT();
+
+        CASE(ADDI) RA.i = wrap(u32(RB.i) + u32(RC.i)); NEXT();
+        CASE(SUBI) RA.i = wrap(u32(RB.i) - u32(RC.i)); NEXT();
+        CASE(MULI) RA.i = wrap(u32(RB.i) * u32(RC.i)); NEXT();
+        CASE(DIVI)
+        {
+            if (RC.i == 0) FAIL("division by zero");
+            if (RB.i == std::numeric_limits<int32_t>::min() && RC.i == -1) FAIL("integer overflow in division");
+            RA.i = RB.i / RC.i;
+            NEXT();
+        }
+        CASE(MODI)
+        {
+            if (RC.i == 0) FAIL("division by zero");
+            if (RB.i == std::numeric_limits<int32_t>::min() && RC.i == -1) FAIL("integer overflow in division");
+            RA.i = RB.i % RC.i;
+            NEXT();
+        }
+        CASE(AND) RA.i = RB.i & RC.i; NEXT();
+        CASE(OR) RA.i = RB.i | RC.i; NEXT();
+        CASE(XOR) RA.i = RB.i ^ RC.i; NEXT();
+        CASE(ADDIK) RA.i = wrap(u32(RB.i) + u32(static_cast<int16_t>(C))); NEXT();
+        CASE(SUBIK) RA.i = wrap(u32(RB.i) - u32(static_cast<int16_t>(C))); NEXT();
+
+        CASE(ADDF) RA.f = RB.f + RC.f; NEXT();
+        CASE(SUBF) RA.f = RB.f - RC.f; NEXT();
+        CASE(MULF) RA.f = RB.f * RC.f; NEXT();
+        CASE(DIVF) RA.f = RB.f / RC.f; NEXT();
+
+        CASE(EQI) RA.i = RB.i == RC.i; NEXT();
+        CASE(NEI) RA.i = RB.i != RC.i; NEXT();
+        CASE(LTI) RA.i = RB.i < RC.i; NEXT();
+        CASE(LEI) RA.i = RB.i <= RC.i; NEXT();
+        CASE(GTI) RA.i = RB.i > RC.i; NEXT();
+        CASE(GEI) RA.i = RB.i >= RC.i; NEXT();
+        CASE(EQF) RA.i = RB.f == RC.f; NEXT();
+        CASE(NEF) RA.i = RB.f < RC.f || RB.f > RC.f; NEXT(); //有序比较 与LLVM的fcmp one一致
+        CASE(LTF) RA.i = RB.f < RC.f; NEXT();
+        CASE(LEF) RA.i = RB.f <= RC.f; NEXT();
+        CASE(GTF) RA.i = RB.f > RC.f; NEXT();
+        CASE(GEF) RA.i = RB.f >= RC.f; NEXT();
+
+        CASE(JMP) pc = code + pc->wide(); DISPATCH();
+        CASE(JMPF)
+        {
+            if (RA.i) ++pc;
+            else pc = code + pc->wide();
+            DISPATCH();
+        }
+        //循环回边 热度达到阈值时编译当前函数，本次调用仍然解释执行，之后的调用执行本地代码
+        CASE(LOOP)
+        {
+            if (++*heat == threshold) tier_up(static_cast<uint32_t>(function - functions));
+            pc = code + pc->wide();
+            DISPATCH();
+        }
+        CASE(LOOPF)
+        {
+            if (RA.i)
+            {
+                ++pc;
+                DISPATCH();
+            }
+            if (++*heat == threshold) tier_up(static_cast<uint32_t>(function - functions));
+            pc = code + pc->wide();
+            DISPATCH();
+        }
+        CASE(SWITCH)
+        {
+            const auto &table = function->cases[B];
+            auto value = RA.i;
+            auto it = std::lower_bound(table.targets.begin(), table.targets.end(), value,
+                                       [](const std::pair<int64_t, uint32_t> &entry, int64_t key) {
+                                           return entry.first < key;
+                                       });
+            pc = code + (it != table.targets.end() && it->first == value ? it->second : table.otherwise);
+            DISPATCH();
+        }
+        CASE(CALL)
+        {
+            //已经编译的函数直接调用本地代码 参数与返回值都是寄存器中的值
+            if (auto entry = entries[B])
+            {
+                entry(regs + C, &RA);
+                NEXT();
+            }
+            if (++hotness[B] == threshold && tier_up(B))
+            {
+                entries[B](regs + C, &RA);
+                NEXT();
+            }
+            const auto *callee = &functions[B];
+            auto *base = regs + function->frame_size;
+            if (static_cast<size_t>(stack_end - base) < callee->frame_size) FAIL("stack overflow");
+            std::copy(regs + C, regs + C + callee->params, base);
+            std::fill(base + callee->params, base + callee->frame_size, VmValue{0});
+            frames.push_back(CallFrame{function, pc, regs});
+            enter(callee, base);
+            pc = code;
+            DISPATCH();
+        }
+        CASE(RET)
+        {
+            auto result = RA;
+            if (frames.empty()) return static_cast<int>(result.i);
+            auto frame = frames.back();
+            frames.pop_back();
+            enter(frame.function, frame.registers);
+            pc = frame.pc;
+            RA = result;
+            NEXT();
+        }
+        CASE(RETV)
+        {
+            if (frames.empty()) return 0;
+            auto frame = frames.back();
+            frames.pop_back();
+            enter(frame.function, frame.registers);
+            pc = frame.pc;
+            NEXT();
+        }
+
+        CASE(ABSI) RA.i = RB.i < 0 ? wrap(0u - u32(RB.i)) : RB.i; NEXT();
+        CASE(ABSF) RA.f = std::fabs(RB.f); NEXT();
+        CASE(SQRTF) RA.f = std::sqrt(RB.f); NEXT();
+        CASE(CHR) RA.i = static_cast<int8_t>(RB.i); NEXT();
+        CASE(ORD) RA.i = RB.i & 0xff; NEXT();
+        CASE(PRED) RA.i = static_cast<int8_t>(RB.i - 1); NEXT();
+        CASE(SUCC) RA.i = static_cast<int8_t>(RB.i + 1); NEXT();
+        CASE(SQRI) RA.i = wrap(u32(RB.i) * u32(RB.i)); NEXT();
+        CASE(SQRF) RA.f = RB.f * RB.f; NEXT();
+        CASE(SINF) RA.f = std::sin(RB.f); NEXT();
+        CASE(COSF) RA.f = std::cos(RB.f); NEXT();
+        CASE(ATANF) RA.f = std::atan(RB.f); NEXT();
+        CASE(EXPF) RA.f = std::exp(RB.f); NEXT();
+        CASE(LNF) RA.f = std::log(RB.f); NEXT();
+        CASE(ROUNDF) RA.i = static_cast<int32_t>(std::round(RB.f)); NEXT();
+        CASE(TRUNCF) RA.i = static_cast<int32_t>(RB.f); NEXT();
+        CASE(ODD) RA.i = RB.i & 1; NEXT();
+
+        //与生成的代码使用同一个运行时库，分层执行时解释器与本地代码共用输入输出缓冲区
+        CASE(WRITEI) spc_write_int(static_cast<int32_t>(RA.i)); NEXT();
+        CASE(WRITEC) spc_write_char(static_cast<int8_t>(RA.i)); NEXT();
+        CASE(WRITEF) spc_write_real(RA.f); NEXT();
+        CASE(WRITES) spc_write_str(program.strings[pc->wide()].c_str()); NEXT();
+        CASE(WRITELN) spc_writeln(); NEXT();
+        CASE(READI)
+        {
+            auto value = static_cast<int32_t>(RA.i);
+            spc_read_int(&value);
+            RA.i = value;
+            NEXT();
+        }
+        CASE(READC)
+        {
+            auto value = static_cast<int8_t>(RA.i);
+            spc_read_char(&value);
+            RA.i = value;
+            NEXT();
+        }
+        CASE(READF) spc_read_real(&RA.f); NEXT();
+        CASE(READLN) spc_readln(); NEXT();
+
+#ifndef SPC_VM_THREADED_DISPATCH
+        }
+#endif
+#undef NEXT
+#undef DISPATCH
+#undef CASE
+#undef FAIL
+#undef RC
+#undef RB
+#undef RA
+#undef C
+#undef B
+#undef A
+
+        fail:
+        spc_flush();
+        diagnostics << "runtime error: " << error << " in " << function->name << std::endl;
+        return -1;
+    }
+}
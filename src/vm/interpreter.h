@@ -0,0 +1,56 @@
+/**
+ * @file interpreter.h
+ * @brief 字节码解释器. GCC与Clang下用computed goto做线程化分派(每条指令的处理代码末尾直接跳到下一条指令)，
+ * 其他编译器退回到switch分派
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_INTERPRETER_H
+#define NAIVE_PASCAL_COMPILER_INTERPRETER_H
+
+#include <iostream>
+#include <vector>
+#include "bytecode.h"
+
+namespace spc
+{
+    /// 编译出的本地代码的入口 参数与返回值都按寄存器中的表示(VmValue)传递
+    using NativeEntry = void (*)(const VmValue *args, VmValue *result);
+
+    /**
+     * @brief 分层执行的第二层. 解释器统计每个子过程的调用次数与循环回边次数，
+     * 达到阈值时请求把它编译成本地代码，之后对它的调用都直接执行本地代码
+     */
+    class NativeTier
+    {
+    public:
+        virtual ~NativeTier() = default;
+
+        /**
+         * @brief 编译一个子过程 它调用的子过程也要一起编译，本地代码不会再回到解释器
+         *
+         * @param function 子过程在BytecodeProgram::functions中的下标
+         * @param globals 解释器的全局存储区 本地代码直接读写其中的全局变量
+         * @param entries 每个函数的本地代码入口 把编译好的函数的入口填到这里
+         * @return true 成功 失败时这个子过程继续解释执行
+         */
+        virtual bool compile(uint32_t function, uint8_t *globals, std::vector<NativeEntry> &entries) = 0;
+    };
+
+    /**
+     * @brief 执行字节码程序
+     *
+     * @param program 字节码
+     * @param diagnostics 运行时错误(除以零，数组越界，栈溢出)输出到这里
+     * @param tier 不为空时分层执行，热点子过程交给它编译
+     * @param threshold 子过程的调用次数与循环回边次数之和达到这个值时编译它
+     * @return int 主程序的返回值 发生运行时错误时返回-1
+     */
+    int interpret(const BytecodeProgram &program, std::ostream &diagnostics, NativeTier *tier = nullptr,
+                  uint32_t threshold = 0);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_INTERPRETER_H
@@ -0,0 +1,1103 @@
+/**
+ * @file lowering.cpp
+ * @brief 语法树到字节码的翻译
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <llvm/ADT/DenseMap.h>
+#include "utils/ast.hpp"
+#include "codegen/codegen_context.hpp"
+#include "lowering.h"
+
+namespace spc
+{
+    namespace
+    {
+        /// node是TNode时返回转换后的指针，否则返回nullptr
+        template<typename TNode>
+        TNode *node_as(AbstractNode *node)
+        {
+            return is_a_ptr_of<TNode>(node) ? static_cast<TNode *>(node) : nullptr;
+        }
+
+        bool is_scalar(Type type)
+        {
+            return type == Type::BOOLEAN || type == Type::INTEGER || type == Type::REAL || type == Type::CHAR;
+        }
+
+        /// 标量在全局存储区中的大小 与LLVM的i1，i8，i32，double相同
+        uint32_t scalar_size(Type type)
+        {
+            switch (type)
+            {
+                case Type::INTEGER: return 4;
+                case Type::REAL: return 8;
+                default: return 1;
+            }
+        }
+
+        /// 全局存储区的访问指令在X-macro中按boolean或char，integer，real的顺序排列
+        Opcode typed(Opcode first, Type type)
+        {
+            auto kind = type == Type::INTEGER ? 1 : type == Type::REAL ? 2 : 0;
+            return static_cast<Opcode>(static_cast<uint8_t>(first) + kind);
+        }
+
+        uint32_t align_to(uint32_t value, uint32_t align)
+        {
+            return (value + align - 1) / align * align;
+        }
+
+        /// 每个全局变量都按16字节对齐 本地代码可能按更大的对齐访问数组
+        constexpr uint32_t global_alignment = 16;
+
+        /// 一个变量 局部的标量在寄存器中，其他变量在全局或局部存储区中
+        struct Variable
+        {
+            /// 已展开别名的类型
+            TypeNode *type;
+            bool global;
+            bool in_register;
+            /// 寄存器编号，全局存储区的字节偏移或局部存储区下标
+            uint32_t offset;
+        };
+
+        /// 类型在全局存储区中的大小与对齐 与LLVM的数据布局相同
+        struct Layout
+        {
+            uint32_t size;
+            uint32_t align;
+        };
+
+        /// 表达式的值所在的寄存器与它的类型
+        struct Operand
+        {
+            uint16_t reg;
+            Type type;
+        };
+
+        /// 一层作用域
+        struct Scope
+        {
+            llvm::DenseMap<SymbolId, Variable> variables;
+            llvm::DenseMap<SymbolId, TypeNode *> aliases;
+        };
+
+        /// 子过程的参数与返回值类型 返回值为VOID时是过程
+        struct Signature
+        {
+            std::vector<Type> params;
+            Type result = Type::VOID;
+        };
+
+        class Lowering
+        {
+        public:
+            BytecodeProgram run(ProgramNode *program);
+
+        private:
+            /// 正在翻译的函数
+            struct FunctionState
+            {
+                BytecodeFunction function;
+                Scope locals;
+                /// 临时寄存器从这里开始 每条语句开始时回收
+                uint32_t first_temp = 0;
+                uint32_t next_register = 0;
+                uint32_t max_registers = 0;
+                /// 局部数组与记录占用的存储区大小
+                uint32_t memory = 0;
+                /// 变量位置到ArraySlot编号
+                llvm::DenseMap<uint64_t, uint16_t> arrays;
+            };
+
+            TypeNode *resolve(TypeNode *type);
+            uint32_t slot_count(TypeNode *type);
+            Layout layout(TypeNode *type);
+            const Variable &declare(IdentifierNode *name, TypeNode *type);
+            const Variable *lookup(SymbolId name);
+            const Variable &lookup_variable(LeftValueExprNode *node);
+
+            void subroutine(SubroutineNode *routine);
+            void declarations(HeadListNode *head);
+            void finish(FunctionState &state, uint32_t index);
+
+            uint16_t allocate();
+            uint16_t destination(int target);
+            size_t emit(Opcode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0);
+            size_t emit_wide(Opcode op, uint32_t a, uint32_t wide);
+            size_t here() const;
+            void patch(size_t jump, size_t target);
+
+            Operand expr(ExprNode *node, int target = -1);
+            Operand constant(ConstValueNode *node, int target);
+            Operand binop(BinaryOperator op, ExprNode *lhs_node, ExprNode *rhs_node, int target);
+            Operand call(RoutineCallNode *node, int target, bool want_value);
+            Operand syscall(SysRoutine routine, ArgListNode *args_node, int target, bool want_value);
+            Operand convert(Operand value, Type type, int target, const std::string &what);
+            uint16_t condition(ExprNode *node, const char *what);
+
+            /// 数组元素访问: 数组编号，下标所在的寄存器与元素类型
+            struct ElementRef
+            {
+                bool global;
+                uint16_t array;
+                uint16_t index;
+                Type type;
+            };
+            ElementRef element(ArrayRefNode *node);
+            /// 记录字段访问: 记录变量，字段相对记录的偏移与字段类型
+            struct FieldRef
+            {
+                const Variable *var;
+                uint32_t offset;
+                Type type;
+            };
+            FieldRef field(RecordRefNode *node);
+
+            void load(const Variable &var, uint32_t offset, Type type, uint16_t reg);
+            void store(const Variable &var, uint32_t offset, Type type, uint16_t reg);
+            void assign(LeftValueExprNode *lhs, ExprNode *rhs);
+            void stmt(AbstractNode *node);
+
+            BytecodeProgram program;
+            Scope globals;
+            FunctionState *current = nullptr;
+            bool in_subroutine = false;
+            /// 已声明的子过程 与代码生成一样只能调用在此之前声明的子过程
+            llvm::DenseMap<SymbolId, uint32_t> routines;
+            std::vector<Signature> signatures;
+        };
+
+        TypeNode *Lowering::resolve(TypeNode *type)
+        {
+            while (is_a_ptr_of<AliasTypeNode>(type))
+            {
+                auto alias = cast_node<AliasTypeNode>(type);
+                TypeNode *found = nullptr;
+                if (in_subroutine)
+                {
+                    auto it = current->locals.aliases.find(alias->identifier->id());
+                    if (it != current->locals.aliases.end()) found = it->second;
+                }
+                if (found == nullptr)
+                {
+                    auto it = globals.aliases.find(alias->identifier->id());
+                    if (it != globals.aliases.end()) found = it->second;
+                }
+                if (found == nullptr) throw CodegenException("undefined type: " + alias->identifier->name());
+                type = found;
+            }
+            return type;
+        }
+
+        uint32_t Lowering::slot_count(TypeNode *type)
+        {
+            type = resolve(type);
+            if (is_scalar(type->type)) return 1;
+            if (auto array = node_as<ArrayTypeNode>(type))
+                return static_cast<uint32_t>(array->range->length) * slot_count(array->element_type);
+            if (auto record = node_as<RecordTypeNode>(type))
+            {
+                uint32_t count = 0;
+                for (auto child : record->children()) count += slot_count(cast_node<VarDeclNode>(child)->type);
+                return count;
+            }
+            throw CodegenException("unsupported type: " + type2string(type->type));
+        }
+
+        Layout Lowering::layout(TypeNode *type)
+        {
+            type = resolve(type);
+            if (is_scalar(type->type)) return {scalar_size(type->type), scalar_size(type->type)};
+            if (auto array = node_as<ArrayTypeNode>(type))
+            {
+                auto element = layout(array->element_type);
+                return {static_cast<uint32_t>(array->range->length) * element.size, element.align};
+            }
+            if (auto record = node_as<RecordTypeNode>(type))
+            {
+                Layout result{0, 1};
+                for (auto child : record->children())
+                {
+                    auto field = layout(cast_node<VarDeclNode>(child)->type);
+                    result.size = align_to(result.size, field.align) + field.size;
+                    result.align = std::max(result.align, field.align);
+                }
+                result.size = align_to(result.size, result.align);
+                return result;
+            }
+            throw CodegenException("unsupported type: " + type2string(type->type));
+        }
+
+        const Variable &Lowering::declare(IdentifierNode *name, TypeNode *type)
+        {
+            type = resolve(type);
+            Variable var{type, !in_subroutine, false, 0};
+            auto &scope = in_subroutine ? current->locals : globals;
+            if (scope.variables.count(name->id()) || scope.aliases.count(name->id()))
+                throw CodegenException("duplicate identifier: " + name->name());
+            if (!in_subroutine)
+            {
+                var.offset = align_to(static_cast<uint32_t>(program.globals.size()), global_alignment);
+                program.globals.resize(var.offset + layout(type).size, 0);
+                program.symbols.push_back(GlobalSymbol{name->name(), var.offset});
+            }
+            else if (is_scalar(type->type))
+            {
+                var.in_register = true;
+                var.offset = allocate();
+            }
+            else
+            {
+                var.offset = current->memory;
+                current->memory += slot_count(type);
+            }
+            return scope.variables.insert({name->id(), var}).first->second;
+        }
+
+        const Variable *Lowering::lookup(SymbolId name)
+        {
+            if (in_subroutine)
+            {
+                auto it = current->locals.variables.find(name);
+                if (it != current->locals.variables.end()) return &it->second;
+            }
+            auto it = globals.variables.find(name);
+            return it != globals.variables.end() ? &it->second : nullptr;
+        }
+
+        const Variable &Lowering::lookup_variable(LeftValueExprNode *node)
+        {
+            auto var = lookup(node->id());
+            if (var == nullptr) throw CodegenException("identifier not found: " + node->name());
+            return *var;
+        }
+
+        uint16_t Lowering::allocate()
+        {
+            auto reg = current->next_register++;
+            if (reg > std::numeric_limits<uint16_t>::max())
+                throw CodegenException("routine is too large for the interpreter: " + current->function.name);
+            current->max_registers = std::max(current->max_registers, current->next_register);
+            return static_cast<uint16_t>(reg);
+        }
+
+        uint16_t Lowering::destination(int target)
+        {
+            return target >= 0 ? static_cast<uint16_t>(target) : allocate();
+        }
+
+        size_t Lowering::emit(Opcode op, uint32_t a, uint32_t b, uint32_t c)
+        {
+            Instruction inst;
+            inst.op = op;
+            inst.a = static_cast<uint16_t>(a);
+            inst.b = static_cast<uint16_t>(b);
+            inst.c = static_cast<uint16_t>(c);
+            current->function.code.push_back(inst);
+            return current->function.code.size() - 1;
+        }
+
+        size_t Lowering::emit_wide(Opcode op, uint32_t a, uint32_t wide)
+        {
+            auto index = emit(op, a);
+            current->function.code[index].set_wide(wide);
+            return index;
+        }
+
+        size_t Lowering::here() const
+        {
+            return current->function.code.size();
+        }
+
+        void Lowering::patch(size_t jump, size_t target)
+        {
+            current->function.code[jump].set_wide(static_cast<uint32_t>(target));
+        }
+
+        void Lowering::load(const Variable &var, uint32_t offset, Type type, uint16_t reg)
+        {
+            if (var.in_register)
+            {
+                if (var.offset != reg) emit(Opcode::MOVE, reg, var.offset);
+            }
+            else emit_wide(var.global ? typed(Opcode::GETGC, type) : Opcode::GETL, reg, var.offset + offset);
+        }
+
+        void Lowering::store(const Variable &var, uint32_t offset, Type type, uint16_t reg)
+        {
+            if (var.in_register)
+            {
+                if (var.offset != reg) emit(Opcode::MOVE, var.offset, reg);
+            }
+            else emit_wide(var.global ? typed(Opcode::SETGC, type) : Opcode::SETL, reg, var.offset + offset);
+        }
+
+        Operand Lowering::constant(ConstValueNode *node, int target)
+        {
+            auto reg = destination(target);
+            switch (node->kind())
+            {
+                case NodeKind::Boolean:
+                    emit_wide(Opcode::LOADI, reg, cast_node<BooleanNode>(node)->val ? 1 : 0);
+                    return {reg, Type::BOOLEAN};
+                case NodeKind::Integer:
+                    emit_wide(Opcode::LOADI, reg, static_cast<uint32_t>(cast_node<IntegerNode>(node)->val));
+                    return {reg, Type::INTEGER};
+                case NodeKind::Char:
+                    emit_wide(Opcode::LOADI, reg, static_cast<uint32_t>(static_cast<int8_t>(cast_node<CharNode>(node)->val)));
+                    return {reg, Type::CHAR};
+                case NodeKind::Real:
+                {
+                    VmValue value;
+                    value.f = cast_node<RealNode>(node)->val;
+                    auto &constants = current->function.constants;
+                    constants.push_back(value);
+                    emit_wide(Opcode::LOADK, reg, static_cast<uint32_t>(constants.size() - 1));
+                    return {reg, Type::REAL};
+                }
+                default:
+                    throw CodegenException("unsupported constant: " + type2string(node->type->type));
+            }
+        }
+
+        Operand Lowering::convert(Operand value, Type type, int target, const std::string &what)
+        {
+            if (type == Type::REAL && value.type == Type::INTEGER)
+            {
+                auto reg = destination(target);
+                emit(Opcode::I2F, reg, value.reg);
+                return {reg, Type::REAL};
+            }
+            if (type != value.type) throw CodegenException(what);
+            return value;
+        }
+
+        uint16_t Lowering::condition(ExprNode *node, const char *what)
+        {
+            auto value = expr(node);
+            if (value.type != Type::BOOLEAN)
+                throw CodegenException(std::string("incompatible type in ") + what + " condition: expected boolean");
+            return value.reg;
+        }
+
+        Lowering::ElementRef Lowering::element(ArrayRefNode *node)
+        {
+            auto var = lookup(node->id());
+            if (var == nullptr)
+                throw CodegenException("Undefined Identifier named \"" + node->identifier->name() + "\"");
+            auto array = node_as<ArrayTypeNode>(var->type);
+            if (array == nullptr)
+                throw CodegenException("Identifier \"" + node->identifier->name() + "\" is not a array!");
+            auto element_type = resolve(array->element_type)->type;
+            if (!is_scalar(element_type))
+                throw CodegenException("unsupported array element type: " + type2string(element_type));
+            auto key = static_cast<uint64_t>(var->global) << 32 | var->offset;
+            auto it = current->arrays.find(key);
+            if (it == current->arrays.end())
+            {
+                auto &arrays = current->function.arrays;
+                if (arrays.size() > std::numeric_limits<uint16_t>::max())
+                    throw CodegenException("too many arrays in routine: " + current->function.name);
+                arrays.push_back(ArraySlot{var->offset, array->range->low->val,
+                                           static_cast<uint32_t>(array->range->length)});
+                it = current->arrays.insert({key, static_cast<uint16_t>(arrays.size() - 1)}).first;
+            }
+            auto slot = it->second;
+            auto global = var->global;
+            auto index = expr(node->index);
+            if (!(index.type == Type::INTEGER || index.type == Type::CHAR || index.type == Type::BOOLEAN))
+                throw CodegenException("incompatible type in array index: " + node->identifier->name());
+            return {global, slot, index.reg, element_type};
+        }
+
+        Lowering::FieldRef Lowering::field(RecordRefNode *node)
+        {
+            auto var = lookup(node->id());
+            if (var == nullptr)
+                throw CodegenException("Undefined Identifier named \"" + node->identifier->name() + "\"");
+            auto record = node_as<RecordTypeNode>(var->type);
+            if (record == nullptr)
+                throw CodegenException("Identifier \"" + node->identifier->name() + "\" is not a record!");
+            //全局记录按LLVM的结构体布局，局部记录按存储区下标
+            uint32_t offset = 0;
+            for (auto child : record->children())
+            {
+                auto decl = cast_node<VarDeclNode>(child);
+                if (var->global) offset = align_to(offset, layout(decl->type).align);
+                if (decl->name->id() == node->field->id())
+                {
+                    auto type = resolve(decl->type);
+                    if (!is_scalar(type->type))
+                        throw CodegenException("unsupported record field type: " + node->field->name());
+                    return {var, offset, type->type};
+                }
+                offset += var->global ? layout(decl->type).size : slot_count(decl->type);
+            }
+            throw CodegenException("Record \"" + node->identifier->name() + "\" has no field named \"" +
+                                   node->field->name() + "\"");
+        }
+
+        Operand Lowering::expr(ExprNode *node, int target)
+        {
+            switch (node->kind())
+            {
+                case NodeKind::Boolean:
+                case NodeKind::Integer:
+                case NodeKind::Real:
+                case NodeKind::Char:
+                    return constant(cast_node<ConstValueNode>(node), target);
+                case NodeKind::Identifier:
+                {
+                    auto &var = lookup_variable(cast_node<IdentifierNode>(node));
+                    if (!is_scalar(var.type->type))
+                        throw CodegenException("unsupported use of " + type2string(var.type->type) + " value: " +
+                                               cast_node<IdentifierNode>(node)->name());
+                    if (var.in_register && target < 0) return {static_cast<uint16_t>(var.offset), var.type->type};
+                    auto reg = destination(target);
+                    load(var, 0, var.type->type, reg);
+                    return {reg, var.type->type};
+                }
+                case NodeKind::ArrayRef:
+                {
+                    auto ref = element(cast_node<ArrayRefNode>(node));
+                    auto reg = destination(target);
+                    emit(ref.global ? typed(Opcode::LDGAC, ref.type) : Opcode::LDLA, reg, ref.array, ref.index);
+                    return {reg, ref.type};
+                }
+                case NodeKind::RecordRef:
+                {
+                    auto ref = field(cast_node<RecordRefNode>(node));
+                    auto reg = destination(target);
+                    load(*ref.var, ref.offset, ref.type, reg);
+                    return {reg, ref.type};
+                }
+                case NodeKind::BinopExpr:
+                {
+                    auto binop_node = cast_node<BinopExprNode>(node);
+                    return binop(binop_node->op, binop_node->lhs, binop_node->rhs, target);
+                }
+                case NodeKind::FuncExpr:
+                {
+                    auto func_call = cast_node<FuncExprNode>(node)->func_call;
+                    if (auto routine_call = node_as<RoutineCallNode>(func_call))
+                        return call(routine_call, target, true);
+                    auto sys_call = cast_node<SysCallNode>(func_call);
+                    return syscall(sys_call->routine->routine, sys_call->args, target, true);
+                }
+                default:
+                    throw CodegenException("unsupported expression in the interpreter");
+            }
+        }
+
+        Operand Lowering::binop(BinaryOperator op, ExprNode *lhs_node, ExprNode *rhs_node, int target)
+        {
+            auto lhs = expr(lhs_node);
+            //加减一个小整数常量时用带立即数的指令
+            auto constant = node_as<IntegerNode>(rhs_node);
+            if (lhs.type == Type::INTEGER && constant != nullptr &&
+                (op == BinaryOperator::ADD || op == BinaryOperator::SUB) &&
+                constant->val >= std::numeric_limits<int16_t>::min() &&
+                constant->val <= std::numeric_limits<int16_t>::max())
+            {
+                auto reg = destination(target);
+                emit(op == BinaryOperator::ADD ? Opcode::ADDIK : Opcode::SUBIK, reg, lhs.reg,
+                     static_cast<uint16_t>(static_cast<int16_t>(constant->val)));
+                return {reg, Type::INTEGER};
+            }
+            auto rhs = expr(rhs_node);
+
+            Opcode opcode;
+            Type result = Type::BOOLEAN;
+            auto compare = [&](bool real) {
+                switch (op)
+                {
+                    case BinaryOperator::GT: opcode = real ? Opcode::GTF : Opcode::GTI; return true;
+                    case BinaryOperator::GE: opcode = real ? Opcode::GEF : Opcode::GEI; return true;
+                    case BinaryOperator::LT: opcode = real ? Opcode::LTF : Opcode::LTI; return true;
+                    case BinaryOperator::LE: opcode = real ? Opcode::LEF : Opcode::LEI; return true;
+                    case BinaryOperator::EQ: opcode = real ? Opcode::EQF : Opcode::EQI; return true;
+                    case BinaryOperator::NE: opcode = real ? Opcode::NEF : Opcode::NEI; return true;
+                    default: return false;
+                }
+            };
+            if (lhs.type == Type::BOOLEAN && rhs.type == Type::BOOLEAN)
+            {
+                if (!compare(false))
+                {
+                    switch (op)
+                    {
+                        case BinaryOperator::AND: opcode = Opcode::AND; break;
+                        case BinaryOperator::OR:  opcode = Opcode::OR; break;
+                        case BinaryOperator::XOR: opcode = Opcode::XOR; break;
+                        default: throw CodegenException("operator is invalid: boolean " + to_string(op) + " boolean");
+                    }
+                }
+            }
+            else if (lhs.type == Type::INTEGER && rhs.type == Type::INTEGER)
+            {
+                if (!compare(false))
+                {
+                    result = Type::INTEGER;
+                    switch (op)
+                    {
+                        case BinaryOperator::ADD: opcode = Opcode::ADDI; break;
+                        case BinaryOperator::SUB: opcode = Opcode::SUBI; break;
+                        case BinaryOperator::MUL: opcode = Opcode::MULI; break;
+                        case BinaryOperator::DIV: opcode = Opcode::DIVI; break;
+                        case BinaryOperator::MOD: opcode = Opcode::MODI; break;
+                        case BinaryOperator::AND: opcode = Opcode::AND; break;
+                        case BinaryOperator::OR: opcode = Opcode::OR; break;
+                        case BinaryOperator::XOR: opcode = Opcode::XOR; break;
+                        case BinaryOperator::TRUEDIV:
+                            lhs = convert(lhs, Type::REAL, -1, "");
+                            rhs = convert(rhs, Type::REAL, -1, "");
+                            opcode = Opcode::DIVF;
+                            result = Type::REAL;
+                            break;
+                        default: throw CodegenException("operator is invalid: integer " + to_string(op) + " integer");
+                    }
+                }
+            }
+            else if (lhs.type == Type::REAL || rhs.type == Type::REAL)
+            {
+                auto mismatch = "operator is invalid: " + to_string(op) + " between different types";
+                lhs = convert(lhs, Type::REAL, -1, mismatch);
+                rhs = convert(rhs, Type::REAL, -1, mismatch);
+                if (!compare(true))
+                {
+                    result = Type::REAL;
+                    switch (op)
+                    {
+                        case BinaryOperator::ADD: opcode = Opcode::ADDF; break;
+                        case BinaryOperator::SUB: opcode = Opcode::SUBF; break;
+                        case BinaryOperator::MUL: opcode = Opcode::MULF; break;
+                        case BinaryOperator::TRUEDIV: opcode = Opcode::DIVF; break;
+                        default: throw CodegenException("operator is invalid: real " + to_string(op) + " real");
+                    }
+                }
+            }
+            else if (lhs.type == Type::CHAR && rhs.type == Type::CHAR)
+            {
+                if (!compare(false))
+                    throw CodegenException("operator is invalid: char " + to_string(op) + " char");
+            }
+            else
+            {
+                throw CodegenException("operator is invalid: " + to_string(op) + " between different types");
+            }
+            auto reg = destination(target);
+            emit(opcode, reg, lhs.reg, rhs.reg);
+            return {reg, result};
+        }
+
+        Operand Lowering::call(RoutineCallNode *node, int target, bool want_value)
+        {
+            auto it = routines.find(node->identifier->id());
+            SysRoutine routine;
+            //没有同名的用户函数时才是预定义的数学函数
+            if (it == routines.end() && predeclared_routine(node->identifier->name(), routine))
+                return syscall(routine, node->args, target, want_value);
+            if (it == routines.end())
+                throw CodegenException("routine not found: " + node->identifier->name() + "()");
+            auto index = it->second;
+            const auto &signature = signatures[index];
+            const auto &args = node->args->children();
+            if (signature.params.size() != args.size())
+                throw CodegenException("wrong number of arguments: " + node->identifier->name() + "()");
+            if (signature.result == Type::VOID && want_value)
+                throw CodegenException("procedure has no value: " + node->identifier->name() + "()");
+
+            //参数放在连续的寄存器中，先全部分配好，计算参数时的临时值在它们之后
+            auto base = current->next_register;
+            for (size_t i = 0; i < args.size(); ++i) allocate();
+            for (size_t i = 0; i < args.size(); ++i)
+            {
+                auto reg = static_cast<int>(base + i);
+                auto value = expr(cast_node<ExprNode>(args[i]), reg);
+                convert(value, signature.params[i], reg,
+                        "incompatible type in arguments: " + node->identifier->name() + "()");
+            }
+            auto result = signature.result == Type::VOID ? 0 : destination(target);
+            if (base > std::numeric_limits<uint16_t>::max())
+                throw CodegenException("routine is too large for the interpreter: " + current->function.name);
+            emit(Opcode::CALL, result, index, base);
+            return {static_cast<uint16_t>(result), signature.result};
+        }
+
+        Operand Lowering::syscall(SysRoutine routine, ArgListNode *args_node, int target, bool want_value)
+        {
+            const auto &args = args_node->children();
+            auto single = [&](const char *name) {
+                if (args.size() != 1) throw CodegenException(std::string("wrong number of arguments: ") + name + "()");
+                return expr(cast_node<ExprNode>(args.front()));
+            };
+            switch (routine)
+            {
+                case SysRoutine::WRITE:
+                case SysRoutine::WRITELN:
+                case SysRoutine::READ:
+                case SysRoutine::READLN:
+                    if (want_value) throw CodegenException("built-in routine has no value: " + to_string(routine));
+                    break;
+                default:
+                    break;
+            }
+            switch (routine)
+            {
+                case SysRoutine::WRITE:
+                case SysRoutine::WRITELN:
+                {
+                    for (auto arg : args)
+                    {
+                        if (auto string = node_as<StringNode>(arg))
+                        {
+                            program.strings.push_back(string->val);
+                            emit_wide(Opcode::WRITES, 0, static_cast<uint32_t>(program.strings.size() - 1));
+                            continue;
+                        }
+                        auto value = expr(cast_node<ExprNode>(arg));
+                        switch (value.type)
+                        {
+                            case Type::CHAR: emit(Opcode::WRITEC, value.reg); break;
+                            case Type::BOOLEAN:
+                            case Type::INTEGER: emit(Opcode::WRITEI, value.reg); break;
+                            case Type::REAL: emit(Opcode::WRITEF, value.reg); break;
+                            default: throw CodegenException("incompatible type in write(): expected char, integer, real");
+                        }
+                    }
+                    if (routine == SysRoutine::WRITELN) emit(Opcode::WRITELN);
+                    return {0, Type::VOID};
+                }
+                case SysRoutine::READ:
+                case SysRoutine::READLN:
+                {
+                    for (auto arg : args)
+                    {
+                        auto identifier = node_as<IdentifierNode>(arg);
+                        if (identifier == nullptr) throw CodegenException("read() expects variables");
+                        auto &var = lookup_variable(identifier);
+                        Opcode opcode;
+                        switch (var.type->type)
+                        {
+                            case Type::CHAR: opcode = Opcode::READC; break;
+                            case Type::INTEGER: opcode = Opcode::READI; break;
+                            case Type::REAL: opcode = Opcode::READF; break;
+                            default: throw CodegenException("incompatible type in read(): expected char, integer, real");
+                        }
+                        if (var.in_register)
+                        {
+                            emit(opcode, var.offset);
+                            continue;
+                        }
+                        //读入失败时变量保持原值，所以先取出原值
+                        auto reg = allocate();
+                        load(var, 0, var.type->type, reg);
+                        emit(opcode, reg);
+                        store(var, 0, var.type->type, reg);
+                    }
+                    if (routine == SysRoutine::READLN) emit(Opcode::READLN);
+                    return {0, Type::VOID};
+                }
+                case SysRoutine::ABS:
+                {
+                    auto value = single("abs");
+                    if (value.type != Type::INTEGER && value.type != Type::REAL)
+                        throw CodegenException("incompatible type in abs(): expected integer, real");
+                    auto reg = destination(target);
+                    emit(value.type == Type::INTEGER ? Opcode::ABSI : Opcode::ABSF, reg, value.reg);
+                    return {reg, value.type};
+                }
+                case SysRoutine::SQR:
+                {
+                    auto value = single("sqr");
+                    if (value.type != Type::INTEGER && value.type != Type::REAL)
+                        throw CodegenException("incompatible type in sqr(): expected integer, real");
+                    auto reg = destination(target);
+                    emit(value.type == Type::INTEGER ? Opcode::SQRI : Opcode::SQRF, reg, value.reg);
+                    return {reg, value.type};
+                }
+                case SysRoutine::SQRT:
+                case SysRoutine::SIN:
+                case SysRoutine::COS:
+                case SysRoutine::ARCTAN:
+                case SysRoutine::EXP:
+                case SysRoutine::LN:
+                {
+                    auto name = to_string(routine);
+                    auto value = convert(single(name.c_str()), Type::REAL, -1,
+                                         "incompatible type in " + name + "(): expected integer, real");
+                    auto reg = destination(target);
+                    auto opcode = routine == SysRoutine::SQRT ? Opcode::SQRTF
+                                  : routine == SysRoutine::SIN ? Opcode::SINF
+                                  : routine == SysRoutine::COS ? Opcode::COSF
+                                  : routine == SysRoutine::ARCTAN ? Opcode::ATANF
+                                  : routine == SysRoutine::EXP ? Opcode::EXPF : Opcode::LNF;
+                    emit(opcode, reg, value.reg);
+                    return {reg, Type::REAL};
+                }
+                case SysRoutine::ROUND:
+                case SysRoutine::TRUNC:
+                {
+                    auto name = to_string(routine);
+                    auto value = single(name.c_str());
+                    if (value.type == Type::INTEGER) //整数不变
+                    {
+                        if (target < 0 || value.reg == target) return value;
+                        emit(Opcode::MOVE, target, value.reg);
+                        return {static_cast<uint16_t>(target), Type::INTEGER};
+                    }
+                    if (value.type != Type::REAL)
+                        throw CodegenException("incompatible type in " + name + "(): expected integer, real");
+                    auto reg = destination(target);
+                    emit(routine == SysRoutine::ROUND ? Opcode::ROUNDF : Opcode::TRUNCF, reg, value.reg);
+                    return {reg, Type::INTEGER};
+                }
+                case SysRoutine::ODD:
+                {
+                    auto value = single("odd");
+                    if (value.type != Type::INTEGER)
+                        throw CodegenException("incompatible type in odd(): expected integer");
+                    auto reg = destination(target);
+                    emit(Opcode::ODD, reg, value.reg);
+                    return {reg, Type::BOOLEAN};
+                }
+                case SysRoutine::CHR:
+                {
+                    auto value = single("chr");
+                    if (value.type != Type::INTEGER)
+                        throw CodegenException("incompatible type in chr(): expected integer");
+                    auto reg = destination(target);
+                    emit(Opcode::CHR, reg, value.reg);
+                    return {reg, Type::CHAR};
+                }
+                case SysRoutine::ORD:
+                case SysRoutine::PRED:
+                case SysRoutine::SUCC:
+                {
+                    auto name = to_string(routine);
+                    auto value = single(name.c_str());
+                    if (value.type != Type::CHAR)
+                        throw CodegenException("incompatible type in " + name + "(): expected char");
+                    auto reg = destination(target);
+                    auto opcode = routine == SysRoutine::ORD ? Opcode::ORD
+                                  : routine == SysRoutine::PRED ? Opcode::PRED : Opcode::SUCC;
+                    emit(opcode, reg, value.reg);
+                    return {reg, routine == SysRoutine::ORD ? Type::INTEGER : Type::CHAR};
+                }
+                default:
+                    throw CodegenException("unsupported built-in routine: " + to_string(routine));
+            }
+        }
+
+        void Lowering::assign(LeftValueExprNode *lhs, ExprNode *rhs)
+        {
+            auto mismatch = "incompatible type in assignments: " + lhs->name();
+            if (auto array_ref = node_as<ArrayRefNode>(lhs))
+            {
+                auto ref = element(array_ref);
+                auto value = convert(expr(rhs), ref.type, -1, mismatch);
+                emit(ref.global ? typed(Opcode::STGAC, ref.type) : Opcode::STLA, value.reg, ref.array, ref.index);
+                return;
+            }
+            if (auto record_ref = node_as<RecordRefNode>(lhs))
+            {
+                auto ref = field(record_ref);
+                auto value = convert(expr(rhs), ref.type, -1, mismatch);
+                store(*ref.var, ref.offset, ref.type, value.reg);
+                return;
+            }
+            auto &var = lookup_variable(lhs);
+            if (!is_scalar(var.type->type)) throw CodegenException(mismatch);
+            //局部变量直接作为表达式的目标寄存器
+            auto target = var.in_register ? static_cast<int>(var.offset) : -1;
+            auto value = convert(expr(rhs, target), var.type->type, target, mismatch);
+            store(var, 0, var.type->type, value.reg);
+        }
+
+        void Lowering::stmt(AbstractNode *node)
+        {
+            if (node == nullptr) return;
+            current->next_register = current->first_temp; //上一条语句的临时寄存器都不再使用
+            switch (node->kind())
+            {
+                case NodeKind::CompoundStmt:
+                    for (auto child : node->children()) stmt(child);
+                    return;
+                case NodeKind::AssignStmt:
+                {
+                    auto assign_stmt = cast_node<AssignStmtNode>(node);
+                    assign(cast_node<LeftValueExprNode>(assign_stmt->lhs), assign_stmt->rhs);
+                    return;
+                }
+                case NodeKind::ProcStmt:
+                {
+                    auto proc_call = cast_node<ProcStmtNode>(node)->proc_call;
+                    if (auto routine_call = node_as<RoutineCallNode>(proc_call))
+                        call(routine_call, -1, false);
+                    else
+                    {
+                        auto sys_call = cast_node<SysCallNode>(proc_call);
+                        syscall(sys_call->routine->routine, sys_call->args, -1, false);
+                    }
+                    return;
+                }
+                case NodeKind::IfStmt:
+                {
+                    auto if_stmt = cast_node<IfStmtNode>(node);
+                    auto skip_then = emit_wide(Opcode::JMPF, condition(if_stmt->expr, "if"), 0);
+                    stmt(if_stmt->stmt);
+                    auto else_stmt = if_stmt->else_stmt;
+                    if (else_stmt == nullptr ||
+                        (is_a_ptr_of<CompoundStmtNode>(else_stmt) && else_stmt->children().empty()))
+                    {
+                        patch(skip_then, here());
+                        return;
+                    }
+                    auto skip_else = emit_wide(Opcode::JMP, 0, 0);
+                    patch(skip_then, here());
+                    stmt(else_stmt);
+                    patch(skip_else, here());
+                    return;
+                }
+                case NodeKind::WhileStmt:
+                {
+                    auto while_stmt = cast_node<WhileStmtNode>(node);
+                    auto top = here();
+                    auto exit = emit_wide(Opcode::JMPF, condition(while_stmt->expr, "while"), 0);
+                    stmt(while_stmt->stmt);
+                    emit_wide(Opcode::LOOP, 0, static_cast<uint32_t>(top));
+                    patch(exit, here());
+                    return;
+                }
+                case NodeKind::RepeatStmt:
+                {
+                    auto repeat_stmt = cast_node<RepeatStmtNode>(node);
+                    auto top = here();
+                    for (auto child : repeat_stmt->children()) stmt(child);
+                    current->next_register = current->first_temp;
+                    emit_wide(Opcode::LOOPF, condition(repeat_stmt->expr, "repeat"), static_cast<uint32_t>(top));
+                    return;
+                }
+                case NodeKind::ForStmt:
+                {
+                    //与代码生成相同: 初值与终值只计算一次，循环变量的值放在寄存器中，每次迭代开始时写回变量，
+                    //先与终值比较再递增，终值为maxint时也不会越界
+                    auto for_stmt = cast_node<ForStmtNode>(node);
+                    auto &var = lookup_variable(for_stmt->identifier);
+                    if (var.type->type != Type::INTEGER)
+                        throw CodegenException("incompatible type in for iterator: expected int");
+                    auto upto = for_stmt->direction == DirectionEnum::TO;
+                    //计数器与终值所在的寄存器在循环体中不能回收
+                    auto first_temp = current->first_temp;
+                    auto counter = allocate();
+                    auto bound = allocate();
+                    current->first_temp = current->next_register;
+                    auto mismatch = "incompatible type in for bound: expected int";
+                    auto start = convert(expr(for_stmt->start, counter), Type::INTEGER, counter, mismatch);
+                    if (start.reg != counter) emit(Opcode::MOVE, counter, start.reg);
+                    auto finish = convert(expr(for_stmt->finish, bound), Type::INTEGER, bound, mismatch);
+                    if (finish.reg != bound) emit(Opcode::MOVE, bound, finish.reg);
+                    auto enter = allocate();
+                    emit(upto ? Opcode::LEI : Opcode::GEI, enter, counter, bound);
+                    auto skip = emit_wide(Opcode::JMPF, enter, 0);
+                    auto top = here();
+                    store(var, 0, Type::INTEGER, counter);
+                    stmt(for_stmt->stmt);
+                    current->next_register = current->first_temp;
+                    auto done = allocate();
+                    emit(Opcode::EQI, done, counter, bound);
+                    emit(upto ? Opcode::ADDIK : Opcode::SUBIK, counter, counter, 1);
+                    emit_wide(Opcode::LOOPF, done, static_cast<uint32_t>(top));
+                    patch(skip, here());
+                    current->first_temp = first_temp;
+                    return;
+                }
+                case NodeKind::CaseStmt:
+                {
+                    auto case_stmt = cast_node<CaseStmtNode>(node);
+                    auto value = expr(case_stmt->expr);
+                    if (!(value.type == Type::INTEGER || value.type == Type::CHAR || value.type == Type::BOOLEAN))
+                        throw CodegenException("incompatible type in case statement: expected integer");
+                    auto &cases = current->function.cases;
+                    if (cases.size() > std::numeric_limits<uint16_t>::max())
+                        throw CodegenException("too many case statements in routine: " + current->function.name);
+                    auto table_index = cases.size();
+                    cases.emplace_back();
+                    emit(Opcode::SWITCH, value.reg, static_cast<uint32_t>(table_index));
+                    CaseTable table;
+                    std::vector<size_t> exits;
+                    for (auto child : case_stmt->children())
+                    {
+                        auto branch = cast_node<CaseExprNode>(child);
+                        int64_t label;
+                        switch (branch->branch->kind())
+                        {
+                            case NodeKind::Integer: label = cast_node<IntegerNode>(branch->branch)->val; break;
+                            case NodeKind::Char: label = static_cast<int8_t>(cast_node<CharNode>(branch->branch)->val); break;
+                            case NodeKind::Boolean: label = cast_node<BooleanNode>(branch->branch)->val; break;
+                            default: throw CodegenException("case label must be a constant");
+                        }
+                        table.targets.emplace_back(label, static_cast<uint32_t>(here()));
+                        stmt(branch->stmt);
+                        exits.push_back(emit_wide(Opcode::JMP, 0, 0));
+                    }
+                    for (auto exit : exits) patch(exit, here());
+                    table.otherwise = static_cast<uint32_t>(here());
+                    //相同的值只有第一个分支有效
+                    std::stable_sort(table.targets.begin(), table.targets.end(),
+                                     [](const std::pair<int64_t, uint32_t> &lhs, const std::pair<int64_t, uint32_t> &rhs) {
+                                         return lhs.first < rhs.first;
+                                     });
+                    cases[table_index] = std::move(table);
+                    return;
+                }
+                default:
+                    throw CodegenException("unsupported statement in the interpreter");
+            }
+        }
+
+        void Lowering::declarations(HeadListNode *head)
+        {
+            auto &scope = in_subroutine ? current->locals : globals;
+            for (auto child : head->const_list->children())
+            {
+                auto decl = cast_node<ConstDeclNode>(child);
+                if (!in_subroutine && is_a_ptr_of<StringNode>(decl->value)) continue; //与代码生成一样不进符号表
+                auto &var = declare(decl->name, decl->value->type);
+                if (var.in_register)
+                {
+                    constant(decl->value, static_cast<int>(var.offset));
+                    continue;
+                }
+                auto *value = &program.globals[var.offset];
+                switch (decl->value->kind())
+                {
+                    case NodeKind::Boolean: *value = cast_node<BooleanNode>(decl->value)->val; break;
+                    case NodeKind::Char: *value = static_cast<uint8_t>(cast_node<CharNode>(decl->value)->val); break;
+                    case NodeKind::Integer:
+                    {
+                        int32_t integer = cast_node<IntegerNode>(decl->value)->val;
+                        std::memcpy(value, &integer, sizeof(integer));
+                        break;
+                    }
+                    case NodeKind::Real:
+                    {
+                        double real = cast_node<RealNode>(decl->value)->val;
+                        std::memcpy(value, &real, sizeof(real));
+                        break;
+                    }
+                    default: throw CodegenException("unsupported constant: " + decl->name->name());
+                }
+            }
+            for (auto child : head->type_list->children())
+            {
+                auto def = cast_node<TypeDefNode>(child);
+                if (scope.aliases.count(def->name->id()) || scope.variables.count(def->name->id()))
+                    throw CodegenException("duplicate type alias: \"" + def->name->name() + "\"");
+                scope.aliases[def->name->id()] = def->type;
+            }
+            for (auto child : head->var_list->children())
+            {
+                auto decl = cast_node<VarDeclNode>(child);
+                declare(decl->name, decl->type);
+            }
+        }
+
+        void Lowering::finish(FunctionState &state, uint32_t index)
+        {
+            auto &function = state.function;
+            function.registers = static_cast<uint16_t>(std::max(state.max_registers, state.next_register));
+            function.frame_size = function.registers + state.memory;
+            program.functions[index] = std::move(function);
+        }
+
+        void Lowering::subroutine(SubroutineNode *routine)
+        {
+            auto name = routine->name->id();
+            if (routines.count(name)) throw CodegenException("duplicate routine: " + routine->name->name());
+            Signature signature;
+            for (auto child : routine->params->children())
+            {
+                auto type = resolve(cast_node<ParamDeclNode>(child)->type)->type;
+                if (!is_scalar(type)) throw CodegenException("unsupported parameter type: " + type2string(type));
+                signature.params.push_back(type);
+            }
+            auto returns_value = routine->return_type->type != Type::VOID;
+            if (returns_value)
+            {
+                signature.result = resolve(routine->return_type)->type;
+                if (!is_scalar(signature.result))
+                    throw CodegenException("unsupported return type: " + type2string(signature.result));
+            }
+            auto index = static_cast<uint32_t>(program.functions.size());
+            if (index > std::numeric_limits<uint16_t>::max())
+                throw CodegenException("too many routines for the interpreter");
+            program.functions.emplace_back();
+            signatures.push_back(signature);
+            routines[name] = index;
+
+            FunctionState state;
+            state.function.name = routine->name->name();
+            state.function.params = static_cast<uint16_t>(signature.params.size());
+            auto outer = current;
+            auto outer_in_subroutine = in_subroutine;
+            current = &state;
+            in_subroutine = true;
+
+            //寄存器的顺序: 参数，返回值，常量与变量
+            for (auto child : routine->params->children())
+            {
+                auto decl = cast_node<ParamDeclNode>(child);
+                declare(decl->name, decl->type);
+            }
+            auto result_reg = returns_value ? declare(routine->name, routine->return_type).offset : 0;
+            declarations(routine->head_list);
+            for (auto child : routine->head_list->subroutine_list->children())
+                subroutine(cast_node<SubroutineNode>(child));
+
+            state.first_temp = state.next_register;
+            for (auto child : routine->children()) stmt(child);
+            if (returns_value) emit(Opcode::RET, result_reg);
+            else emit(Opcode::RETV);
+
+            finish(state, index);
+            current = outer;
+            in_subroutine = outer_in_subroutine;
+        }
+
+        BytecodeProgram Lowering::run(ProgramNode *program_node)
+        {
+            FunctionState state;
+            state.function.name = "main";
+            current = &state;
+            in_subroutine = false;
+            declarations(program_node->head_list);
+            for (auto child : program_node->head_list->subroutine_list->children())
+                subroutine(cast_node<SubroutineNode>(child));
+
+            for (auto child : program_node->children()) stmt(child);
+            state.next_register = state.first_temp;
+            auto status = allocate();
+            emit_wide(Opcode::LOADI, status, 0);
+            emit(Opcode::RET, status);
+
+            program.main = static_cast<uint32_t>(program.functions.size());
+            program.functions.emplace_back();
+            finish(state, program.main);
+            return std::move(program);
+        }
+    }
+
+    BytecodeProgram lower_to_bytecode(ProgramNode *program)
+    {
+        return Lowering().run(program);
+    }
+}
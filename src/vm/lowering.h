@@ -0,0 +1,27 @@
+/**
+ * @file lowering.h
+ * @brief 把语法树翻译成字节码. 类型检查与隐式转换的规则与LLVM代码生成一致，出错时同样抛出CodegenException
+ * @version 0.1
+ * @date 2021-06-19
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#ifndef NAIVE_PASCAL_COMPILER_LOWERING_H
+#define NAIVE_PASCAL_COMPILER_LOWERING_H
+
+#include "ast/ast_base.h"
+#include "bytecode.h"
+
+namespace spc
+{
+    /**
+     * @brief 翻译整个程序 返回的字节码不再引用语法树，语法树可以随后释放
+     *
+     * @param program 语法树根节点
+     * @return BytecodeProgram
+     */
+    BytecodeProgram lower_to_bytecode(ProgramNode *program);
+}
+
+#endif //NAIVE_PASCAL_COMPILER_LOWERING_H
@@ -0,0 +1,29 @@
+{数学函数测试样例
+ 期望输出:
+7 2.500000 1.414214 49 6.250000
+0.000000 1.000000 0.785398 2.718282 2.302585
+3 -3 0 2 -2
+1 0 1
+4.000000 1.000000 0.000000
+4.000000
+}
+program prog;
+var
+  i: integer;
+  x: real;
+  v: array [1..4] of real;
+
+begin
+  writeln(abs(-7), ' ', abs(-2.5), ' ', sqrt(2.0), ' ', sqr(7), ' ', sqr(2.5));
+  writeln(sin(0.0), ' ', cos(0.0), ' ', arctan(1.0), ' ', exp(1.0), ' ', ln(10.0));
+  { round: halves away from zero; trunc: towards zero }
+  writeln(round(2.5), ' ', round(-2.5), ' ', round(0.4), ' ', trunc(2.9), ' ', trunc(-2.9));
+  writeln(odd(7), ' ', odd(-4), ' ', odd(-3));
+  { integer arguments are converted to real }
+  writeln(sqrt(16), ' ', exp(0), ' ', ln(1));
+  { a loop over a real array }
+  for i := 1 to 4 do v[i] := i;
+  x := 0.0;
+  for i := 1 to 4 do x := x + sin(v[i]) * sin(v[i]) + cos(v[i]) * cos(v[i]);
+  writeln(x);
+end.
@@ -0,0 +1,43 @@
+{for循环测试样例: downto，空区间，边界为maxint与-maxint-1，终值只计算一次
+ 期望输出:
+5 4 3 2 1 
+empty: 0
+to maxint: 3
+downto -maxint-1: 3
+bound once: 3 6
+}
+program prog;
+var
+  i, n, count, low: integer;
+
+begin
+  { downto }
+  for i := 5 downto 1 do write(i, ' ');
+  writeln();
+
+  { empty ranges }
+  count := 0;
+  for i := 1 to 0 do count := count + 1;
+  for i := 0 downto 1 do count := count + 1;
+  writeln('empty: ', count);
+
+  { upper bound is maxint }
+  count := 0;
+  for i := 2147483645 to 2147483647 do count := count + 1;
+  writeln('to maxint: ', count);
+
+  { lower bound is -maxint-1 }
+  low := -2147483647 - 1;
+  count := 0;
+  for i := low + 2 downto low do count := count + 1;
+  writeln('downto -maxint-1: ', count);
+
+  { the bounds are evaluated once }
+  n := 3;
+  count := 0;
+  for i := 1 to n do begin
+    n := n + 1;
+    count := count + 1;
+  end;
+  writeln('bound once: ', count, ' ', n);
+end.
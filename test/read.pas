@@ -0,0 +1,33 @@
+{read/readln测试样例: 读入整数与实数
+ 输入:
+3   -7
+
+ 12 ignored
+2.5 -0.125 1e2 rest
+1 2 3 4 5
+ 期望输出:
+3 -7 12
+2.500000 -0.125000 100.000000
+sum = 15
+}
+program prog;
+var
+  a, b, c, i, sum: integer;
+  x, y, z: real;
+
+begin
+  { integers separated by spaces and line breaks }
+  read(a, b);
+  readln(c);
+  writeln(a, ' ', b, ' ', c);
+  { reals, including integer and exponent forms; readln drops the rest of the line }
+  readln(x, y, z);
+  writeln(x, ' ', y, ' ', z);
+  { many integers on one line }
+  sum := 0;
+  for i := 1 to 5 do begin
+    read(a);
+    sum := sum + a;
+  end;
+  writeln('sum = ', sum);
+end.
@@ -0,0 +1,19 @@
+{预定义的数学函数可以被同名的变量与函数覆盖
+ 期望输出:
+3 42 2 9
+}
+program prog;
+var
+  exp: integer;
+  x: real;
+
+function round(x: real): integer;
+begin
+  round := 42;
+end;
+
+begin
+  exp := 3;
+  x := 2.5;
+  writeln(exp, ' ', round(x), ' ', trunc(x), ' ', sqr(exp));
+end.
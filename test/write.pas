@@ -0,0 +1,35 @@
+{write/writeln测试样例: 各种类型的参数合并输出，有副作用的参数按顺序输出
+ 期望输出:
+x = 0, r = 2.500000, ch = z, 42 1.500000
+no newline
+100% %d
+before 0 call <bump>1 after 1
+<bump>11<bump>111
+}
+program prog;
+var
+  x: integer;
+  r: real;
+  ch: char;
+
+function bump(d: integer): integer;
+begin
+  write('<bump>');
+  x := x + d;
+  bump := x;
+end;
+
+begin
+  x := 0;
+  r := 2.5;
+  ch := 'z';
+  { constants, integers, reals and chars in one statement }
+  writeln('x = ', x, ', r = ', r, ', ch = ', ch, ', ', 42, ' ', 1.5);
+  write('no ');
+  write('newline');
+  writeln();
+  writeln('100%', ' ', '%d');
+  { arguments with side effects are written in order }
+  writeln('before ', x, ' call ', bump(1), ' after ', x);
+  writeln(bump(10), bump(100));
+end.